@@ -809,10 +809,22 @@ void create_next_audio_buffer(s16 *samples, u32 num_samples) {
 /**
  * Called from threads: thread5_game_loop
  */
+// libsm64: set while a speculative Mario is bound, the sounds it requests are dropped
+static THREAD_LOCAL u8 sSoundRequestsMuted = FALSE;
+
+void set_sound_requests_muted(u8 muted) {
+    sSoundRequestsMuted = muted;
+}
+
 void play_sound(s32 soundBits, f32 *pos) {
-    sSoundRequests[sSoundRequestCount].soundBits = soundBits;
-    sSoundRequests[sSoundRequestCount].position = pos;
-    sSoundRequestCount++;
+    if (sSoundRequestsMuted) {
+        return;
+    }
+
+    // libsm64: Marios ticked on different threads can request sounds at the same time
+    u8 index = __atomic_fetch_add(&sSoundRequestCount, 1, __ATOMIC_RELAXED);
+    sSoundRequests[index].soundBits = soundBits;
+    sSoundRequests[index].position = pos;
 	//DEBUG_PRINT("play_sound(%d) request#%d; pos %f %f %f\n", soundBits,sSoundRequestCount,pos[0],pos[1],pos[2]);
 }
 
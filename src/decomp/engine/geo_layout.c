@@ -46,11 +46,11 @@ GeoLayoutCommandProc GeoLayoutJumpTable[] = {
     geo_layout_cmd_node_culling_radius,
 };
 
-struct GraphNode gObjParentGraphNode;
-struct AllocOnlyPool *gGraphNodePool;
-struct GraphNode *gCurRootGraphNode;
+THREAD_LOCAL struct GraphNode gObjParentGraphNode;
+THREAD_LOCAL struct AllocOnlyPool *gGraphNodePool;
+THREAD_LOCAL struct GraphNode *gCurRootGraphNode;
 
-UNUSED s32 D_8038BCA8;
+THREAD_LOCAL UNUSED s32 D_8038BCA8;
 
 /* The gGeoViews array is a mysterious one. Some background:
  *
@@ -91,18 +91,18 @@ UNUSED s32 D_8038BCA8;
  * so everything was reduced to a single ObjectParent with a single group, and
  * camera switching was all done in one node. End of speculation.
  */
-struct GraphNode **gGeoViews;
-u16 gGeoNumViews; // length of gGeoViews array
-
-uintptr_t gGeoLayoutStack[16];
-struct GraphNode *gCurGraphNodeList[32];
-s16 gCurGraphNodeIndex;
-s16 gGeoLayoutStackIndex; // similar to SP register in MIPS
-UNUSED s16 D_8038BD7C;
-s16 gGeoLayoutReturnIndex; // similar to RA register in MIPS
-u8 *gGeoLayoutCommand;
-
-u32 unused_8038B894[3] = { 0 };
+THREAD_LOCAL struct GraphNode **gGeoViews;
+THREAD_LOCAL u16 gGeoNumViews; // length of gGeoViews array
+
+THREAD_LOCAL uintptr_t gGeoLayoutStack[16];
+THREAD_LOCAL struct GraphNode *gCurGraphNodeList[32];
+THREAD_LOCAL s16 gCurGraphNodeIndex;
+THREAD_LOCAL s16 gGeoLayoutStackIndex; // similar to SP register in MIPS
+THREAD_LOCAL UNUSED s16 D_8038BD7C;
+THREAD_LOCAL s16 gGeoLayoutReturnIndex; // similar to RA register in MIPS
+THREAD_LOCAL u8 *gGeoLayoutCommand;
+
+THREAD_LOCAL u32 unused_8038B894[3] = { 0 };
 
 /*
   0x00: Branch and store return address
@@ -29,19 +29,19 @@
 #define cur_geo_cmd_ptr(offset) \
     (*(void **) &gGeoLayoutCommand[CMD_PROCESS_OFFSET(offset)])
 
-extern struct AllocOnlyPool *gGraphNodePool;
-extern struct GraphNode *gCurRootGraphNode;
-extern UNUSED s32 D_8038BCA8;
-extern struct GraphNode **gGeoViews;
-extern u16 gGeoNumViews;
-extern uintptr_t gGeoLayoutStack[];
-extern struct GraphNode *gCurGraphNodeList[];
-extern s16 gCurGraphNodeIndex;
-extern s16 gGeoLayoutStackIndex;
-extern UNUSED s16 D_8038BD7C;
-extern s16 gGeoLayoutReturnIndex;
-extern u8 *gGeoLayoutCommand;
-extern struct GraphNode gObjParentGraphNode;
+extern THREAD_LOCAL struct AllocOnlyPool *gGraphNodePool;
+extern THREAD_LOCAL struct GraphNode *gCurRootGraphNode;
+extern THREAD_LOCAL UNUSED s32 D_8038BCA8;
+extern THREAD_LOCAL struct GraphNode **gGeoViews;
+extern THREAD_LOCAL u16 gGeoNumViews;
+extern THREAD_LOCAL uintptr_t gGeoLayoutStack[];
+extern THREAD_LOCAL struct GraphNode *gCurGraphNodeList[];
+extern THREAD_LOCAL s16 gCurGraphNodeIndex;
+extern THREAD_LOCAL s16 gGeoLayoutStackIndex;
+extern THREAD_LOCAL UNUSED s16 D_8038BD7C;
+extern THREAD_LOCAL s16 gGeoLayoutReturnIndex;
+extern THREAD_LOCAL u8 *gGeoLayoutCommand;
+extern THREAD_LOCAL struct GraphNode gObjParentGraphNode;
 
 extern struct AllocOnlyPool *D_8038BCA0;
 extern struct GraphNode *D_8038BCA4;
@@ -13,11 +13,14 @@ static struct Surface *find_ceil_from_list( s32 x, s32 y, s32 z, f32 *pheight) {
 
     ceil = NULL;
 
+    level_update_mesh_instances_query(x, z, 0.0f);
+
+    struct SurfaceSpan span;
     uint32_t groupCount = level_get_room_count();
     for( int i = 0; i < groupCount; ++i ) {
-    uint32_t surfCount = level_get_room_surfaces_count( i );
-    for( int j = 0; j < surfCount; ++j ) {
-        surf = level_get_room_surface( i, j );
+    level_get_room_surface_span( i, &span );
+    for( int j = 0; j < span.count; ++j ) {
+        surf = surface_span_get( &span, j );
 
         // libsm64: Weed out surfaces whose triangles are actually line segs. TODO do this at surface load time
         if( !surf->isValid ) continue;
@@ -90,12 +93,14 @@ static struct Surface *find_floor_from_list( s32 x, s32 y, s32 z, f32 *pheight)
     struct Surface *floor = NULL;
 
     level_update_big_floor_hack(x, y, z);
+    level_update_mesh_instances_query(x, z, 0.0f);
 
+    struct SurfaceSpan span;
     uint32_t groupCount = level_get_room_count();
     for( int i = 0; i < groupCount; ++i ) {
-    uint32_t surfCount = level_get_room_surfaces_count( i );
-    for( int j = 0; j < surfCount; ++j ) {
-        surf = level_get_room_surface( i, j );
+    level_get_room_surface_span( i, &span );
+    for( int j = 0; j < span.count; ++j ) {
+        surf = surface_span_get( &span, j );
 
         // libsm64: Weed out surfaces whose triangles are actually line segs. TODO do this at surface load time
         if( !surf->isValid ) continue;
@@ -167,11 +172,14 @@ static s32 find_wall_collisions_from_list( struct WallCollisionData *data) {
         radius = 200.0f;
     }
 
+    level_update_mesh_instances_query(x, z, radius);
+
+    struct SurfaceSpan span;
     uint32_t groupCount = level_get_room_count();
     for( int i = 0; i < groupCount; ++i ) {
-    uint32_t surfCount = level_get_room_surfaces_count( i );
-    for( int j = 0; j < surfCount; ++j ) {
-        surf = level_get_room_surface( i, j );
+    level_get_room_surface_span( i, &span );
+    for( int j = 0; j < span.count; ++j ) {
+        surf = surface_span_get( &span, j );
 
         // libsm64: Weed out surfaces whose triangles are actually line segs. TODO do this at surface load time
         if( !surf->isValid ) continue;
@@ -179,10 +187,6 @@ static s32 find_wall_collisions_from_list( struct WallCollisionData *data) {
         // Do the check normally done in add_surface_to_cell
         if( surf->normal.y < -0.01f || surf->normal.y > 0.01f ) continue;
 
-        if( surf->normal.x < -0.707f || surf->normal.x > 0.707f ) {
-            surf->flags |= SURFACE_FLAG_X_PROJECTION;
-        }
-
         // Exclude a large number of walls immediately to optimize.
         if (y < surf->lowerY || y > surf->upperY) {
             continue;
@@ -319,7 +323,7 @@ f32 find_ceil(f32 posX, f32 posY, f32 posZ, struct Surface **pceil)
 	return height;
 }
 
-struct FloorGeometry sFloorGeo;
+THREAD_LOCAL struct FloorGeometry sFloorGeo;
 
 f32 find_floor_height_and_data(f32 xPos, f32 yPos, f32 zPos, struct FloorGeometry **floorGeo)
 {
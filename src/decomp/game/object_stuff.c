@@ -60,17 +60,17 @@
 static Vec3f gVec3fZero = { 0.0f, 0.0f, 0.0f };
 static Vec3s gVec3sZero = { 0, 0, 0 };
 
-static struct Object *try_allocate_object(void) {
+static struct Object *try_allocate_object(struct Object *storage) {
     struct ObjectNode *nextObj;
-    nextObj = (struct ObjectNode *) malloc(sizeof(struct Object));
+    nextObj = (struct ObjectNode *) storage;
     nextObj->prev = NULL;
     nextObj->next = NULL;
     return (struct Object *) nextObj;
 }
 
-static struct Object *allocate_object(void) {
+static struct Object *allocate_object(struct Object *storage) {
     s32 i;
-    struct Object *obj = try_allocate_object();
+    struct Object *obj = try_allocate_object(storage);
 
     // Initialize object fields
 
@@ -126,9 +126,9 @@ static struct Object *allocate_object(void) {
     return obj;
 }
 
-static struct Object *create_object(void) {
+static struct Object *create_object(struct Object *storage) {
     struct Object *obj;
-    obj = allocate_object();
+    obj = allocate_object(storage);
     obj->curBhvCommand = NULL;
     obj->behavior = NULL;
     return obj;
@@ -150,9 +150,9 @@ static void geo_obj_init(struct GraphNodeObject *graphNode, void *sharedChild, V
     graphNode->node.flags &= ~GRAPH_RENDER_BILLBOARD;
 }
 
-static struct Object *spawn_object_at_origin(void) {
+static struct Object *spawn_object_at_origin(struct Object *storage) {
     struct Object *obj;
-    obj = create_object();
+    obj = create_object(storage);
 
     obj->parentObj = NULL;
     obj->header.gfx.areaIndex = 0;
@@ -194,9 +194,12 @@ static void copy_mario_state_to_object(void) {
     gCurrentObject->oAngleVelRoll = gMarioState->angleVel[2];
 }
 
-struct Object *hack_allocate_mario(void)
+/**
+ * Builds Mario's object in memory owned by the caller, libsm64 keeps it next to the rest of the Mario instance.
+ */
+struct Object *hack_init_mario(struct Object *storage)
 {
-    return spawn_object_at_origin();
+    return spawn_object_at_origin(storage);
 }
 
 /**
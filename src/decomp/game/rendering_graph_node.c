@@ -20,7 +20,7 @@
 // PATCH
 static Vec3s gVec3sZero = { 0, 0, 0 };
 static Vec3f gVec3fZero = { 0, 0, 0 };
-static Gfx *gDisplayListHead;
+static THREAD_LOCAL Gfx *gDisplayListHead;
 #define USE_SYSTEM_MALLOC
 
 
@@ -50,9 +50,9 @@ static Gfx *gDisplayListHead;
  *
  */
 
-s16 gMatStackIndex;
-Mat4 gMatStack[32];
-Mtx *gMatStackFixed[32];
+THREAD_LOCAL s16 gMatStackIndex;
+THREAD_LOCAL Mat4 gMatStack[32];
+THREAD_LOCAL Mtx *gMatStackFixed[32];
 
 /**
  * Animation nodes have state in global variables, so this struct captures
@@ -70,16 +70,16 @@ struct GeoAnimState {
 
 // For some reason, this is a GeoAnimState struct, but the current state consists
 // of separate global variables. It won't match EU otherwise.
-struct GeoAnimState gGeoTempState;
+THREAD_LOCAL struct GeoAnimState gGeoTempState;
 
-u8 gCurAnimType;
-u8 gCurAnimEnabled;
-s16 gCurrAnimFrame;
-f32 gCurAnimTranslationMultiplier;
-u16 *gCurrAnimAttribute;
-s16 *gCurAnimData;
+THREAD_LOCAL u8 gCurAnimType;
+THREAD_LOCAL u8 gCurAnimEnabled;
+THREAD_LOCAL s16 gCurrAnimFrame;
+THREAD_LOCAL f32 gCurAnimTranslationMultiplier;
+THREAD_LOCAL u16 *gCurrAnimAttribute;
+THREAD_LOCAL s16 *gCurAnimData;
 
-struct AllocOnlyPool *gDisplayListHeap;
+THREAD_LOCAL struct AllocOnlyPool *gDisplayListHeap;
 
 struct RenderModeContainer {
     u32 modes[8];
@@ -131,12 +131,12 @@ struct RenderModeContainer renderModeTable_2Cycle[2] = { { {
     G_RM_AA_ZB_XLU_INTER2,
     } } };
 
-struct GraphNodeRoot *gCurGraphNodeRoot = NULL;
-struct GraphNodeMasterList *gCurGraphNodeMasterList = NULL;
-struct GraphNodePerspective *gCurGraphNodeCamFrustum = NULL;
-struct GraphNodeCamera *gCurGraphNodeCamera = NULL;
-struct GraphNodeObject *gCurGraphNodeObject = NULL;
-struct GraphNodeHeldObject *gCurGraphNodeHeldObject = NULL;
+THREAD_LOCAL struct GraphNodeRoot *gCurGraphNodeRoot = NULL;
+THREAD_LOCAL struct GraphNodeMasterList *gCurGraphNodeMasterList = NULL;
+THREAD_LOCAL struct GraphNodePerspective *gCurGraphNodeCamFrustum = NULL;
+THREAD_LOCAL struct GraphNodeCamera *gCurGraphNodeCamera = NULL;
+THREAD_LOCAL struct GraphNodeObject *gCurGraphNodeObject = NULL;
+THREAD_LOCAL struct GraphNodeHeldObject *gCurGraphNodeHeldObject = NULL;
 
 #ifdef F3DEX_GBI_2
 LookAt lookAt;
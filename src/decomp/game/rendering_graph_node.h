@@ -5,12 +5,12 @@
 
 #include "../engine/graph_node.h"
 
-extern struct GraphNodeRoot *gCurGraphNodeRoot;
-extern struct GraphNodeMasterList *gCurGraphNodeMasterList;
-extern struct GraphNodePerspective *gCurGraphNodeCamFrustum;
-extern struct GraphNodeCamera *gCurGraphNodeCamera;
-extern struct GraphNodeObject *gCurGraphNodeObject;
-extern struct GraphNodeHeldObject *gCurGraphNodeHeldObject;
+extern THREAD_LOCAL struct GraphNodeRoot *gCurGraphNodeRoot;
+extern THREAD_LOCAL struct GraphNodeMasterList *gCurGraphNodeMasterList;
+extern THREAD_LOCAL struct GraphNodePerspective *gCurGraphNodeCamFrustum;
+extern THREAD_LOCAL struct GraphNodeCamera *gCurGraphNodeCamera;
+extern THREAD_LOCAL struct GraphNodeObject *gCurGraphNodeObject;
+extern THREAD_LOCAL struct GraphNodeHeldObject *gCurGraphNodeHeldObject;
 
 // after processing an object, the type is reset to this
 #define ANIM_TYPE_NONE                  0
@@ -3,13 +3,18 @@
 #include <stdlib.h>
 #include <string.h>
 
-struct GlobalState *g_state = 0;
+THREAD_LOCAL struct GlobalState *g_state = 0;
 
-struct GlobalState *global_state_create(void)
+void global_state_init(struct GlobalState *state)
 {
-	struct GlobalState *state = malloc( sizeof( struct GlobalState ));
 	memset( state, 0, sizeof( struct GlobalState ));
 	state->msSwimStrength = MIN_SWIM_STRENGTH;
+}
+
+struct GlobalState *global_state_create(void)
+{
+	struct GlobalState *state = malloc( sizeof( struct GlobalState ));
+	global_state_init( state );
 	return state;
 }
 
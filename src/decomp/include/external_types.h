@@ -41,6 +41,16 @@ struct SM64SurfaceObject
     struct SM64Surface *surfaces;
 };
 
+/**
+ * @brief Places a mesh registered with sm64_level_register_mesh inside a room.
+ * All instances of the same mesh share its local-space surfaces.
+ */
+struct SM64MeshInstance
+{
+    uint32_t meshId;
+    struct SM64ObjectTransform transform;
+};
+
 enum SM64ExternalSurfaceTypes
 {
     EXTERNAL_SURFACE_TYPE_STATIC_SURFACE,
@@ -60,5 +70,50 @@ struct SM64DebugSurface
 };
 
 
+/**
+ * @brief Load-time cleanup applied to room surfaces and registered meshes, see sm64_level_set_surface_cleanup.
+ */
+struct SM64SurfaceCleanupOptions
+{
+    int32_t weldDistance; // vertices closer than this on every axis are welded, 0 disables welding
+    bool removeDegenerates;
+    bool removeDuplicates;
+    bool mergeCoplanarPairs;
+};
+
+struct SM64SurfaceCleanupStats
+{
+    uint32_t surfacesBefore;
+    uint32_t surfacesAfter;
+    uint32_t verticesWelded;
+    uint32_t degeneratesRemoved;
+    uint32_t duplicatesRemoved;
+    uint32_t pairsMerged;
+};
+
+/**
+ * @brief A room slot whose content changed since the version given to sm64_level_get_changed_rooms.
+ */
+struct SM64DebugRoomDelta
+{
+    uint32_t roomId;
+    uint32_t version;
+    bool loaded;
+    uint32_t surfacesCount;
+};
+
+/**
+ * @brief A surface object slot that changed since the version given to sm64_level_get_changed_surface_objects.
+ * Its surfaces only need to be exported again when geometryChanged is set, otherwise only the transform moved.
+ */
+struct SM64DebugObjectDelta
+{
+    uint32_t objectId;
+    uint32_t version;
+    bool loaded;
+    bool geometryChanged;
+    struct SM64ObjectTransform transform;
+    uint32_t surfacesCount;
+};
 
 #endif
\ No newline at end of file
@@ -58,6 +58,13 @@
 #define ALIGNED16
 #endif
 
+// Engine state bound per thread, so independent Marios can be ticked on separate threads
+#ifdef __GNUC__
+#define THREAD_LOCAL __thread
+#else
+#define THREAD_LOCAL __declspec(thread)
+#endif
+
 #ifndef NO_SEGMENTED_MEMORY
 // convert a virtual address to physical.
 #define VIRTUAL_TO_PHYSICAL(addr)   ((uintptr_t)(addr) & 0x1FFFFFFF)
@@ -87,6 +87,14 @@ struct VblankHandler
 #define ANIM_FLAG_7          (1 << 7) // 0x80
 
 // Added by libsm64
+// libsm64: added type, where a surface or a transform is stored in the level so a reference to it is made without a search.
+struct SurfaceOwner
+{
+    u32 kind; // SURFACE_REF_* of load_surfaces.h, SURFACE_REF_NONE if it isn't stored in the level
+    u32 id; // surface object id, or for a static object transform the index of a room surface using it
+    void *container; // Room or MeshInstance holding it, NULL for surface objects and shared rooms
+};
+
 struct SurfaceObjectTransform
 {
     float aPosX, aPosY, aPosZ;
@@ -99,6 +107,8 @@ struct SurfaceObjectTransform
     s16 aAngleVelPitch;
     s16 aAngleVelYaw;
     s16 aAngleVelRoll;
+
+    struct SurfaceOwner owner; // libsm64: added field
 };
 
 struct SM64Animation {
@@ -265,6 +275,7 @@ struct Surface
     enum SM64ExternalSurfaceTypes eSurfaceType; //added external room type
     int externalRoom;
     int externalFace;
+    struct SurfaceOwner owner; // libsm64: added field
 };
 
 struct MarioBodyState
@@ -11,16 +11,19 @@ struct AllocOnlyPool
     void **allocatedBlocks;
 };
 
-struct AllocOnlyPool *s_display_list_pool;
+THREAD_LOCAL struct AllocOnlyPool *s_display_list_pool;
 
 void memory_init(void)
 {
     s_display_list_pool = alloc_only_pool_init();
 }
 
+// Releases the display list pool of the calling thread, other threads keep theirs.
 void memory_terminate(void)
 {
-    alloc_only_pool_free( s_display_list_pool );
+    if( s_display_list_pool != NULL )
+        alloc_only_pool_free( s_display_list_pool );
+    s_display_list_pool = NULL;
 }
 
 struct AllocOnlyPool *alloc_only_pool_init(void)
@@ -49,7 +52,8 @@ void alloc_only_pool_free(struct AllocOnlyPool *pool)
 
 void display_list_pool_reset(void)
 {
-    alloc_only_pool_free( s_display_list_pool );
+    if( s_display_list_pool != NULL )
+        alloc_only_pool_free( s_display_list_pool );
     s_display_list_pool = alloc_only_pool_init();
 }
 
@@ -7,21 +7,25 @@
 #include "gfx_adapter.h"
 #include "gfx_adapter_commands.h"
 #include "load_tex_data.h"
+#include "debug_print.h"
 
-static Mat4 s_curMatrix;
-static float s_curColor[3];
+static THREAD_LOCAL Mat4 s_curMatrix;
+static THREAD_LOCAL float s_curColor[3];
 
-static uint16_t s_scaleS, s_scaleT, s_uls, s_ult;
-static int s_textureOn, s_textureIndex;
-static float s_texWidth;
-static float s_texHeight;
+static THREAD_LOCAL uint16_t s_scaleS, s_scaleT, s_uls, s_ult;
+static THREAD_LOCAL int s_textureOn, s_textureIndex;
+static THREAD_LOCAL float s_texWidth;
+static THREAD_LOCAL float s_texHeight;
 
-static struct SM64MarioGeometryBuffers *s_outBuffers;
+static THREAD_LOCAL struct SM64MarioGeometryBuffers *s_outBuffers;
 
-static float *s_trianglePtr;
-static float *s_colorPtr;
-static float *s_normalPtr;
-static float *s_uvPtr;
+static THREAD_LOCAL float *s_trianglePtr;
+static THREAD_LOCAL float *s_colorPtr;
+static THREAD_LOCAL float *s_normalPtr;
+static THREAD_LOCAL float *s_uvPtr;
+
+static THREAD_LOCAL struct GfxPose *s_capturePose;
+static THREAD_LOCAL bool s_capturePoseFull;
 
 static void mtxf_mul_vec3f_x(Mat4 mtx, Vec3f b, float w, Vec3f out)
 {
@@ -201,9 +205,57 @@ void gSPMatrix( void *pkt, Mtx *m, uint8_t flags )
     guMtxL2F( s_curMatrix, m );
 }
 
+static void pose_draw_save_state( struct GfxPoseDraw *draw )
+{
+    vec3f_copy( draw->color, s_curColor );
+    draw->scaleS = s_scaleS;
+    draw->scaleT = s_scaleT;
+    draw->uls = s_uls;
+    draw->ult = s_ult;
+    draw->textureOn = (int16_t)s_textureOn;
+    draw->textureIndex = (int16_t)s_textureIndex;
+}
+
+static void pose_draw_load_state( const struct GfxPoseDraw *draw )
+{
+    vec3f_copy( s_curColor, (float*)draw->color );
+    s_scaleS = draw->scaleS;
+    s_scaleT = draw->scaleT;
+    s_uls = draw->uls;
+    s_ult = draw->ult;
+    s_textureOn = draw->textureOn;
+    s_textureIndex = draw->textureIndex;
+    s_texWidth = mario_tex_widths[s_textureIndex];
+    s_texHeight = mario_tex_heights[s_textureIndex];
+}
+
 void gSPDisplayList( void *pkt, struct DisplayListNode *dl )
 {
+    if( s_capturePose == NULL || s_capturePose->drawCount >= GFX_POSE_MAX_DRAWS )
+    {
+        // Still drawn this pass, but missing from the interpolated frames built from the pose.
+        if( s_capturePose != NULL && !s_capturePoseFull )
+        {
+            DEBUG_PRINT("Mario pose has more than %d draws, interpolated frames will miss the rest", GFX_POSE_MAX_DRAWS);
+            s_capturePoseFull = true;
+        }
+        process_display_list( (void*)dl );
+        return;
+    }
+
+    struct GfxPoseDraw *draw = &s_capturePose->draws[s_capturePose->drawCount];
+    uint16_t trianglesBefore = s_outBuffers->numTrianglesUsed;
+
+    mtxf_copy( draw->matrix, s_curMatrix );
+    draw->displayList = dl;
+    pose_draw_save_state( draw );
+
     process_display_list( (void*)dl );
+
+    // Lists that only change render state are dropped, the state they set is saved with the next draw.
+    // They're also the only ones allocated per pass, so every kept list outlives the pass.
+    if( s_outBuffers->numTrianglesUsed != trianglesBefore )
+        s_capturePose->drawCount++;
 }
 
 void gfx_adapter_bind_output_buffers( struct SM64MarioGeometryBuffers *outBuffers )
@@ -214,4 +266,53 @@ void gfx_adapter_bind_output_buffers( struct SM64MarioGeometryBuffers *outBuffer
     s_normalPtr = s_outBuffers->normal;
     s_uvPtr = s_outBuffers->uv;
     s_outBuffers->numTrianglesUsed = 0;
-}
\ No newline at end of file
+}
+
+void gfx_adapter_bind_pose_capture( struct GfxPose *pose )
+{
+    s_capturePose = pose;
+    s_capturePoseFull = false;
+    if( pose != NULL )
+        pose->drawCount = 0;
+}
+
+// Poses of different models, a cap swap or another hand, can have the same number of draws, so the lists must match too.
+static bool pose_blendable( const struct GfxPose *from, const struct GfxPose *to )
+{
+    if( from == NULL || from->drawCount != to->drawCount )
+        return false;
+
+    for( uint32_t i = 0; i < to->drawCount; ++i )
+        if( from->draws[i].displayList != to->draws[i].displayList )
+            return false;
+
+    return true;
+}
+
+void gfx_adapter_render_pose( const struct GfxPose *from, const struct GfxPose *to, float alpha, struct SM64MarioGeometryBuffers *outBuffers )
+{
+    gfx_adapter_bind_output_buffers( outBuffers );
+
+    bool blend = pose_blendable( from, to );
+
+    for( uint32_t i = 0; i < to->drawCount; ++i )
+    {
+        const struct GfxPoseDraw *draw = &to->draws[i];
+
+        // A plain lerp of the matrices, the rotation between two 30 Hz ticks is small enough for it not to shrink visibly.
+        if( blend )
+        {
+            const struct GfxPoseDraw *prev = &from->draws[i];
+            for( int row = 0; row < 4; ++row )
+                for( int col = 0; col < 4; ++col )
+                    s_curMatrix[row][col] = prev->matrix[row][col] + ( draw->matrix[row][col] - prev->matrix[row][col] ) * alpha;
+        }
+        else
+        {
+            mtxf_copy( s_curMatrix, (Vec4f *)draw->matrix );
+        }
+
+        pose_draw_load_state( draw );
+        process_display_list( draw->displayList );
+    }
+}
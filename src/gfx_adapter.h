@@ -12,4 +12,33 @@
 extern void gSPMatrix( void *pkt, Mtx *m, uint8_t flags );
 extern void gSPDisplayList( void *pkt, struct DisplayListNode *dl );
 
-extern void gfx_adapter_bind_output_buffers( struct SM64MarioGeometryBuffers *outBuffers );
\ No newline at end of file
+extern void gfx_adapter_bind_output_buffers( struct SM64MarioGeometryBuffers *outBuffers );
+
+#define GFX_POSE_MAX_DRAWS 64
+
+// A display list drawn during a geometry pass, with the matrix and render state it started with.
+struct GfxPoseDraw
+{
+    Mat4 matrix;
+    void *displayList;
+    float color[3];
+    uint16_t scaleS, scaleT, uls, ult;
+    int16_t textureOn, textureIndex;
+};
+
+struct GfxPose
+{
+    uint32_t drawCount;
+    struct GfxPoseDraw draws[GFX_POSE_MAX_DRAWS];
+};
+
+/**
+ * @brief Records the draws of the following geometry passes into pose, NULL stops recording.
+ */
+extern void gfx_adapter_bind_pose_capture( struct GfxPose *pose );
+
+/**
+ * @brief Redraws a captured pose without walking the graph, blending every matrix from `from` towards `to` by alpha.
+ * @param from Earlier pose, ignored when NULL or when it doesn't have the same draws as `to`.
+ */
+extern void gfx_adapter_render_pose( const struct GfxPose *from, const struct GfxPose *to, float alpha, struct SM64MarioGeometryBuffers *outBuffers );
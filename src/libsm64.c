@@ -9,6 +9,7 @@
 #include <stdbool.h>
 #include <string.h>
 #include <math.h>
+#include <float.h>
 #include <pthread.h>
 
 #include <PR/os_cont.h>
@@ -32,6 +33,9 @@
 
 #include "debug_print.h"
 #include "load_surfaces.h"
+#include "worker_pool.h"
+#include "state_delta.h"
+#include "recorder.h"
 #include "gfx_adapter.h"
 #include "load_anim_data.h"
 #include "load_tex_data.h"
@@ -47,26 +51,146 @@
 #include "decomp/tools/convUtils.h"
 #include "decomp/mario/geo.inc.h"
 
-static struct AllocOnlyPool *s_mario_geo_pool = NULL;
-static struct GraphNode *s_mario_graph_node = NULL;
+// Geo processing writes to the graph nodes, so every thread that ticks Marios builds its own graph.
+static THREAD_LOCAL struct AllocOnlyPool *s_mario_geo_pool = NULL;
+static THREAD_LOCAL struct GraphNode *s_mario_graph_node = NULL;
 static struct AudioAPI *audio_api;
 
 static bool s_init_global = false;
 static bool s_init_one_mario = false;
 
+// Observers and distance levels used by Marios on SM64_UPDATE_INTERVAL_AUTO, set by the host between ticks.
+static float *s_update_observers = NULL;
+static uint32_t s_update_observer_count = 0;
+static float s_update_level_distances_sq[SM64_UPDATE_LEVELS_MAX];
+static uint32_t s_update_level_intervals[SM64_UPDATE_LEVELS_MAX];
+static uint32_t s_update_level_count = 0;
+
+// Draws of the last two geometry passes, kept for sm64_mario_render_interpolated.
+struct MarioPoseHistory
+{
+    struct GfxPose poses[2];
+    uint32_t current;
+    uint32_t count;
+};
+
+// Values a full tick of a resting Mario leaves unchanged.
+struct MarioIdleCheck
+{
+    Vec3f pos;
+    Vec3f vel;
+    Vec3s faceAngle;
+    f32 forwardVel;
+    u32 action;
+    u16 actionState;
+    u16 actionTimer;
+    u32 actionArg;
+    s16 health;
+    s16 animID;
+    s16 animFrame;
+    struct Surface *floor;
+    struct Surface *wall;
+    struct Surface *ceil;
+};
+
+// Everything a tick touches lives in one pool allocation, laid out in the order the tick reaches it.
+// The room list of the loaded rooms follows the struct, sized for the level loaded when the Mario was created.
 struct MarioInstance
 {
-    struct GlobalState *globalState;
+    struct GlobalState globalState;
+    struct Object marioObject;
+    struct Area area;
+    struct Camera camera;
+    struct MarioLoadedRooms loadedRooms;
+    // Allocated by the first geometry pass, most Marios of a large simulation never render.
+    struct MarioPoseHistory *poseHistory;
+    // Speculative copy made by sm64_mario_fork, bound through its own loaded rooms and never rendered or heard.
+    bool isFork;
+    uint32_t updateInterval;
+    uint32_t ticksUntilGeometry;
+    // Consecutive full ticks that left the Mario unchanged, see mario_idle_update.
+    uint32_t idleTicks;
+    struct LevelLayoutStamp idleLayout;
+    struct MarioIdleCheck idleCheck;
+    // Serial of the last batch that took this Mario, catches ids repeated within one batch.
+    uint32_t batchSerial;
+    uint32_t roomIds[];
 };
-struct ObjPool s_mario_instance_pool = { 0, 0 };
+struct ObjPool s_mario_instance_pool = { 0, 0, 0 };
+static THREAD_LOCAL struct MarioInstance *s_bound_instance = NULL;
+
+
+static struct GraphNode *mario_graph_node(void)
+{
+    if( s_mario_graph_node == NULL )
+    {
+        s_mario_geo_pool = alloc_only_pool_init();
+        s_mario_graph_node = process_geo_layout( s_mario_geo_pool, mario_geo_ptr );
+    }
+    return s_mario_graph_node;
+}
 
+static void mario_graph_node_free(void)
+{
+    if( s_mario_geo_pool != NULL )
+        alloc_only_pool_free( s_mario_geo_pool );
+    s_mario_geo_pool = NULL;
+    s_mario_graph_node = NULL;
+}
+
+static struct MarioInstance *mario_instance_from_id( int32_t marioId )
+{
+	return (struct MarioInstance *)obj_pool_get( &s_mario_instance_pool, (uint32_t)marioId );
+}
 
+/**
+ * @brief Gets the loaded rooms record a Mario owns, forks included. NULL once the level dropped it, on a level unload.
+ */
+static struct MarioLoadedRooms *mario_resolve_loaded_rooms( struct MarioInstance *instance )
+{
+	return instance->loadedRooms.roomIds != NULL ? &instance->loadedRooms : NULL;
+}
+
+/**
+ * @brief Binds a Mario for a tick or a read, without waking it from the idle path.
+ * @return NULL without binding anything if the id doesn't belong to a live Mario.
+ */
+static struct MarioInstance *mario_bind( int32_t marioId )
+{
+	struct MarioInstance *instance = mario_instance_from_id( marioId );
+	if( instance == NULL )
+	{
+		DEBUG_PRINT("Tried to use non-existant Mario with ID: %d", marioId);
+		return NULL;
+	}
+
+	global_state_bind( &instance->globalState );
+	s_bound_instance = instance;
+	// A Mario without a record sees no rooms rather than the ones of the Mario bound before.
+	level_bind_loaded_rooms( mario_resolve_loaded_rooms( instance ));
+	return instance;
+}
+
+/**
+ * @brief Like mario_bind for a Mario whose loaded rooms were already looked up, see mario_resolve_loaded_rooms.
+ */
+static void mario_bind_resolved( struct MarioInstance *instance, struct MarioLoadedRooms *loadedRooms )
+{
+	global_state_bind( &instance->globalState );
+	s_bound_instance = instance;
+	level_bind_loaded_rooms( loadedRooms );
+}
+
+// Returns NULL without binding anything if the id doesn't belong to a live Mario.
+// Callers may change the Mario from outside its tick, so an idle Mario goes back to full ticks.
 struct GlobalState *set_global_mario_state(int marioId)
 {
-	struct GlobalState *state = ((struct MarioInstance *)s_mario_instance_pool.objects[ marioId ])->globalState;
-	global_state_bind( state );
-	level_set_active_mario(marioId);
-	return state;
+	struct MarioInstance *instance = mario_bind( marioId );
+	if( instance == NULL )
+		return NULL;
+
+	instance->idleTicks = 0;
+	return &instance->globalState;
 }
 
 
@@ -87,22 +211,15 @@ static void update_button( bool on, u16 button )
     }
 }
 
-static struct Area *allocate_area( void )
+static struct Area *init_area( struct Area *area, struct Camera *camera )
 {
-    struct Area *result = malloc( sizeof( struct Area ));
-    memset( result, 0, sizeof( struct Area ));
+    memset( area, 0, sizeof( struct Area ));
+    memset( camera, 0, sizeof( struct Camera ));
 
-    result->flags = 1;
-    result->camera = malloc( sizeof( struct Camera ));
-    memset( result->camera, 0, sizeof( struct Camera ));
+    area->flags = 1;
+    area->camera = camera;
 
-    return result;
-}
-
-static void free_area( struct Area *area )
-{
-    free( area->camera );
-    free( area );
+    return area;
 }
 
 pthread_t gSoundThread;
@@ -170,6 +287,8 @@ SM64_LIB_FN void sm64_global_init( uint8_t *rom, uint8_t *outTexture, SM64DebugP
 	pthread_create(&gSoundThread, NULL, audio_thread, &s_init_global);
 }
 
+static void mario_delete( int32_t marioId );
+
 SM64_LIB_FN void sm64_global_terminate( void )
 {
     if( !s_init_global ) return;
@@ -177,53 +296,72 @@ SM64_LIB_FN void sm64_global_terminate( void )
 	audio_api = NULL;
 	pthread_cancel(gSoundThread);
 
+	worker_pool_terminate();
+
     global_state_bind( NULL );
     
     if( s_init_one_mario )
     {
-        for( int i = 0; i < s_mario_instance_pool.size; ++i )
-            if( s_mario_instance_pool.objects[i] != NULL )
-                sm64_mario_delete( i );
+        for( uint32_t i = 0; i < s_mario_instance_pool.size; ++i )
+            if( obj_pool_id_at( &s_mario_instance_pool, i ) != OBJ_POOL_INVALID_ID )
+                mario_delete( obj_pool_id_at( &s_mario_instance_pool, i ));
 
         obj_pool_free_all( &s_mario_instance_pool );
     }
 
+    sm64_set_update_observers( NULL, 0 );
+    s_update_level_count = 0;
+
     s_init_global = false;
     s_init_one_mario = false;
 	   
 	ctl_free();
-    alloc_only_pool_free( s_mario_geo_pool );
+    mario_graph_node_free();
     //surfaces_unload_all();
 	level_unload();
     unload_mario_anims();
     memory_terminate();
 }
 
+SM64_LIB_FN void sm64_thread_terminate( void )
+{
+    global_state_bind( NULL );
+    mario_graph_node_free();
+    memory_terminate();
+}
+
 // SM64_LIB_FN void sm64_static_surfaces_load( const struct SM64Surface *surfaceArray, uint32_t numSurfaces )
 // {
 //     surfaces_load_static( surfaceArray, numSurfaces );
 // }
 
-SM64_LIB_FN int32_t sm64_mario_create( float x, float y, float z, int16_t rx, int16_t ry, int16_t rz, uint8_t fake, int *loadedRooms, int loadedCount)
+static int32_t mario_create( float x, float y, float z, int16_t rx, int16_t ry, int16_t rz, uint8_t fake, int *loadedRooms, int loadedCount )
 {
-    int32_t marioIndex = obj_pool_alloc_index( &s_mario_instance_pool, sizeof( struct MarioInstance ));
-	level_load_player_loaded_rooms(marioIndex);
-	level_update_player_loaded_Rooms(marioIndex, loadedRooms, loadedCount);
-    struct MarioInstance *newInstance = s_mario_instance_pool.objects[marioIndex];
-
-    newInstance->globalState = global_state_create();
-    global_state_bind( newInstance->globalState );
-
-    if( !s_init_one_mario )
+    size_t roomIdsSize = sizeof( uint32_t ) * level_get_room_slots_count();
+    int32_t marioIndex = obj_pool_alloc( &s_mario_instance_pool, sizeof( struct MarioInstance ) + roomIdsSize );
+    if( marioIndex < 0 )
     {
-        s_init_one_mario = true;
-        s_mario_geo_pool = alloc_only_pool_init();
-        s_mario_graph_node = process_geo_layout( s_mario_geo_pool, mario_geo_ptr );
+        DEBUG_PRINT("Failed to allocate a new Mario");
+        return -1;
     }
+    struct MarioInstance *newInstance = mario_instance_from_id( marioIndex );
+    memset( newInstance, 0, sizeof( struct MarioInstance ));
+
+    global_state_init( &newInstance->globalState );
+    global_state_bind( &newInstance->globalState );
+
+	if( !level_load_player_loaded_rooms(marioIndex, &newInstance->loadedRooms, newInstance->roomIds) )
+	{
+		obj_pool_free( &s_mario_instance_pool, marioIndex );
+		return -1;
+	}
+	level_update_player_loaded_Rooms(marioIndex, loadedRooms, loadedCount);
+
+    s_init_one_mario = true;
 
     gCurrSaveFileNum = 1;
-    gMarioObject = hack_allocate_mario();
-    gCurrentArea = allocate_area();
+    gMarioObject = hack_init_mario( &newInstance->marioObject );
+    gCurrentArea = init_area( &newInstance->area, &newInstance->camera );
     gCurrentObject = gMarioObject;
 
     gMarioSpawnInfoVal.startPos[0] = x;
@@ -248,7 +386,7 @@ SM64_LIB_FN int32_t sm64_mario_create( float x, float y, float z, int16_t rx, in
 	{
 		if( initResult < 0 )
 		{
-			sm64_mario_delete( marioIndex );
+			mario_delete( marioIndex );
 			return -1;
 		}
 
@@ -262,15 +400,192 @@ SM64_LIB_FN int32_t sm64_mario_create( float x, float y, float z, int16_t rx, in
     return marioIndex;
 }
 
+SM64_LIB_FN int32_t sm64_mario_create( float x, float y, float z, int16_t rx, int16_t ry, int16_t rz, uint8_t fake, int *loadedRooms, int loadedCount)
+{
+    int32_t marioId = mario_create( x, y, z, rx, ry, rz, fake, loadedRooms, loadedCount );
+    if( recorder_active() )
+        recorder_log_mario_create( x, y, z, rx, ry, rz, fake, loadedRooms, loadedCount, marioId );
+    return marioId;
+}
+
+// Returns the pose history of the instance, allocated by the first call. NULL if the allocation fails.
+static struct MarioPoseHistory *mario_pose_history( struct MarioInstance *instance )
+{
+    if( instance == NULL )
+        return NULL;
+
+    if( instance->poseHistory == NULL )
+    {
+        instance->poseHistory = malloc( sizeof( struct MarioPoseHistory ));
+        if( instance->poseHistory == NULL )
+            return NULL;
+        instance->poseHistory->current = 0;
+        instance->poseHistory->count = 0;
+    }
+
+    return instance->poseHistory;
+}
+
+static uint32_t mario_auto_update_interval( const struct MarioInstance *instance )
+{
+    if( s_update_observer_count == 0 || s_update_level_count == 0 )
+        return 1;
+
+    const float *pos = instance->marioObject.header.gfx.pos;
+    float nearestSq = FLT_MAX;
+    for( uint32_t i = 0; i < s_update_observer_count; ++i )
+    {
+        const float *observer = &s_update_observers[i * 3];
+        float dx = pos[0] - observer[0], dy = pos[1] - observer[1], dz = pos[2] - observer[2];
+        float distSq = dx*dx + dy*dy + dz*dz;
+        if( distSq < nearestSq ) nearestSq = distSq;
+    }
+
+    for( uint32_t i = 0; i < s_update_level_count; ++i )
+        if( nearestSq <= s_update_level_distances_sq[i] )
+            return s_update_level_intervals[i];
+
+    return SM64_UPDATE_INTERVAL_NEVER;
+}
+
+/**
+ * @brief Counts a tick with geometry requested and tells whether its update interval lets it build the geometry.
+ */
+static bool mario_geometry_due( struct MarioInstance *instance )
+{
+    if( instance == NULL )
+        return true;
+
+    uint32_t interval = instance->updateInterval;
+    if( interval == SM64_UPDATE_INTERVAL_AUTO )
+        interval = mario_auto_update_interval( instance );
+
+    if( interval >= SM64_UPDATE_INTERVAL_NEVER )
+        return false;
+
+    // An automatic interval can shrink as the Mario comes closer, the wait left over from a longer one is cut short.
+    if( instance->ticksUntilGeometry >= interval )
+        instance->ticksUntilGeometry = interval - 1;
+
+    if( instance->ticksUntilGeometry > 0 )
+    {
+        instance->ticksUntilGeometry--;
+        return false;
+    }
+
+    instance->ticksUntilGeometry = interval - 1;
+    return true;
+}
+
+/**
+ * @brief Generates the geometry of the bound Mario, or only advances its animation when outBuffers is NULL.
+ * Physics reads the animation frame, so it has to move on even when nothing is rendered.
+ * Ticks skipped by the update interval only advance the animation and leave outBuffers as they were.
+ */
+static void mario_process_geometry( struct SM64MarioGeometryBuffers *outBuffers )
+{
+    bool isFork = s_bound_instance != NULL && s_bound_instance->isFork;
+    if( outBuffers != NULL && !isFork && mario_geometry_due( s_bound_instance ))
+    {
+        struct MarioPoseHistory *history = mario_pose_history( s_bound_instance );
+        if( history != NULL )
+        {
+            history->current ^= 1;
+            if( history->count < 2 ) history->count++;
+            gfx_adapter_bind_pose_capture( &history->poses[history->current] );
+        }
+
+        gfx_adapter_bind_output_buffers( outBuffers );
+        geo_process_root_hack_single_node( mario_graph_node() );
+        gfx_adapter_bind_pose_capture( NULL );
+        return;
+    }
+
+    struct AnimInfo *animInfo = &gMarioObject->header.gfx.animInfo;
+    animInfo->animFrame = geo_update_animation_frame( animInfo, &animInfo->animFrameAccelAssist );
+    animInfo->animTimer = gAreaUpdateCounter;
+}
+
+// SM64_UPDATE_INTERVAL_AUTO picks the interval from the update observers, which is also what new Marios use.
+SM64_LIB_FN void sm64_mario_set_update_interval( int32_t marioId, uint32_t interval )
+{
+    struct MarioInstance *instance = mario_instance_from_id( marioId );
+    if( instance == NULL )
+    {
+        DEBUG_PRINT("Tried to set the update interval of non-existant Mario with ID: %u", marioId);
+        return;
+    }
+
+    instance->updateInterval = interval;
+    // The next tick builds geometry, so a Mario that comes closer doesn't wait out its old interval.
+    instance->ticksUntilGeometry = 0;
+}
+
+// positions holds count xyz triples. A Mario on SM64_UPDATE_INTERVAL_AUTO builds geometry every intervals[i] ticks when its
+// nearest observer is within distances[i], the levels being in increasing distance. Farther Marios skip geometry.
+SM64_LIB_FN void sm64_set_update_observers( const float *positions, uint32_t count )
+{
+    free( s_update_observers );
+    s_update_observers = NULL;
+    s_update_observer_count = 0;
+
+    if( count == 0 )
+        return;
+
+    s_update_observers = malloc( sizeof( float ) * 3 * count );
+    memcpy( s_update_observers, positions, sizeof( float ) * 3 * count );
+    s_update_observer_count = count;
+}
+
+SM64_LIB_FN void sm64_set_update_levels( const float *distances, const uint32_t *intervals, uint32_t count )
+{
+    if( count > SM64_UPDATE_LEVELS_MAX )
+    {
+        DEBUG_PRINT("Too many update levels, only the first %u are used", SM64_UPDATE_LEVELS_MAX);
+        count = SM64_UPDATE_LEVELS_MAX;
+    }
+
+    for( uint32_t i = 0; i < count; ++i )
+    {
+        s_update_level_distances_sq[i] = distances[i] * distances[i];
+        s_update_level_intervals[i] = intervals[i] == SM64_UPDATE_INTERVAL_AUTO ? 1 : intervals[i];
+    }
+    s_update_level_count = count;
+}
+
+// Redraws the Mario between its last two geometry ticks without advancing it, alpha goes from 0 at the earlier tick to 1 at the latest.
+// Returns false and leaves outBuffers empty when the Mario hasn't been ticked with geometry yet.
+SM64_LIB_FN bool sm64_mario_render_interpolated( int32_t marioId, float alpha, struct SM64MarioGeometryBuffers *outBuffers )
+{
+    struct MarioInstance *instance = mario_instance_from_id( marioId );
+    if( instance == NULL )
+    {
+        DEBUG_PRINT("Tried to render non-existant Mario with ID: %u", marioId);
+        return false;
+    }
+
+    struct MarioPoseHistory *history = instance->poseHistory;
+    if( history == NULL || history->count == 0 )
+    {
+        outBuffers->numTrianglesUsed = 0;
+        return false;
+    }
+
+    const struct GfxPose *latest = &history->poses[history->current];
+    const struct GfxPose *previous = history->count == 2 ? &history->poses[history->current ^ 1] : NULL;
+    gfx_adapter_render_pose( previous, latest, alpha, outBuffers );
+    return true;
+}
+
 SM64_LIB_FN struct SM64AnimInfo* sm64_mario_get_anim_info( int32_t marioId, int16_t rot[3] )
 {
-	if( marioId >= s_mario_instance_pool.size || s_mario_instance_pool.objects[marioId] == NULL )
+	if( mario_instance_from_id( marioId ) == NULL )
     {
         DEBUG_PRINT("Tried to tick non-existant Mario with ID: %u", marioId);
         return NULL;
     }
 
-	set_global_mario_state(marioId);
+	mario_bind(marioId);
 	
 	rot[0] = gMarioState->marioObj->header.gfx.angle[0];
 	rot[1] = gMarioState->marioObj->header.gfx.angle[1];
@@ -281,7 +596,7 @@ SM64_LIB_FN struct SM64AnimInfo* sm64_mario_get_anim_info( int32_t marioId, int1
 
 SM64_LIB_FN void sm64_mario_anim_tick( int32_t marioId, uint32_t stateFlags, struct SM64AnimInfo* animInfo, struct SM64MarioGeometryBuffers *outBuffers, int16_t rot[3] )
 {
-	if( marioId >= s_mario_instance_pool.size || s_mario_instance_pool.objects[marioId] == NULL )
+	if( mario_instance_from_id( marioId ) == NULL )
     {
         DEBUG_PRINT("Tried to tick non-existant Mario with ID: %u", marioId);
         return;
@@ -299,22 +614,92 @@ SM64_LIB_FN void sm64_mario_anim_tick( int32_t marioId, uint32_t stateFlags, str
         set_mario_anim_with_accel( gMarioState, animInfo->animID, animInfo->animAccel );
     gMarioState->marioObj->header.gfx.animInfo.animAccel = animInfo->animAccel;
 
-    gfx_adapter_bind_output_buffers( outBuffers );
-    geo_process_root_hack_single_node( s_mario_graph_node );
+    mario_process_geometry( outBuffers );
     gAreaUpdateCounter++;
+
+    if( recorder_active() )
+        recorder_log_mario_anim_tick( marioId, stateFlags, animInfo, rot, outBuffers != NULL );
 }
 
 
-SM64_LIB_FN void sm64_mario_tick(int32_t marioId, const struct SM64MarioInputs *inputs, struct SM64MarioState *outState, struct SM64MarioGeometryBuffers *outBuffers )
+// Full ticks a Mario has to leave unchanged before it moves to the idle path.
+#define MARIO_IDLE_TICKS_TO_SLEEP 30
+
+static void mario_idle_check_fill( struct MarioIdleCheck *check )
 {
-    if( marioId >= s_mario_instance_pool.size || s_mario_instance_pool.objects[marioId] == NULL )
-    {
-        DEBUG_PRINT("Tried to tick non-existant Mario with ID: %u", marioId);
+    memset( check, 0, sizeof( struct MarioIdleCheck ));
+    vec3f_copy( check->pos, gMarioState->pos );
+    vec3f_copy( check->vel, gMarioState->vel );
+    vec3s_copy( check->faceAngle, gMarioState->faceAngle );
+    check->forwardVel = gMarioState->forwardVel;
+    check->action = gMarioState->action;
+    check->actionState = gMarioState->actionState;
+    check->actionTimer = gMarioState->actionTimer;
+    check->actionArg = gMarioState->actionArg;
+    check->health = gMarioState->health;
+    check->animID = gMarioState->marioObj->header.gfx.animInfo.animID;
+    // Actions like act_sleeping only move on at the end of an animation, so the frame has to hold still too. Lying asleep
+    // is the one looping animation nothing waits on.
+    bool steadyLoop = gMarioState->action == ACT_SLEEPING && gMarioState->actionState == 2;
+    check->animFrame = steadyLoop ? 0 : gMarioState->marioObj->header.gfx.animInfo.animFrame;
+    check->floor = gMarioState->floor;
+    check->wall = gMarioState->wall;
+    check->ceil = gMarioState->ceil;
+}
+
+/**
+ * @brief Counts the full ticks that left a Mario resting: no input, no platform, no pending health change and nothing in
+ * its state moved. Actions that keep counting or animating, like the idle head turns, never qualify, a Mario lying asleep does.
+ */
+static void mario_idle_update( struct MarioInstance *instance, bool noInput )
+{
+    if( instance == NULL )
         return;
+
+    struct MarioIdleCheck check;
+    mario_idle_check_fill( &check );
+    struct LevelLayoutStamp layout;
+    level_get_layout_stamp( gMarioState->pos[0], gMarioState->pos[2], &layout );
+
+    bool resting = noInput
+        && gMarioState->marioObj->platform == NULL
+        && gMarioState->healCounter == 0
+        && gMarioState->hurtCounter == 0
+        && gMarioState->invincTimer == 0
+        && gMarioState->squishTimer == 0
+        && gMarioState->particleFlags == 0
+        && memcmp( &layout, &instance->idleLayout, sizeof( struct LevelLayoutStamp )) == 0
+        && memcmp( &check, &instance->idleCheck, sizeof( struct MarioIdleCheck )) == 0;
+
+    instance->idleTicks = resting ? instance->idleTicks + 1 : 0;
+    memcpy( &instance->idleCheck, &check, sizeof( struct MarioIdleCheck ));
+    instance->idleLayout = layout;
+}
+
+/**
+ * @brief Tells whether the bound Mario can skip its full tick. A collision change in its rooms or around it wakes it.
+ */
+static bool mario_idle_asleep( struct MarioInstance *instance )
+{
+    if( instance == NULL || instance->idleTicks < MARIO_IDLE_TICKS_TO_SLEEP )
+        return false;
+
+    struct LevelLayoutStamp layout;
+    level_get_layout_stamp( gMarioState->pos[0], gMarioState->pos[2], &layout );
+    if( memcmp( &layout, &instance->idleLayout, sizeof( struct LevelLayoutStamp )) != 0 )
+    {
+        instance->idleTicks = 0;
+        return false;
     }
 
-	set_global_mario_state(marioId);
+    return true;
+}
 
+/**
+ * @brief Runs one physics tick of the Mario whose state is currently bound, without reporting its state.
+ */
+static void mario_step_bound( const struct SM64MarioInputs *inputs, struct SM64MarioGeometryBuffers *outBuffers )
+{
     gMarioState->fallDamage = 0;
 
     update_button( inputs->buttonA, A_BUTTON );
@@ -331,23 +716,46 @@ SM64_LIB_FN void sm64_mario_tick(int32_t marioId, const struct SM64MarioInputs *
     gController.stickY = 64.0f * inputs->stickY;
     gController.stickMag = sqrtf( gController.stickX*gController.stickX + gController.stickY*gController.stickY );
 
+    bool noInput = gController.buttonDown == 0 && gController.stickX == 0.0f && gController.stickY == 0.0f;
+    if( noInput && mario_idle_asleep( s_bound_instance ))
+    {
+        // Nothing a full tick reads has changed, so only the animation and the timers advance.
+        mario_process_geometry( outBuffers );
+        gAreaUpdateCounter++;
+        return;
+    }
+
+    // Muted for the tick only, the thread may play sounds of its own afterwards.
+    bool muted = s_bound_instance != NULL && s_bound_instance->isFork;
+    set_sound_requests_muted( muted );
+
 	apply_mario_platform_displacement();
     bhv_mario_update();
     update_mario_platform(); // TODO platform grabbed here and used next tick could be a use-after-free
 
-    gfx_adapter_bind_output_buffers( outBuffers );
+    set_sound_requests_muted( FALSE );
 
-    geo_process_root_hack_single_node( s_mario_graph_node );
+    mario_idle_update( s_bound_instance, noInput );
+    mario_process_geometry( outBuffers );
 
     gAreaUpdateCounter++;
+}
+
+// Engine s16 angle to the radians given to the host.
+static float mario_angle_to_radians( s16 angle )
+{
+    return (float)angle / 32768.0f * 3.14159f;
+}
 
+static void mario_write_state( struct SM64MarioState *outState )
+{
 	int i;
     outState->health = gMarioState->health;
     vec3f_copy( outState->position, gMarioState->pos );
     vec3f_copy( outState->velocity, gMarioState->vel );
-    for (i=0; i<3; i++) outState->angleVel[i] = (float)gMarioState->angleVel[i] / 32768.0f * 3.14159f;
-    outState->faceAngle = (float)gMarioState->faceAngle[1] / 32768.0f * 3.14159f;
-    outState->pitchAngle = (float)gMarioState->faceAngle[0] / 32768.0f * 3.14159f;
+    for (i=0; i<3; i++) outState->angleVel[i] = mario_angle_to_radians( gMarioState->angleVel[i] );
+    outState->faceAngle = mario_angle_to_radians( gMarioState->faceAngle[1] );
+    outState->pitchAngle = mario_angle_to_radians( gMarioState->faceAngle[0] );
 	outState->action = gMarioState->action;
 	outState->flags = gMarioState->flags;
 	outState->particleFlags = gMarioState->particleFlags;
@@ -356,28 +764,660 @@ SM64_LIB_FN void sm64_mario_tick(int32_t marioId, const struct SM64MarioInputs *
 	outState->fallDamage = gMarioState->fallDamage;
 }
 
-SM64_LIB_FN void sm64_mario_delete( int32_t marioId )
+/**
+ * @brief Ticks the Mario whose state is currently bound.
+ */
+static void mario_tick_bound( const struct SM64MarioInputs *inputs, struct SM64MarioState *outState, struct SM64MarioGeometryBuffers *outBuffers )
 {
-    if( marioId >= s_mario_instance_pool.size || s_mario_instance_pool.objects[marioId] == NULL )
+	mario_step_bound( inputs, outBuffers );
+	mario_write_state( outState );
+}
+
+// outBuffers can be NULL for a physics only tick, the animation still advances but no geometry is generated.
+SM64_LIB_FN void sm64_mario_tick(int32_t marioId, const struct SM64MarioInputs *inputs, struct SM64MarioState *outState, struct SM64MarioGeometryBuffers *outBuffers )
+{
+    if( mario_instance_from_id( marioId ) == NULL )
+    {
+        DEBUG_PRINT("Tried to tick non-existant Mario with ID: %u", marioId);
+        return;
+    }
+
+	mario_bind(marioId);
+	mario_tick_bound( inputs, outState, outBuffers );
+
+	if( recorder_active() )
+		recorder_log_mario_tick( marioId, inputs, outState, outBuffers != NULL );
+}
+
+// Runs inputs[0] to inputs[count - 1] back to back. Only the last tick reports its state and, when outBuffers isn't NULL, its geometry.
+SM64_LIB_FN void sm64_mario_tick_n(int32_t marioId, const struct SM64MarioInputs *inputs, uint32_t count, struct SM64MarioState *outState, struct SM64MarioGeometryBuffers *outBuffers )
+{
+    if( mario_instance_from_id( marioId ) == NULL )
+    {
+        DEBUG_PRINT("Tried to tick non-existant Mario with ID: %u", marioId);
+        return;
+    }
+
+    if( count == 0 )
+        return;
+
+    mario_bind(marioId);
+
+    if( recorder_active() )
+    {
+        // Every tick is recorded on its own so the replay can check the intermediate states too.
+        struct SM64MarioState state;
+        for( uint32_t i = 0; i < count - 1; ++i )
+        {
+            mario_tick_bound( &inputs[i], &state, NULL );
+            recorder_log_mario_tick( marioId, &inputs[i], &state, false );
+        }
+        mario_tick_bound( &inputs[count - 1], outState, outBuffers );
+        recorder_log_mario_tick( marioId, &inputs[count - 1], outState, outBuffers != NULL );
+        return;
+    }
+
+    for( uint32_t i = 0; i < count - 1; ++i )
+        mario_step_bound( &inputs[i], NULL );
+
+    mario_tick_bound( &inputs[count - 1], outState, outBuffers );
+}
+
+struct MarioTickBatch
+{
+    const int32_t *marioIds;
+    const struct SM64MarioInputs *inputs;
+    struct SM64MarioState *outStates;
+    struct SM64MarioGeometryBuffers *outBuffers;
+
+    // Looked up once before the workers start, entry i is NULL for an invalid id or a Mario without loaded rooms.
+    struct MarioInstance **instances;
+    struct MarioLoadedRooms **loadedRooms;
+};
+
+static void mario_tick_batch_task( void *context, uint32_t i )
+{
+	struct MarioTickBatch *batch = (struct MarioTickBatch *)context;
+	struct MarioInstance *instance = batch->instances[i];
+	if( instance == NULL )
+	{
+		DEBUG_PRINT("Tried to tick non-existant Mario with ID: %u", batch->marioIds[i]);
+		return;
+	}
+	// Without rooms of its own it would be ticked against the record the worker bound last.
+	if( batch->loadedRooms[i] == NULL )
+		return;
+
+	mario_bind_resolved( instance, batch->loadedRooms[i] );
+	mario_tick_bound( &batch->inputs[i], &batch->outStates[i], batch->outBuffers != NULL ? &batch->outBuffers[i] : NULL );
+}
+
+/**
+ * @brief Records the Marios of a batch that were ticked, the outputs of skipped entries were never written.
+ */
+static void mario_tick_batch_record( const struct MarioTickBatch *batch, uint32_t count )
+{
+	const int32_t *marioIds = batch->marioIds;
+	const struct SM64MarioInputs *inputs = batch->inputs;
+	const struct SM64MarioState *outStates = batch->outStates;
+
+	int32_t *ids = malloc( sizeof( int32_t ) * ( count + 1 ));
+	struct SM64MarioInputs *tickedInputs = malloc( sizeof( struct SM64MarioInputs ) * ( count + 1 ));
+	struct SM64MarioState *states = malloc( sizeof( struct SM64MarioState ) * ( count + 1 ));
+
+	uint32_t ticked = 0;
+	for( uint32_t i = 0; i < count; ++i )
+	{
+		if( batch->instances[i] == NULL || batch->loadedRooms[i] == NULL )
+			continue;
+
+		ids[ticked] = marioIds[i];
+		tickedInputs[ticked] = inputs[i];
+		states[ticked] = outStates[i];
+		ticked++;
+	}
+
+	recorder_log_mario_tick_batch( ids, tickedInputs, states, ticked, batch->outBuffers != NULL );
+
+	free( ids );
+	free( tickedInputs );
+	free( states );
+}
+
+// Mesh instances farther than this from every Mario get their world surfaces freed, see mario_release_mesh_instances.
+#define MESH_INSTANCE_KEEP_DISTANCE 1000.0f
+
+/**
+ * @brief Frees the world surfaces of the mesh instances no Mario is near, the floor, wall and ceiling of each Mario are kept.
+ * The level must not be queried on another thread meanwhile.
+ */
+static void mario_release_mesh_instances( void )
+{
+	Vec3f *positions = malloc( sizeof( Vec3f ) * ( s_mario_instance_pool.size + 1 ));
+	const struct Surface **pinned = malloc( sizeof( struct Surface * ) * 3 * ( s_mario_instance_pool.size + 1 ));
+
+	uint32_t count = 0;
+	for( uint32_t i = 0; i < s_mario_instance_pool.size; ++i )
+	{
+		uint32_t marioId = obj_pool_id_at( &s_mario_instance_pool, i );
+		if( marioId == OBJ_POOL_INVALID_ID )
+			continue;
+
+		const struct MarioState *m = &mario_instance_from_id( marioId )->globalState.mgMarioStateVal;
+		vec3f_copy( positions[count], (f32 *)m->pos );
+		pinned[3 * count] = m->floor;
+		pinned[3 * count + 1] = m->wall;
+		pinned[3 * count + 2] = m->ceil;
+		count++;
+	}
+
+	level_release_mesh_instances_surfaces( positions, count, MESH_INSTANCE_KEEP_DISTANCE, pinned, 3 * count );
+
+	free( positions );
+	free( pinned );
+}
+
+static uint32_t s_batch_serial = 0;
+
+// Entry i of inputs, outStates and outBuffers belongs to marioIds[i]. Invalid ids are skipped and leave their outputs untouched.
+// The Marios are spread over the worker pool when it's running, so an id appearing twice in a batch is only ticked once.
+// outBuffers can be NULL to tick the whole batch without generating geometry.
+SM64_LIB_FN void sm64_mario_tick_batch(const int32_t *marioIds, const struct SM64MarioInputs *inputs, struct SM64MarioState *outStates, struct SM64MarioGeometryBuffers *outBuffers, uint32_t count )
+{
+	struct MarioTickBatch batch = { marioIds, inputs, outStates, outBuffers, NULL, NULL };
+	// 0 is what new Marios start with, so it's never a batch serial.
+	if( ++s_batch_serial == 0 )
+		s_batch_serial = 1;
+	batch.instances = malloc( sizeof( struct MarioInstance * ) * ( count + 1 ));
+	batch.loadedRooms = malloc( sizeof( struct MarioLoadedRooms * ) * ( count + 1 ));
+	for( uint32_t i = 0; i < count; ++i )
+	{
+		batch.instances[i] = mario_instance_from_id( marioIds[i] );
+		batch.loadedRooms[i] = batch.instances[i] != NULL ? mario_resolve_loaded_rooms( batch.instances[i] ) : NULL;
+		if( batch.instances[i] == NULL )
+			continue;
+
+		// Each Mario owns its record, so distinct Marios never share one. A repeated id would, on two workers at once.
+		if( batch.instances[i]->batchSerial == s_batch_serial )
+		{
+			DEBUG_PRINT("Mario %d appears twice in the batch, the repeat is skipped", marioIds[i]);
+			batch.loadedRooms[i] = NULL;
+			continue;
+		}
+		batch.instances[i]->batchSerial = s_batch_serial;
+
+		if( batch.loadedRooms[i] == NULL )
+			DEBUG_PRINT("Mario %d has no loaded rooms, skipped in the batch", marioIds[i]);
+	}
+
+	level_queries_parallel_begin();
+	worker_pool_run( mario_tick_batch_task, &batch, count );
+	level_queries_parallel_end();
+
+	if( recorder_active() )
+		mario_tick_batch_record( &batch, count );
+
+	free( batch.instances );
+	free( batch.loadedRooms );
+}
+
+SM64_LIB_FN bool sm64_worker_pool_init( uint32_t threadCount, const int32_t *cpus )
+{
+	return worker_pool_init( threadCount, cpus, sm64_thread_terminate );
+}
+
+SM64_LIB_FN void sm64_worker_pool_terminate( void )
+{
+	worker_pool_terminate();
+}
+
+static void mario_delete( int32_t marioId )
+{
+    if( mario_instance_from_id( marioId ) == NULL )
     {
         DEBUG_PRINT("Tried to delete non-existant Mario with ID: %u", marioId);
         return;
     }
 
-    struct GlobalState *globalState = set_global_mario_state(marioId);
+    set_global_mario_state(marioId);
 
 	stop_sound(SOUND_MARIO_SNORING3, gMarioState->marioObj->header.gfx.cameraToObject);
 
-    free( gMarioObject );
-    free_area( gCurrentArea );
+    // The instance memory stays in the pool for the next Mario, only the loaded rooms slot and the poses have to be given back.
+    struct MarioInstance *instance = mario_instance_from_id( marioId );
+    free( instance->poseHistory );
+    instance->poseHistory = NULL;
+    if( s_bound_instance == instance )
+        s_bound_instance = NULL;
+    if( instance->isFork )
+        level_release_loaded_rooms( &instance->loadedRooms );
+    else
+        level_unload_player_loaded_rooms( marioId );
+    obj_pool_free( &s_mario_instance_pool, marioId );
+}
 
-    global_state_delete( globalState );
-    obj_pool_free_index( &s_mario_instance_pool, marioId );
+SM64_LIB_FN void sm64_mario_delete( int32_t marioId )
+{
+    if( recorder_active() )
+        recorder_log_mario_delete( marioId );
+    mario_delete( marioId );
+}
+
+// Entry i of every array belongs to marioIds[i], arrays left NULL are skipped. Entries of invalid ids are zeroed.
+// Reads the instances directly without binding them, so it doesn't wake idle Marios. Returns the number of valid ids.
+SM64_LIB_FN uint32_t sm64_export_states( const int32_t *marioIds, uint32_t count, const struct SM64MarioStateArrays *outArrays )
+{
+    uint32_t exported = 0;
+
+    for( uint32_t i = 0; i < count; ++i )
+    {
+        struct MarioInstance *instance = mario_instance_from_id( marioIds[i] );
+        const struct MarioState *m = instance != NULL ? &instance->globalState.mgMarioStateVal : NULL;
+        if( m != NULL ) exported++;
+
+        if( outArrays->positionX ) outArrays->positionX[i] = m ? m->pos[0] : 0.0f;
+        if( outArrays->positionY ) outArrays->positionY[i] = m ? m->pos[1] : 0.0f;
+        if( outArrays->positionZ ) outArrays->positionZ[i] = m ? m->pos[2] : 0.0f;
+        if( outArrays->velocityX ) outArrays->velocityX[i] = m ? m->vel[0] : 0.0f;
+        if( outArrays->velocityY ) outArrays->velocityY[i] = m ? m->vel[1] : 0.0f;
+        if( outArrays->velocityZ ) outArrays->velocityZ[i] = m ? m->vel[2] : 0.0f;
+        if( outArrays->faceAngle ) outArrays->faceAngle[i] = m ? mario_angle_to_radians( m->faceAngle[1] ) : 0.0f;
+        if( outArrays->health ) outArrays->health[i] = m ? m->health : 0;
+        if( outArrays->action ) outArrays->action[i] = m ? m->action : 0;
+        if( outArrays->flags ) outArrays->flags[i] = m ? m->flags : 0;
+    }
+
+    return exported;
+}
+
+#define MARIO_SNAPSHOT_MAGIC 0x4D534E50 // "MSNP"
+#define MARIO_SNAPSHOT_VERSION 2
+
+// Values of the Mario object that the simulation reads back, the rest of the object is set up once at creation.
+struct MarioObjectSnapshot
+{
+    s16 activeFlags;
+    s16 nodeFlags;
+    Vec3s angle;
+    Vec3f pos;
+    Vec3f scale;
+    Vec3f cameraToObject;
+    struct AnimInfo animInfo;
+    u32 curAnimIndex;
+    u32 rawData[0x50];
+    f32 hitboxRadius;
+    f32 hitboxHeight;
+    f32 hurtboxRadius;
+    f32 hurtboxHeight;
+    f32 hitboxDownOffset;
+    Mat4 transform;
+    u32 collidedObjInteractTypes;
+    // Saved by what owns the transform, a platform that isn't the floor's survives the round trip too.
+    struct SurfaceRef platform;
+};
+
+// Layout of the buffers written by sm64_mario_save_state. Every pointer is either cleared or stored as an id.
+struct MarioSnapshot
+{
+    uint32_t magic;
+    uint32_t version;
+    struct GlobalState globalState;
+    struct MarioObjectSnapshot marioObject;
+    struct Camera camera;
+    struct SurfaceRef floor;
+    struct SurfaceRef ceil;
+    struct SurfaceRef wall;
+};
+
+STATIC_ASSERT( sizeof( struct MarioSnapshot ) <= SM64_MARIO_STATE_SIZE, "Mario snapshots must fit in SM64_MARIO_STATE_SIZE" );
+
+static void mario_snapshot_clear_pointers( struct GlobalState *state )
+{
+    struct MarioState *m = &state->mgMarioStateVal;
+
+    state->mgCurrentArea = NULL;
+    state->mgCurrentObject = NULL;
+    state->mgMarioObject = NULL;
+    state->mgMarioSpawnInfoVal.behaviorScript = NULL;
+    state->mgMarioSpawnInfoVal.unk18 = NULL;
+    state->mgMarioSpawnInfoVal.next = NULL;
+    state->mD_80339D10.animDmaTable = NULL;
+    state->mD_80339D10.targetAnim = NULL;
+
+    m->wall = NULL;
+    m->ceil = NULL;
+    m->floor = NULL;
+    m->interactObj = NULL;
+    m->heldObj = NULL;
+    m->usedObj = NULL;
+    m->riddenObj = NULL;
+    m->marioObj = NULL;
+    m->spawnInfo = NULL;
+    m->area = NULL;
+    m->marioBodyState = NULL;
+    m->controller = NULL;
+    m->animation = NULL;
+}
+
+/**
+ * @brief Points the restored global state back at the parts of its own instance, the way sm64_mario_create and init_mario set them.
+ */
+static void mario_snapshot_bind_pointers( struct MarioInstance *instance )
+{
+    struct GlobalState *state = &instance->globalState;
+    struct MarioState *m = &state->mgMarioStateVal;
+
+    state->mgCurrentArea = &instance->area;
+    state->mgCurrentObject = &instance->marioObject;
+    state->mgMarioObject = &instance->marioObject;
+    state->mD_80339D10.targetAnim = mario_animation_from_index( state->mD_80339D10.currentAnimAddr );
+
+    m->marioObj = &instance->marioObject;
+    m->spawnInfo = &state->mgMarioSpawnInfoVal;
+    m->area = &instance->area;
+    m->marioBodyState = &state->mgBodyStates[0];
+    m->controller = &state->mgController;
+    m->animation = &state->mD_80339D10;
+}
+
+static void mario_object_save( struct MarioObjectSnapshot *dst, struct Object *src )
+{
+    dst->activeFlags = src->activeFlags;
+    dst->nodeFlags = src->header.gfx.node.flags;
+    vec3s_copy( dst->angle, src->header.gfx.angle );
+    vec3f_copy( dst->pos, src->header.gfx.pos );
+    vec3f_copy( dst->scale, src->header.gfx.scale );
+    vec3f_copy( dst->cameraToObject, src->header.gfx.cameraToObject );
+    dst->animInfo = src->header.gfx.animInfo;
+    dst->animInfo.curAnim = NULL;
+    dst->curAnimIndex = mario_animation_to_index( src->header.gfx.animInfo.curAnim );
+    memcpy( dst->rawData, src->rawData.asU32, sizeof( dst->rawData ));
+    dst->hitboxRadius = src->hitboxRadius;
+    dst->hitboxHeight = src->hitboxHeight;
+    dst->hurtboxRadius = src->hurtboxRadius;
+    dst->hurtboxHeight = src->hurtboxHeight;
+    dst->hitboxDownOffset = src->hitboxDownOffset;
+    mtxf_copy( dst->transform, src->transform );
+    dst->collidedObjInteractTypes = src->collidedObjInteractTypes;
+    level_transform_to_ref( src->platform, &dst->platform );
+}
+
+static void mario_object_load( struct Object *dst, const struct MarioObjectSnapshot *src )
+{
+    dst->activeFlags = src->activeFlags;
+    dst->header.gfx.node.flags = src->nodeFlags;
+    vec3s_copy( dst->header.gfx.angle, (s16 *)src->angle );
+    vec3f_copy( dst->header.gfx.pos, (f32 *)src->pos );
+    vec3f_copy( dst->header.gfx.scale, (f32 *)src->scale );
+    vec3f_copy( dst->header.gfx.cameraToObject, (f32 *)src->cameraToObject );
+    dst->header.gfx.animInfo = src->animInfo;
+    dst->header.gfx.animInfo.curAnim = mario_animation_from_index( src->curAnimIndex );
+    memcpy( dst->rawData.asU32, src->rawData, sizeof( src->rawData ));
+    dst->hitboxRadius = src->hitboxRadius;
+    dst->hitboxHeight = src->hitboxHeight;
+    dst->hurtboxRadius = src->hurtboxRadius;
+    dst->hurtboxHeight = src->hurtboxHeight;
+    dst->hitboxDownOffset = src->hitboxDownOffset;
+    mtxf_copy( dst->transform, (Vec4f *)src->transform );
+    dst->collidedObjInteractTypes = src->collidedObjInteractTypes;
+    dst->platform = level_transform_from_ref( &src->platform );
+}
+
+SM64_LIB_FN bool sm64_mario_save_state( int32_t marioId, uint8_t *outBuffer )
+{
+    if( mario_bind( marioId ) == NULL )
+        return false;
+
+    struct MarioInstance *instance = mario_instance_from_id( marioId );
+
+    // Built on the stack so the caller buffer doesn't need any alignment, and zeroed so equal states give equal bytes.
+    struct MarioSnapshot snapshot;
+    memset( &snapshot, 0, sizeof( struct MarioSnapshot ));
+    snapshot.magic = MARIO_SNAPSHOT_MAGIC;
+    snapshot.version = MARIO_SNAPSHOT_VERSION;
+
+    snapshot.globalState = instance->globalState;
+    mario_snapshot_clear_pointers( &snapshot.globalState );
+    level_surface_to_ref( gMarioState->floor, &snapshot.floor );
+    level_surface_to_ref( gMarioState->ceil, &snapshot.ceil );
+    level_surface_to_ref( gMarioState->wall, &snapshot.wall );
+
+    mario_object_save( &snapshot.marioObject, &instance->marioObject );
+    snapshot.camera = instance->camera;
+
+    memcpy( outBuffer, &snapshot, sizeof( struct MarioSnapshot ));
+    return true;
+}
+
+SM64_LIB_FN bool sm64_mario_load_state( int32_t marioId, const uint8_t *buffer )
+{
+    if( set_global_mario_state( marioId ) == NULL )
+        return false;
+
+    struct MarioSnapshot snapshot;
+    memcpy( &snapshot, buffer, sizeof( struct MarioSnapshot ));
+    if( snapshot.magic != MARIO_SNAPSHOT_MAGIC || snapshot.version != MARIO_SNAPSHOT_VERSION )
+    {
+        DEBUG_PRINT("Tried to load an invalid Mario state into Mario with ID: %d", marioId);
+        return false;
+    }
+
+    struct MarioInstance *instance = mario_instance_from_id( marioId );
+
+    instance->globalState = snapshot.globalState;
+    mario_snapshot_bind_pointers( instance );
+    gMarioState->floor = level_surface_from_ref( &snapshot.floor );
+    gMarioState->ceil = level_surface_from_ref( &snapshot.ceil );
+    gMarioState->wall = level_surface_from_ref( &snapshot.wall );
+
+    mario_object_load( &instance->marioObject, &snapshot.marioObject );
+    instance->camera = snapshot.camera;
+
+    // Blending from the pose before the load would smear the Mario across the jump.
+    if( instance->poseHistory != NULL )
+        instance->poseHistory->count = 0;
+
+    if( recorder_active() )
+        recorder_log_mario_load_state( marioId, buffer, sizeof( struct MarioSnapshot ));
+    return true;
+}
+
+/**
+ * @brief Moves a freshly copied Mario to its spawn point, the part of init_mario that depends on the position.
+ * @return false when there's no floor under the spawn point.
+ */
+static bool mario_clone_place( float x, float y, float z, int16_t rx, int16_t ry, int16_t rz )
+{
+    struct MarioState *m = gMarioState;
+
+    vec3f_set( m->pos, x, y, z );
+    vec3f_set( m->vel, 0, 0, 0 );
+    vec3s_set( m->faceAngle, rx, ry, rz );
+    vec3s_set( m->angleVel, 0, 0, 0 );
+    m->forwardVel = 0.0f;
+    vec3f_copy( m->spawnInfo->startPos, m->pos );
+    vec3s_copy( m->spawnInfo->startAngle, m->faceAngle );
+
+    m->waterLevel = find_water_level( x, z );
+    m->floorHeight = find_floor( x, y, z, &m->floor );
+    if( m->floor == NULL )
+        return false;
+
+    m->curTerrain = m->floor->terrain;
+    if( m->pos[1] < m->floorHeight )
+        m->pos[1] = m->floorHeight;
+
+    struct Object *o = m->marioObj;
+    o->oPosX = m->pos[0];
+    o->oPosY = m->pos[1];
+    o->oPosZ = m->pos[2];
+    o->oMoveAnglePitch = m->faceAngle[0];
+    o->oMoveAngleYaw = m->faceAngle[1];
+    o->oMoveAngleRoll = m->faceAngle[2];
+    vec3f_copy( o->header.gfx.pos, m->pos );
+    vec3s_set( o->header.gfx.angle, 0, m->faceAngle[1], 0 );
+    return true;
+}
+
+static int32_t mario_clone( int32_t templateId, float x, float y, float z, int16_t rx, int16_t ry, int16_t rz, int *loadedRooms, int loadedCount )
+{
+    if( mario_instance_from_id( templateId ) == NULL )
+    {
+        DEBUG_PRINT("Tried to clone non-existant Mario with ID: %u", templateId);
+        return -1;
+    }
+
+    size_t roomIdsSize = sizeof( uint32_t ) * level_get_room_slots_count();
+    int32_t marioId = obj_pool_alloc( &s_mario_instance_pool, sizeof( struct MarioInstance ) + roomIdsSize );
+    if( marioId < 0 )
+    {
+        DEBUG_PRINT("Failed to allocate a new Mario");
+        return -1;
+    }
+
+    // Fetched after the allocation, which may have grown the pool.
+    struct MarioInstance *source = mario_instance_from_id( templateId );
+    struct MarioInstance *instance = mario_instance_from_id( marioId );
+    memset( instance, 0, sizeof( struct MarioInstance ));
+
+    instance->globalState = source->globalState;
+    instance->marioObject = source->marioObject;
+    instance->area = source->area;
+    instance->camera = source->camera;
+    instance->updateInterval = source->updateInterval;
+
+    // The copy still points into the template, everything it owns is pointed back at itself and the rest is dropped.
+    mario_snapshot_clear_pointers( &instance->globalState );
+    mario_snapshot_bind_pointers( instance );
+    instance->area.camera = &instance->camera;
+    instance->marioObject.platform = NULL;
+    instance->marioObject.header.gfx.throwMatrix = NULL;
+
+    if( !level_load_player_loaded_rooms( marioId, &instance->loadedRooms, instance->roomIds ))
+    {
+        obj_pool_free( &s_mario_instance_pool, marioId );
+        return -1;
+    }
+    level_update_player_loaded_Rooms( marioId, loadedRooms, loadedCount );
+    mario_bind( marioId );
+
+    if( !mario_clone_place( x, y, z, rx, ry, rz ))
+    {
+        DEBUG_PRINT("No floor under the clone of Mario %u", templateId);
+        mario_delete( marioId );
+        return -1;
+    }
+
+    return marioId;
+}
+
+/**
+ * @brief Points a surface of the source's own loaded rooms, the big floor or a clipper, at the same surface of the fork.
+ */
+static struct Surface *mario_fork_surface( struct Surface *surface, struct MarioLoadedRooms *source, struct MarioLoadedRooms *fork )
+{
+    struct Surface *begin = source->playerSurfaces;
+    struct Surface *end = begin + sizeof( source->playerSurfaces ) / sizeof( source->playerSurfaces[0] );
+    if( surface >= begin && surface < end )
+        return fork->playerSurfaces + ( surface - begin );
+    return surface;
+}
+
+static int32_t mario_fork( int32_t marioId )
+{
+    if( mario_instance_from_id( marioId ) == NULL )
+    {
+        DEBUG_PRINT("Tried to fork non-existant Mario with ID: %u", marioId);
+        return -1;
+    }
+
+    size_t roomIdsSize = sizeof( uint32_t ) * level_get_room_slots_count();
+    int32_t forkId = obj_pool_alloc( &s_mario_instance_pool, sizeof( struct MarioInstance ) + roomIdsSize );
+    if( forkId < 0 )
+    {
+        DEBUG_PRINT("Failed to allocate a new Mario");
+        return -1;
+    }
+
+    // Fetched after the allocation, which may have grown the pool.
+    struct MarioInstance *source = mario_instance_from_id( marioId );
+    struct MarioInstance *fork = mario_instance_from_id( forkId );
+    memset( fork, 0, sizeof( struct MarioInstance ));
+
+    fork->globalState = source->globalState;
+    fork->marioObject = source->marioObject;
+    fork->area = source->area;
+    fork->camera = source->camera;
+    fork->isFork = true;
+    level_copy_player_loaded_rooms( forkId, &fork->loadedRooms, &source->loadedRooms, fork->roomIds );
+
+    // Level surfaces and surface object transforms are shared, only what the source owns is pointed at the fork.
+    struct MarioState *m = &fork->globalState.mgMarioStateVal;
+    struct Surface *floor = mario_fork_surface( m->floor, &source->loadedRooms, &fork->loadedRooms );
+    struct Surface *wall = mario_fork_surface( m->wall, &source->loadedRooms, &fork->loadedRooms );
+    struct Surface *ceil = mario_fork_surface( m->ceil, &source->loadedRooms, &fork->loadedRooms );
+    mario_snapshot_clear_pointers( &fork->globalState );
+    mario_snapshot_bind_pointers( fork );
+    m->floor = floor;
+    m->wall = wall;
+    m->ceil = ceil;
+    fork->area.camera = &fork->camera;
+    fork->marioObject.header.gfx.throwMatrix = NULL;
+
+    return forkId;
+}
+
+// Copies a Mario into a speculative instance for searching over inputs. The fork ticks like any Mario, batches of forks
+// included, but never builds geometry nor plays sounds. It keeps the rooms its source had loaded, and is discarded
+// with sm64_mario_delete.
+SM64_LIB_FN int32_t sm64_mario_fork( int32_t marioId )
+{
+    int32_t forkId = mario_fork( marioId );
+    if( recorder_active() )
+        recorder_log_mario_fork( marioId, forkId );
+    return forkId;
+}
+
+// Spawns a Mario by copying an existing one instead of running the whole init. The clone starts in the template's action,
+// so a template that was created and never ticked gives the same Mario as sm64_mario_create at the new position.
+SM64_LIB_FN int32_t sm64_mario_clone( int32_t templateId, float x, float y, float z, int16_t rx, int16_t ry, int16_t rz, int *loadedRooms, int loadedCount )
+{
+    int32_t marioId = mario_clone( templateId, x, y, z, rx, ry, rz, loadedRooms, loadedCount );
+    if( recorder_active() )
+        recorder_log_mario_clone( templateId, x, y, z, rx, ry, rz, loadedRooms, loadedCount, marioId );
+    return marioId;
+}
+
+SM64_LIB_FN uint32_t sm64_mario_net_state_encode( const struct SM64MarioNetState *baseline, const struct SM64MarioNetState *current, uint8_t *outBuffer, uint32_t bufferSize )
+{
+    return state_delta_encode( baseline, current, outBuffer, bufferSize );
+}
+
+SM64_LIB_FN uint32_t sm64_mario_net_state_decode( const struct SM64MarioNetState *baseline, const uint8_t *buffer, uint32_t size, struct SM64MarioNetState *outState )
+{
+    return state_delta_decode( baseline, buffer, size, outState );
+}
+
+SM64_LIB_FN bool sm64_recording_start( const char *path )
+{
+    return recorder_start( path );
+}
+
+SM64_LIB_FN void sm64_recording_stop( void )
+{
+    recorder_stop();
+}
+
+SM64_LIB_FN bool sm64_replay_run( const char *path, uint32_t flags, struct SM64ReplayStats *outStats )
+{
+    return replay_run( path, flags, outStats );
 }
 
 SM64_LIB_FN void sm64_set_mario_position(int32_t marioId, float x, float y, float z)
 {
-	set_global_mario_state(marioId);
+	RECORD_SETTER( RECORD_SET_POSITION, marioId, 0, 0, 0, x, y, z, 0.0f );
+	if( set_global_mario_state(marioId) == NULL )
+		return;
 	
 	gMarioState->pos[0] = x;
 	gMarioState->pos[1] = y;
@@ -387,7 +1427,9 @@ SM64_LIB_FN void sm64_set_mario_position(int32_t marioId, float x, float y, floa
 
 SM64_LIB_FN void sm64_add_mario_position(int32_t marioId, float x, float y, float z)
 {
-	set_global_mario_state(marioId);
+	RECORD_SETTER( RECORD_ADD_POSITION, marioId, 0, 0, 0, x, y, z, 0.0f );
+	if( set_global_mario_state(marioId) == NULL )
+		return;
 	
 	gMarioState->pos[0] += x;
 	gMarioState->pos[1] += y;
@@ -397,7 +1439,9 @@ SM64_LIB_FN void sm64_add_mario_position(int32_t marioId, float x, float y, floa
 
 SM64_LIB_FN void sm64_set_mario_angle(int32_t marioId, int16_t x, int16_t y, int16_t z)
 {
-	set_global_mario_state(marioId);
+	RECORD_SETTER( RECORD_SET_ANGLE, marioId, x, y, z, 0.0f, 0.0f, 0.0f, 0.0f );
+	if( set_global_mario_state(marioId) == NULL )
+		return;
 	
 	vec3s_set(gMarioState->faceAngle, x, y, z);
 	vec3s_set(gMarioState->marioObj->header.gfx.angle, 0, gMarioState->faceAngle[1], 0);
@@ -405,7 +1449,9 @@ SM64_LIB_FN void sm64_set_mario_angle(int32_t marioId, int16_t x, int16_t y, int
 
 SM64_LIB_FN void sm64_set_mario_faceangle(int32_t marioId, int16_t y)
 {
-	set_global_mario_state(marioId);
+	RECORD_SETTER( RECORD_SET_FACEANGLE, marioId, y, 0, 0, 0.0f, 0.0f, 0.0f, 0.0f );
+	if( set_global_mario_state(marioId) == NULL )
+		return;
 	
 	gMarioState->faceAngle[1] = y;
 	vec3s_set(gMarioState->marioObj->header.gfx.angle, 0, gMarioState->faceAngle[1], 0);
@@ -413,7 +1459,9 @@ SM64_LIB_FN void sm64_set_mario_faceangle(int32_t marioId, int16_t y)
 
 SM64_LIB_FN void sm64_set_mario_velocity(int32_t marioId, float x, float y, float z)
 {
-	set_global_mario_state(marioId);
+	RECORD_SETTER( RECORD_SET_VELOCITY, marioId, 0, 0, 0, x, y, z, 0.0f );
+	if( set_global_mario_state(marioId) == NULL )
+		return;
 	
 	gMarioState->vel[0] = x;
 	gMarioState->vel[1] = y;
@@ -422,35 +1470,45 @@ SM64_LIB_FN void sm64_set_mario_velocity(int32_t marioId, float x, float y, floa
 
 SM64_LIB_FN void sm64_set_mario_forward_velocity(int32_t marioId, float vel)
 {
-	set_global_mario_state(marioId);
+	RECORD_SETTER( RECORD_SET_FORWARD_VELOCITY, marioId, 0, 0, 0, vel, 0.0f, 0.0f, 0.0f );
+	if( set_global_mario_state(marioId) == NULL )
+		return;
 	
 	gMarioState->forwardVel = vel;
 }
 
 SM64_LIB_FN void sm64_set_mario_action(int32_t marioId, uint32_t action)
 {
-	set_global_mario_state(marioId);
+	RECORD_SETTER( RECORD_SET_ACTION, marioId, action, 0, 0, 0.0f, 0.0f, 0.0f, 0.0f );
+	if( set_global_mario_state(marioId) == NULL )
+		return;
 	
 	set_mario_action( gMarioState, action, 0);
 }
 
 SM64_LIB_FN void sm64_set_mario_action_arg(int32_t marioId, uint32_t action, uint32_t actionArg)
 {
-	set_global_mario_state(marioId);
+	RECORD_SETTER( RECORD_SET_ACTION_ARG, marioId, action, actionArg, 0, 0.0f, 0.0f, 0.0f, 0.0f );
+	if( set_global_mario_state(marioId) == NULL )
+		return;
 	
 	set_mario_action( gMarioState, action, actionArg);
 }
 
 SM64_LIB_FN void sm64_set_mario_animation(int32_t marioId, int32_t animID)
 {
-	set_global_mario_state(marioId);
+	RECORD_SETTER( RECORD_SET_ANIMATION, marioId, animID, 0, 0, 0.0f, 0.0f, 0.0f, 0.0f );
+	if( set_global_mario_state(marioId) == NULL )
+		return;
 	
 	set_mario_animation(gMarioState, animID);
 }
 
 SM64_LIB_FN void sm64_set_mario_anim_frame(int32_t marioId, int16_t animFrame)
 {
-	set_global_mario_state(marioId);
+	RECORD_SETTER( RECORD_SET_ANIM_FRAME, marioId, animFrame, 0, 0, 0.0f, 0.0f, 0.0f, 0.0f );
+	if( set_global_mario_state(marioId) == NULL )
+		return;
 	
 	gMarioState->marioObj->header.gfx.animInfo.animFrame = animFrame;
 	
@@ -458,28 +1516,35 @@ SM64_LIB_FN void sm64_set_mario_anim_frame(int32_t marioId, int16_t animFrame)
 
 SM64_LIB_FN void sm64_set_mario_state(int32_t marioId, uint32_t flags)
 {
-	set_global_mario_state(marioId);
+	RECORD_SETTER( RECORD_SET_STATE, marioId, flags, 0, 0, 0.0f, 0.0f, 0.0f, 0.0f );
+	if( set_global_mario_state(marioId) == NULL )
+		return;
 	
 	gMarioState->flags = flags;
 }
 
 SM64_LIB_FN void sm64_set_mario_water_level(int32_t marioId, signed int level)
 {
-	set_global_mario_state(marioId);
+	RECORD_SETTER( RECORD_SET_WATER_LEVEL, marioId, level, 0, 0, 0.0f, 0.0f, 0.0f, 0.0f );
+	if( set_global_mario_state(marioId) == NULL )
+		return;
 	
 	gMarioState->waterLevel = level;
 }
 
 SM64_LIB_FN signed int sm64_get_mario_water_level(int32_t marioId)
 {
-	set_global_mario_state(marioId);
+	if( mario_bind(marioId) == NULL )
+		return 0;
 	
 	return gMarioState->waterLevel;
 }
 
 SM64_LIB_FN void sm64_set_mario_floor_override(int32_t marioId, uint16_t terrain, int16_t floorType)
 {
-	set_global_mario_state(marioId);
+	RECORD_SETTER( RECORD_SET_FLOOR_OVERRIDE, marioId, terrain, floorType, 0, 0.0f, 0.0f, 0.0f, 0.0f );
+	if( set_global_mario_state(marioId) == NULL )
+		return;
 	
 	gMarioState->overrideTerrain = terrain;
 	gMarioState->overrideFloorType = floorType;
@@ -487,42 +1552,53 @@ SM64_LIB_FN void sm64_set_mario_floor_override(int32_t marioId, uint16_t terrain
 
 SM64_LIB_FN void sm64_mario_take_damage(int32_t marioId, uint32_t damage, uint32_t subtype, float x, float y, float z)
 {
-	set_global_mario_state(marioId);
+	RECORD_SETTER( RECORD_TAKE_DAMAGE, marioId, damage, subtype, 0, x, y, z, 0.0f );
+	if( set_global_mario_state(marioId) == NULL )
+		return;
 	
 	fake_damage_knock_back(gMarioState, damage, subtype, x, y, z);
 }
 
 SM64_LIB_FN void sm64_mario_heal(int32_t marioId, uint8_t healCounter)
 {
-	set_global_mario_state(marioId);
+	RECORD_SETTER( RECORD_HEAL, marioId, healCounter, 0, 0, 0.0f, 0.0f, 0.0f, 0.0f );
+	if( set_global_mario_state(marioId) == NULL )
+		return;
 	
 	gMarioState->healCounter += healCounter;
 }
 
 SM64_LIB_FN void sm64_mario_set_health(int32_t marioId, uint16_t health)
 {
-	set_global_mario_state(marioId);
+	RECORD_SETTER( RECORD_SET_HEALTH, marioId, health, 0, 0, 0.0f, 0.0f, 0.0f, 0.0f );
+	if( set_global_mario_state(marioId) == NULL )
+		return;
 	
 	gMarioState->health = health;
 }
 
 SM64_LIB_FN uint16_t sm64_mario_get_health(int32_t marioId)
 {
-	set_global_mario_state(marioId);
+	if( mario_bind(marioId) == NULL )
+		return 0;
 	
 	return gMarioState->health;
 }
 
 SM64_LIB_FN void sm64_mario_kill(int32_t marioId)
 {
-	set_global_mario_state(marioId);
+	RECORD_SETTER( RECORD_KILL, marioId, 0, 0, 0, 0.0f, 0.0f, 0.0f, 0.0f );
+	if( set_global_mario_state(marioId) == NULL )
+		return;
 	
 	gMarioState->health = 0xFF;
 }
 
 SM64_LIB_FN void sm64_mario_interact_cap(int32_t marioId, uint32_t capFlag, uint16_t capTime, uint8_t playMusic)
 {
-	set_global_mario_state(marioId);
+	RECORD_SETTER( RECORD_INTERACT_CAP, marioId, capFlag, capTime, playMusic, 0.0f, 0.0f, 0.0f, 0.0f );
+	if( set_global_mario_state(marioId) == NULL )
+		return;
 	
 	uint16_t capMusic = 0;
 	if(gMarioState->action != ACT_GETTING_BLOWN && capFlag != 0)
@@ -568,7 +1644,9 @@ SM64_LIB_FN void sm64_mario_interact_cap(int32_t marioId, uint32_t capFlag, uint
 
 SM64_LIB_FN bool sm64_mario_attack(int32_t marioId, float x, float y, float z, float hitboxHeight)
 {
-	set_global_mario_state(marioId);
+	RECORD_SETTER( RECORD_ATTACK, marioId, 0, 0, 0, x, y, z, hitboxHeight );
+	if( set_global_mario_state(marioId) == NULL )
+		return false;
 	
 	return fake_interact_bounce_top(gMarioState, x, y, z, hitboxHeight);
 }
@@ -576,23 +1654,38 @@ SM64_LIB_FN bool sm64_mario_attack(int32_t marioId, float x, float y, float z, f
 SM64_LIB_FN uint32_t sm64_surface_object_create( const struct SM64SurfaceObject *surfaceObject )
 {
     uint32_t id = level_load_dynamic_object( surfaceObject );
+    if( recorder_active() )
+        recorder_log_object_create( surfaceObject, id );
     return id;
 }
 
 SM64_LIB_FN void sm64_surface_object_move( uint32_t objectId, const struct SM64ObjectTransform *transform )
 {
+    if( recorder_active() )
+        recorder_log_object_move( objectId, transform );
     level_update_dynamic_object_transform( objectId, transform );
 }
 
+SM64_LIB_FN void sm64_surface_objects_move_batch( const uint32_t *objectIds, const struct SM64ObjectTransform *transforms, uint32_t count )
+{
+    if( recorder_active() )
+        recorder_log_objects_move_batch( objectIds, transforms, count );
+    level_update_dynamic_objects_transforms( objectIds, transforms, count );
+}
+
 SM64_LIB_FN void sm64_surface_object_delete( uint32_t objectId )
 {
+    if( recorder_active() )
+        recorder_log_object_delete( objectId );
+
     // A mario standing on the platform that is being destroyed will have a pointer to freed memory if we don't clear it.
-    for( int i = 0; i < s_mario_instance_pool.size; ++i )
+    for( uint32_t i = 0; i < s_mario_instance_pool.size; ++i )
     {
-        if( s_mario_instance_pool.objects[i] == NULL )
+        uint32_t marioId = obj_pool_id_at( &s_mario_instance_pool, i );
+        if( marioId == OBJ_POOL_INVALID_ID )
             continue;
 
-        struct GlobalState *state = set_global_mario_state(i);
+        struct GlobalState *state = set_global_mario_state(marioId);
 		if( state->mgMarioObject->platform == level_get_dynamic_object_transform( objectId ))
             state->mgMarioObject->platform = NULL;
     }
@@ -600,12 +1693,13 @@ SM64_LIB_FN void sm64_surface_object_delete( uint32_t objectId )
     level_unload_dynamic_object( objectId, true );
 
 	// We need to reposition Mario's floor in case it was in the removed object.
-    for( int i = 0; i < s_mario_instance_pool.size; ++i )
+    for( uint32_t i = 0; i < s_mario_instance_pool.size; ++i )
     {
-        if( s_mario_instance_pool.objects[i] == NULL )
+        uint32_t marioId = obj_pool_id_at( &s_mario_instance_pool, i );
+        if( marioId == OBJ_POOL_INVALID_ID )
             continue;
 
-		set_global_mario_state(i);
+		set_global_mario_state(marioId);
 		find_floor(gMarioState->pos[0],gMarioState->pos[1],gMarioState->pos[2],&(gMarioState->floor));
     }
 }
@@ -698,50 +1792,70 @@ void* audio_thread(void* keepAlive)
     }
 }
 
-void copy_debug_collision_surface(struct SM64DebugSurface *dst, struct Surface *src)
+// Largest wall radius of a Mario step.
+#define COLLISION_SURFACES_QUERY_MARGIN 50.0f
+
+/**
+ * @brief Gathers the mesh instances around the bound Mario again, the query left by its last tick may be stale or empty.
+ * The count and the list refresh the same way, so they agree as long as the level doesn't change in between.
+ */
+static void collision_surfaces_query_refresh( void )
 {
-	if( src && src->isValid ) {
-		vec3i2f_copy(dst->v1, src->vertex1);
-		vec3i2f_copy(dst->v2, src->vertex2);
-		vec3i2f_copy(dst->v3, src->vertex3);
-		dst->color = src->eSurfaceType;
-		dst->valid = true;
-	}
-	else
-	{
-		vec3f_reset(dst->v1, 0);
-		vec3f_reset(dst->v2, 0);
-		vec3f_reset(dst->v3, 0);
-		dst->color = 0;
-		dst->valid = false;
-	}	
+	level_update_mesh_instances_query( gMarioState->pos[0], gMarioState->pos[2], COLLISION_SURFACES_QUERY_MARGIN );
 }
 
 void sm64_get_collision_surfaces(int marioId, struct SM64DebugSurface *floor, struct SM64DebugSurface *ceiling, struct SM64DebugSurface *wall, struct SM64DebugSurface surfaces[])
 {
-	level_set_active_mario(marioId);
+	if( set_global_mario_state(marioId) == NULL )
+		return;
 
-	copy_debug_collision_surface(floor, gMarioState->floor);
-	copy_debug_collision_surface(wall, gMarioState->wall);
-	copy_debug_collision_surface(ceiling, gMarioState->ceil);
+	collision_surfaces_query_refresh();
+	level_copy_debug_surface(floor, gMarioState->floor);
+	level_copy_debug_surface(wall, gMarioState->wall);
+	level_copy_debug_surface(ceiling, gMarioState->ceil);
 	
 
 	int index=0;
-	int roomsCount = level_get_room_count();
-	for(int i=0; i<roomsCount; i++)
+	struct LevelSurfaceIterator it;
+	struct Surface *surf;
+	level_surface_iterator_begin(&it);
+	while((surf = level_surface_iterator_next(&it)) != NULL)
 	{
-		int surfCount = level_get_room_surfaces_count(i);
-		for(int j=0; j<surfCount; j++)
-		{
-			copy_debug_collision_surface(&(surfaces[index++]), level_get_room_surface(i, j));
-		}
+		level_copy_debug_surface(&(surfaces[index++]), surf);
 	}
 }
 
+uint32_t sm64_level_get_version(void)
+{
+	return level_get_version();
+}
+
+uint32_t sm64_level_get_changed_rooms(uint32_t sinceVersion, struct SM64DebugRoomDelta *outRooms, uint32_t maxRooms)
+{
+	return level_get_changed_rooms(sinceVersion, outRooms, maxRooms);
+}
+
+uint32_t sm64_level_get_room_debug_surfaces(uint32_t roomId, struct SM64DebugSurface surfaces[])
+{
+	return level_export_room_surfaces(roomId, surfaces);
+}
+
+uint32_t sm64_level_get_changed_surface_objects(uint32_t sinceVersion, struct SM64DebugObjectDelta *outObjects, uint32_t maxObjects)
+{
+	return level_get_changed_dynamic_objects(sinceVersion, outObjects, maxObjects);
+}
+
+uint32_t sm64_surface_object_get_debug_surfaces(uint32_t objectId, struct SM64DebugSurface surfaces[])
+{
+	return level_export_dynamic_object_surfaces(objectId, surfaces);
+}
+
 int sm64_get_collision_surfaces_count(int marioId)
 {
-	level_set_active_mario(marioId);
+	if( set_global_mario_state(marioId) == NULL )
+		return 0;
 
+	collision_surfaces_query_refresh();
 	int resultCount = 0;
 	int roomsCount = level_get_room_count();
 	for(int i=0; i<roomsCount; i++)
@@ -754,47 +1868,134 @@ int sm64_get_collision_surfaces_count(int marioId)
 
 void sm64_level_init(uint32_t roomsCount)
 {
+	if( recorder_active() )
+		recorder_log_level_init(roomsCount);
 	level_init(roomsCount);
 }
 
 void sm64_level_unload()
 {
+	if( recorder_active() )
+		recorder_log_level_unload();
 	level_unload();
 }
 
+bool sm64_level_save_snapshot(const char *path)
+{
+	return level_save_snapshot(path);
+}
+
+bool sm64_level_load_snapshot(const char *path)
+{
+	if( !recorder_active() )
+		return level_load_snapshot(path);
+
+	size_t size;
+	uint8_t *data = level_read_snapshot_file(path, &size);
+	if( data == NULL )
+		return false;
+
+	recorder_log_level_load_snapshot(data, (uint32_t)size);
+	bool ok = level_load_snapshot_data(data, size);
+	free(data);
+	return ok;
+}
+
+bool sm64_level_share_rooms(const char *name)
+{
+	return level_share_rooms(name);
+}
+
+uint32_t sm64_level_attach_shared_rooms(const char *name)
+{
+	uint32_t attached = level_attach_shared_rooms(name);
+	// The rooms live in another process, a replay would have nothing to attach.
+	if( attached > 0 && recorder_active() )
+		recorder_log_unsupported("sm64_level_attach_shared_rooms");
+	return attached;
+}
+
 void sm64_level_load_room(uint32_t roomId, const struct SM64Surface *staticSurfaces, uint32_t numSurfaces, const struct SM64SurfaceObject *staticObjects, uint32_t staticObjectsCount)
 {
+	if( recorder_active() )
+		recorder_log_load_room(roomId, staticSurfaces, numSurfaces, staticObjects, staticObjectsCount);
 	level_load_room(roomId, staticSurfaces, numSurfaces, staticObjects, staticObjectsCount);
 }
 
 void sm64_level_unload_room(uint32_t roomId)
 {
+	if( recorder_active() )
+		recorder_log_unload_room(roomId);
 	level_unload_room(roomId);
 }
 
+void sm64_level_set_surface_cleanup(const struct SM64SurfaceCleanupOptions *options)
+{
+	if( recorder_active() )
+		recorder_log_surface_cleanup(options);
+	level_set_surface_cleanup(options);
+}
+
+bool sm64_level_get_room_cleanup_stats(uint32_t roomId, struct SM64SurfaceCleanupStats *outStats)
+{
+	return level_get_room_cleanup_stats(roomId, outStats);
+}
+
+uint32_t sm64_level_register_mesh(const struct SM64Surface *surfaces, uint32_t numSurfaces)
+{
+	uint32_t meshId = level_register_mesh(surfaces, numSurfaces);
+	if( recorder_active() )
+		recorder_log_register_mesh(surfaces, numSurfaces, meshId);
+	return meshId;
+}
+
+void sm64_level_release_mesh_instances(void)
+{
+	if( recorder_active() )
+		recorder_log_release_mesh_instances();
+	mario_release_mesh_instances();
+}
+
+void sm64_level_load_room_mesh_instances(uint32_t roomId, const struct SM64MeshInstance *instances, uint32_t instancesCount)
+{
+	if( recorder_active() )
+		recorder_log_mesh_instances(roomId, instances, instancesCount);
+	level_load_room_mesh_instances(roomId, instances, instancesCount);
+}
+
 void sm64_level_update_loaded_rooms_list(int marioId, int *loadedRooms, int loadedCount)
 {
+	if( recorder_active() )
+		recorder_log_loaded_rooms(marioId, loadedRooms, loadedCount, NULL, 0);
+	if( mario_instance_from_id( marioId ) == NULL )
+		return;
 	level_update_player_loaded_Rooms(marioId, loadedRooms, loadedCount);
 }
 
 void sm64_level_update_player_loaded_Rooms_with_clippers(int marioId, int *newloadedRooms, int loadedCount, const struct SM64Surface clippers[MAX_CLIPPER_BLOCKS_FACES], uint32_t clippersCount)
 {
+	if( recorder_active() )
+		recorder_log_loaded_rooms(marioId, newloadedRooms, loadedCount, clippers, clippersCount);
+	if( mario_instance_from_id( marioId ) == NULL )
+		return;
 	level_update_player_loaded_Rooms_with_clippers(marioId, newloadedRooms, loadedCount, clippers, clippersCount);
 }
 
 void sm64_level_rooms_switch(int switchedRooms[][2], int switchedRoomsCount)
 {
+	if( recorder_active() )
+		recorder_log_rooms_switch(switchedRooms, switchedRoomsCount);
 	level_rooms_switch(switchedRooms, switchedRoomsCount);
 }
 
 void sm64_level_set_active_mario(int marioId)
 {
-	level_set_active_mario(marioId);
+	set_global_mario_state(marioId);
 }
 
 float* sm64_get_mario_position(int marioId)
 {
-	if( marioId >= s_mario_instance_pool.size || s_mario_instance_pool.objects[marioId] == NULL )
+	if( mario_instance_from_id( marioId ) == NULL )
     {
         return NULL;
     }
@@ -806,7 +2007,8 @@ float* sm64_get_mario_position(int marioId)
 
 void sm64_set_mario_tank_mode(int marioId, bool tankMode)
 {
-	if( marioId >= s_mario_instance_pool.size || s_mario_instance_pool.objects[marioId] == NULL )
+	RECORD_SETTER( RECORD_SET_TANK_MODE, marioId, tankMode, 0, 0, 0.0f, 0.0f, 0.0f, 0.0f );
+	if( mario_instance_from_id( marioId ) == NULL )
     {
         return;
     }
@@ -40,6 +40,30 @@ struct SM64MarioState
 	uint8_t fallDamage;
 };
 
+struct SM64MarioStateArrays
+{
+    float *positionX;
+    float *positionY;
+    float *positionZ;
+    float *velocityX;
+    float *velocityY;
+    float *velocityZ;
+    float *faceAngle;
+    int16_t *health;
+    uint32_t *action;
+    uint32_t *flags;
+};
+
+struct SM64MarioNetState
+{
+    struct SM64MarioState state;
+    int16_t animID;
+    int16_t animYTrans;
+    int16_t animFrame;
+    int32_t animAccel;
+    int16_t rotation[3];
+};
+
 struct SM64MarioGeometryBuffers
 {
     float *position;
@@ -89,6 +113,15 @@ struct SM64AnimInfo
 	int32_t animAccel;
 };
 
+struct SM64ReplayStats
+{
+    uint32_t records;
+    uint32_t ticks;
+    uint32_t mismatches;
+    uint32_t firstMismatchTick;
+    double seconds;
+};
+
 typedef void (*SM64DebugPrintFunctionPtr)( const char * );
 
 enum
@@ -96,16 +129,52 @@ enum
     SM64_TEXTURE_WIDTH = 64 * 11,
     SM64_TEXTURE_HEIGHT = 64,
     SM64_GEO_MAX_TRIANGLES = 1024,
+    SM64_MARIO_STATE_SIZE = 4096,
+    SM64_MARIO_NET_STATE_MAX_SIZE = 128,
+};
+
+enum
+{
+    SM64_REPLAY_CHECK_STATES = 1 << 0,
+    SM64_REPLAY_SKIP_GEOMETRY = 1 << 1,
+};
+
+enum
+{
+    SM64_UPDATE_INTERVAL_AUTO = 0,
+    SM64_UPDATE_INTERVAL_NEVER = 0xFFFF,
+    SM64_UPDATE_LEVELS_MAX = 8,
 };
 
 extern SM64_LIB_FN void sm64_global_init( uint8_t *rom, uint8_t *outTexture, SM64DebugPrintFunctionPtr debugPrintFunction );
 extern SM64_LIB_FN void sm64_global_terminate( void );
+extern SM64_LIB_FN void sm64_thread_terminate( void );
 
 extern SM64_LIB_FN int32_t sm64_mario_create( float x, float y, float z, int16_t rx, int16_t ry, int16_t rz, uint8_t fake, int *loadedRooms, int loadedCount);
+extern SM64_LIB_FN int32_t sm64_mario_clone( int32_t templateId, float x, float y, float z, int16_t rx, int16_t ry, int16_t rz, int *loadedRooms, int loadedCount );
+extern SM64_LIB_FN int32_t sm64_mario_fork( int32_t marioId );
 extern SM64_LIB_FN void sm64_mario_tick(int32_t marioId, const struct SM64MarioInputs *inputs, struct SM64MarioState *outState, struct SM64MarioGeometryBuffers *outBuffers );
+extern SM64_LIB_FN bool sm64_worker_pool_init( uint32_t threadCount, const int32_t *cpus );
+extern SM64_LIB_FN void sm64_worker_pool_terminate( void );
+extern SM64_LIB_FN void sm64_mario_tick_n(int32_t marioId, const struct SM64MarioInputs *inputs, uint32_t count, struct SM64MarioState *outState, struct SM64MarioGeometryBuffers *outBuffers );
+extern SM64_LIB_FN void sm64_mario_tick_batch(const int32_t *marioIds, const struct SM64MarioInputs *inputs, struct SM64MarioState *outStates, struct SM64MarioGeometryBuffers *outBuffers, uint32_t count );
+extern SM64_LIB_FN void sm64_mario_set_update_interval( int32_t marioId, uint32_t interval );
+extern SM64_LIB_FN void sm64_set_update_observers( const float *positions, uint32_t count );
+extern SM64_LIB_FN void sm64_set_update_levels( const float *distances, const uint32_t *intervals, uint32_t count );
+extern SM64_LIB_FN bool sm64_mario_render_interpolated( int32_t marioId, float alpha, struct SM64MarioGeometryBuffers *outBuffers );
 extern SM64_LIB_FN struct SM64AnimInfo* sm64_mario_get_anim_info( int32_t marioId, int16_t rot[3] );
 extern SM64_LIB_FN void sm64_mario_anim_tick( int32_t marioId, uint32_t stateFlags, struct SM64AnimInfo* animInfo, struct SM64MarioGeometryBuffers *outBuffers, int16_t rot[3] );
 extern SM64_LIB_FN void sm64_mario_delete( int32_t marioId );
+extern SM64_LIB_FN uint32_t sm64_export_states( const int32_t *marioIds, uint32_t count, const struct SM64MarioStateArrays *outArrays );
+extern SM64_LIB_FN bool sm64_mario_save_state( int32_t marioId, uint8_t *outBuffer );
+extern SM64_LIB_FN bool sm64_mario_load_state( int32_t marioId, const uint8_t *buffer );
+extern SM64_LIB_FN uint32_t sm64_mario_net_state_encode( const struct SM64MarioNetState *baseline, const struct SM64MarioNetState *current, uint8_t *outBuffer, uint32_t bufferSize );
+// Records the level and Mario calls for sm64_replay_run, snapshot loads included.
+// sm64_level_attach_shared_rooms can't be replayed, calling it stops the recording and the replay fails there.
+extern SM64_LIB_FN bool sm64_recording_start( const char *path );
+extern SM64_LIB_FN void sm64_recording_stop( void );
+extern SM64_LIB_FN bool sm64_replay_run( const char *path, uint32_t flags, struct SM64ReplayStats *outStats );
+extern SM64_LIB_FN uint32_t sm64_mario_net_state_decode( const struct SM64MarioNetState *baseline, const uint8_t *buffer, uint32_t size, struct SM64MarioNetState *outState );
 
 extern SM64_LIB_FN void sm64_set_mario_action(int32_t marioId, uint32_t action);
 extern SM64_LIB_FN void sm64_set_mario_action_arg(int32_t marioId, uint32_t action, uint32_t actionArg);
@@ -131,6 +200,7 @@ extern SM64_LIB_FN bool sm64_mario_attack(int32_t marioId, float x, float y, flo
 
 extern SM64_LIB_FN uint32_t sm64_surface_object_create( const struct SM64SurfaceObject *surfaceObject );
 extern SM64_LIB_FN void sm64_surface_object_move( uint32_t objectId, const struct SM64ObjectTransform *transform );
+extern SM64_LIB_FN void sm64_surface_objects_move_batch( const uint32_t *objectIds, const struct SM64ObjectTransform *transforms, uint32_t count );
 extern SM64_LIB_FN void sm64_surface_object_delete( uint32_t objectId );
 
 extern SM64_LIB_FN void sm64_seq_player_play_sequence(uint8_t player, uint8_t seqId, uint16_t arg2);
@@ -144,14 +214,30 @@ extern SM64_LIB_FN int sm64_get_version();
 
 extern SM64_LIB_FN void sm64_get_collision_surfaces(int marioId, struct SM64DebugSurface *floor, struct SM64DebugSurface *ceiling, struct SM64DebugSurface *wall, struct SM64DebugSurface surfaces[]);
 extern SM64_LIB_FN int sm64_get_collision_surfaces_count(int marioId);
+extern SM64_LIB_FN uint32_t sm64_level_get_version(void);
+extern SM64_LIB_FN uint32_t sm64_level_get_changed_rooms(uint32_t sinceVersion, struct SM64DebugRoomDelta *outRooms, uint32_t maxRooms);
+extern SM64_LIB_FN uint32_t sm64_level_get_room_debug_surfaces(uint32_t roomId, struct SM64DebugSurface surfaces[]);
+extern SM64_LIB_FN uint32_t sm64_level_get_changed_surface_objects(uint32_t sinceVersion, struct SM64DebugObjectDelta *outObjects, uint32_t maxObjects);
+extern SM64_LIB_FN uint32_t sm64_surface_object_get_debug_surfaces(uint32_t objectId, struct SM64DebugSurface surfaces[]);
 
 void audio_tick();
 void* audio_thread(void* param);
 
 extern SM64_LIB_FN void sm64_level_init(uint32_t roomsCount);
 extern SM64_LIB_FN void sm64_level_unload();
+extern SM64_LIB_FN bool sm64_level_save_snapshot(const char *path);
+extern SM64_LIB_FN bool sm64_level_load_snapshot(const char *path);
+extern SM64_LIB_FN bool sm64_level_share_rooms(const char *name);
+extern SM64_LIB_FN uint32_t sm64_level_attach_shared_rooms(const char *name);
 extern SM64_LIB_FN void sm64_level_load_room(uint32_t roomId, const struct SM64Surface *staticSurfaces, uint32_t numSurfaces, const struct SM64SurfaceObject *staticObjects, uint32_t staticObjectsCount);
 extern SM64_LIB_FN void sm64_level_unload_room(uint32_t roomId);
+extern SM64_LIB_FN void sm64_level_set_surface_cleanup(const struct SM64SurfaceCleanupOptions *options);
+extern SM64_LIB_FN bool sm64_level_get_room_cleanup_stats(uint32_t roomId, struct SM64SurfaceCleanupStats *outStats);
+extern SM64_LIB_FN uint32_t sm64_level_register_mesh(const struct SM64Surface *surfaces, uint32_t numSurfaces);
+extern SM64_LIB_FN void sm64_level_load_room_mesh_instances(uint32_t roomId, const struct SM64MeshInstance *instances, uint32_t instancesCount);
+// Frees the world-space surfaces of the mesh instances no Mario is near, they are rebuilt when one comes back.
+// The level also frees them by itself once the built instance surfaces pass a budget, call it to free them right away.
+extern SM64_LIB_FN void sm64_level_release_mesh_instances(void);
 extern SM64_LIB_FN void sm64_level_update_loaded_rooms_list(int marioId, int *loadedRooms, int loadedCount);
 extern SM64_LIB_FN void sm64_level_update_player_loaded_Rooms_with_clippers(int marioId, int *newloadedRooms, int loadedCount, const struct SM64Surface clippers[MAX_CLIPPER_BLOCKS_FACES], uint32_t clippersCount);
 extern SM64_LIB_FN void sm64_level_rooms_switch(int switchedRooms[][2], int switchedRoomsCount);
@@ -88,6 +88,22 @@ void load_mario_animation(struct MarioAnimation *a, u32 index)
     }
 }
 
+u32 mario_animation_to_index(const struct SM64Animation *anim)
+{
+    if (anim == NULL || anim < s_libsm64_mario_animations || anim >= s_libsm64_mario_animations + s_num_entries)
+        return 0;
+
+    return 1 + (u32)(anim - s_libsm64_mario_animations);
+}
+
+struct SM64Animation *mario_animation_from_index(u32 index)
+{
+    if (index == 0 || index > s_num_entries)
+        return NULL;
+
+    return &s_libsm64_mario_animations[index - 1];
+}
+
 void unload_mario_anims( void )
 {
     for( int i = 0; i < s_num_entries; ++i )
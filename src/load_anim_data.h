@@ -6,5 +6,8 @@
 #include "decomp/include/types.h"
 
 extern void load_mario_animation(struct MarioAnimation *a, u32 index);
+// Animation ids follow MarioAnimation::currentAnimAddr, 1 + index in the table and 0 for none.
+extern u32 mario_animation_to_index(const struct SM64Animation *anim);
+extern struct SM64Animation *mario_animation_from_index(u32 index);
 extern void load_mario_anims_from_rom( uint8_t *rom );
 extern void unload_mario_anims( void );
\ No newline at end of file
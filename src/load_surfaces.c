@@ -8,28 +8,90 @@
 #include "decomp/include/surface_terrains.h"
 #include "decomp/engine/math_util.h"
 #include "decomp/shim.h"
+#include "decomp/game/mario_step.h"
 
 #include "debug_print.h"
+#include "surface_cleanup.h"
+#include "shared_memory.h"
 
 #define BIG_HACK_FLOOR_HEIGHT 100000
 #define BIG_HACK_FLOOR_DIMENSIONS 1000
-#define MAX_MARIO_PLAYERS 10
+#define MARIO_PLAYERS_INITIAL_CAPACITY 16
+// Built instance surfaces the level lets pile up before freeing the ones far from every player, and how far is far.
+#define MESH_INSTANCES_SURFACES_BUDGET 16384
+#define MESH_INSTANCE_KEEP_DISTANCE 1000.0f
 
 
 static uint32_t s_level_rooms_count = 0;
 
 static struct Room **s_level_rooms=NULL;
-
-static struct MarioLoadedRooms s_mario_loaded_rooms[MAX_MARIO_PLAYERS];
-static struct MarioLoadedRooms *s_current_loaded_rooms;
+static uint32_t *s_level_rooms_versions=NULL;
+
+// Surface object changes are tracked per XZ cell, so a resting Mario only wakes for the objects that can reach it.
+// Objects spanning more cells than the limit count as a level-wide change instead.
+#define LAYOUT_CELL_SIZE 1024.0f
+#define LAYOUT_CELLS_COUNT 4096
+#define LAYOUT_CELLS_MAX_PER_CHANGE 64
+// Distance around a Mario whose cells it compares, more than its wall radius and a step.
+#define LAYOUT_NEAR_MARGIN 256.0f
+
+static uint32_t s_level_version = 0;
+// Increased by changes that concern every player: level loads, loaded rooms updates and surface objects too large for the cells.
+// Room changes are covered by the room versions. Never reset.
+static uint32_t s_level_layout_version = 0;
+// Hashed by cell, set to a new s_layout_cells_version whenever a surface object reaching the cell is created, moved or deleted.
+static uint32_t s_layout_cells[LAYOUT_CELLS_COUNT];
+static uint32_t s_layout_cells_version = 0;
+
+// Owned by the Mario instances, a NULL entry is a free slot. Grows so every Mario gets a record of its own.
+static struct MarioLoadedRooms **s_mario_loaded_rooms = NULL;
+static uint32_t s_mario_loaded_rooms_capacity = 0;
+// Private copies made for forks, linked through nextPrivate.
+static struct MarioLoadedRooms *s_private_loaded_rooms = NULL;
+static THREAD_LOCAL struct MarioLoadedRooms *s_current_loaded_rooms;
 
 static struct DynamicObjects *s_dynamic_objects = NULL;
 
-static struct Room *s_big_floor_hack = NULL;
+static bool s_surface_cleanup_enabled = false;
+static struct SM64SurfaceCleanupOptions s_surface_cleanup_options;
+
+static struct RegisteredMesh *s_meshes = NULL;
+static uint32_t s_meshes_count = 0;
+// Surfaces built for mesh instances, the far instances are freed when it reaches s_mesh_instances_release_at.
+static uint32_t s_mesh_instances_built_surfaces = 0;
+static uint32_t s_mesh_instances_release_at = MESH_INSTANCES_SURFACES_BUDGET;
+static bool s_parallel_queries = false;
+
+static struct SharedMemory s_shared_rooms;
 
 static bool s_level_loaded = false;
 
 
+/**
+ * Resolves an activated room of the current Mario through the level room table.
+ * It's NULL if the room slot is not loaded right now.
+ */
+static inline struct Room *level_resolve_loaded_room(uint32_t loadedIndex)
+{
+    return s_level_rooms[s_current_loaded_rooms->roomIds[loadedIndex]];
+}
+
+/**
+ * Empties the mesh instance query of every player, their lists may point to instances that moved or were freed.
+ */
+static void mesh_instances_queries_reset()
+{
+    for(uint32_t i=0; i<s_mario_loaded_rooms_capacity; i++)
+    {
+        if(s_mario_loaded_rooms[i]!=NULL)
+            s_mario_loaded_rooms[i]->instancesQueryCount = 0;
+    }
+    for(struct MarioLoadedRooms *it=s_private_loaded_rooms; it!=NULL; it=it->nextPrivate)
+    {
+        it->instancesQueryCount = 0;
+    }
+}
+
 #define CONVERT_ANGLE( x ) ((s16)( -(x) / 180.0f * 32768.0f ))
 
 #pragma region Auxiliary Funcitons
@@ -96,7 +158,18 @@ static s32 surface_has_force(s16 surfaceType) {
     return hasForce;
 }
 
-static void engine_surface_from_lib_surface( struct Surface *surface, const struct SM64Surface *libSurf, struct SurfaceObjectTransform *transform, enum SM64ExternalSurfaceTypes externalType )
+static void transform_matrix( Mat4 m, const struct SurfaceObjectTransform *transform )
+{
+    Vec3s rotation = { transform->aFaceAnglePitch, transform->aFaceAngleYaw, transform->aFaceAngleRoll };
+    Vec3f position = { transform->aPosX, transform->aPosY, transform->aPosZ };
+    mtxf_rotate_zxy_and_translate(m, position, rotation);
+}
+
+/**
+ * Same as engine_surface_from_lib_surface but with the transform matrix already computed,
+ * so the surfaces of an object only build it once.
+ */
+static void engine_surface_from_lib_surface_with_matrix( struct Surface *surface, const struct SM64Surface *libSurf, struct SurfaceObjectTransform *transform, Mat4 m, enum SM64ExternalSurfaceTypes externalType )
 {
     int16_t type = libSurf->type;
     int16_t force = libSurf->force;
@@ -116,11 +189,6 @@ static void engine_surface_from_lib_surface( struct Surface *surface, const stru
 
     if( transform != NULL )
     {
-        Mat4 m;
-        Vec3s rotation = { transform->aFaceAnglePitch, transform->aFaceAngleYaw, transform->aFaceAngleRoll };
-        Vec3f position = { transform->aPosX, transform->aPosY, transform->aPosZ };
-        mtxf_rotate_zxy_and_translate(m, position, rotation);
-
         Vec3f v1 = { x1, y1, z1 };
         Vec3f v2 = { x2, y2, z2 };
         Vec3f v3 = { x3, y3, z3 };
@@ -201,6 +269,11 @@ static void engine_surface_from_lib_surface( struct Surface *surface, const stru
     s16 hasForce = surface_has_force(type);
     s16 flags = 0; // surf_has_no_cam_collision(type);
 
+    // Set here instead of in find_wall_collisions_from_list so queries never write to the surfaces.
+    if (nx < -0.707f || nx > 0.707f) {
+        flags |= SURFACE_FLAG_X_PROJECTION;
+    }
+
     surface->room = 0;
     surface->type = type;
     surface->flags = (s8) flags;
@@ -218,11 +291,44 @@ static void engine_surface_from_lib_surface( struct Surface *surface, const stru
     surface->externalFace = libSurf->faceId;
 }
 
+static void engine_surface_from_lib_surface( struct Surface *surface, const struct SM64Surface *libSurf, struct SurfaceObjectTransform *transform, enum SM64ExternalSurfaceTypes externalType )
+{
+    Mat4 m;
+    if( transform != NULL )
+    {
+        transform_matrix( m, transform );
+    }
+    engine_surface_from_lib_surface_with_matrix( surface, libSurf, transform, m, externalType );
+}
+
+static void surface_owner_set( struct SurfaceOwner *owner, uint32_t kind, uint32_t id, void *container )
+{
+    owner->kind = kind;
+    owner->id = id;
+    owner->container = container;
+}
+
+/**
+ * Stamps the surfaces of a room and the static object transforms they use with the room, once they are built or read back.
+ */
+static void room_set_owners( struct Room *room )
+{
+    for( uint32_t i = 0; i < room->count; ++i )
+    {
+        struct Surface *surface = &room->surfaces[i];
+        surface_owner_set( &surface->owner, SURFACE_REF_ROOM, 0, room );
+
+        // The surfaces of a static object are consecutive, the first of them stands for its transform.
+        if( surface->transform != NULL && ( i == 0 || room->surfaces[i - 1].transform != surface->transform ))
+            surface_owner_set( &surface->transform->owner, SURFACE_REF_ROOM, i, room );
+    }
+}
+
 #pragma endregion
 
 #pragma region Big Floor Hack
 
-void level_load_big_floor_hack(struct Surface *surf)
+static void level_load_big_floor_hack(struct Surface *surf)
 {
     surf->room=-1;
     surf->isValid = 1;
@@ -236,52 +342,16 @@ void level_load_big_floor_hack(struct Surface *surf)
     surf->normal.z = 0.0f;
 }
 
-void level_init_big_floor_hack()
-{
-    s_big_floor_hack = (struct Room*) malloc(sizeof(struct Room));
-    
-    s_big_floor_hack->count=2;
-
-    s_big_floor_hack->surfaces = (struct Surface*) malloc(sizeof(struct Surface)*s_big_floor_hack->count);
-
-    for(int i=0; i<s_big_floor_hack->count; i++)
-    {
-        level_load_big_floor_hack(&(s_big_floor_hack->surfaces[0]));
-        level_load_big_floor_hack(&(s_big_floor_hack->surfaces[1]));
-    }
-
-    level_update_big_floor_hack(0.0f, 0.0f, 0.0f);
-}
-
-void level_unload_big_floor_hack()
-{
-    if( s_big_floor_hack == NULL )
-    {
-        return;
-    }
-
-    if( s_big_floor_hack->surfaces!=NULL ) 
-    {
-        free(s_big_floor_hack->surfaces);
-        s_big_floor_hack->surfaces=NULL;
-    }
-
-    s_big_floor_hack->count=0;
-
-    free(s_big_floor_hack);
-    s_big_floor_hack = NULL;
-}
-
 void level_update_big_floor_hack(float x, float y, float z)
 {
-    if(s_big_floor_hack==NULL || s_big_floor_hack->surfaces==NULL)
+    if(s_current_loaded_rooms==NULL)
     {
         return;
     }
     int height = y-BIG_HACK_FLOOR_HEIGHT;
 
-    struct Surface *big_floor_hack1 = &(s_big_floor_hack->surfaces[0]);
-    struct Surface *big_floor_hack2 = &(s_big_floor_hack->surfaces[1]);
+    struct Surface *big_floor_hack1 = &(s_current_loaded_rooms->playerSurfaces[0]);
+    struct Surface *big_floor_hack2 = &(s_current_loaded_rooms->playerSurfaces[1]);
 
     big_floor_hack1->vertex1[0] = x-BIG_HACK_FLOOR_DIMENSIONS;
     big_floor_hack1->vertex2[0] = x-BIG_HACK_FLOOR_DIMENSIONS;
@@ -318,128 +388,258 @@ void level_update_big_floor_hack(float x, float y, float z)
 
 #pragma region Dynamic objects management
 
+#define DYNAMIC_OBJECT_INDEX_BITS 20
+#define DYNAMIC_OBJECT_INDEX_MASK ((1u << DYNAMIC_OBJECT_INDEX_BITS) - 1)
+#define DYNAMIC_OBJECT_GENERATION_MASK ((1u << (32 - DYNAMIC_OBJECT_INDEX_BITS)) - 1)
+#define DYNAMIC_OBJECT_NO_SLOT UINT32_MAX
+
 void level_init_dynamic_objects()
 {
     s_dynamic_objects = (struct DynamicObjects*) malloc(sizeof(struct DynamicObjects));
 
     s_dynamic_objects->objects = NULL;
     s_dynamic_objects->objectsCount = 0;
+    s_dynamic_objects->objectsCapacity = 0;
+    s_dynamic_objects->freeHead = DYNAMIC_OBJECT_NO_SLOT;
     s_dynamic_objects->cached_surfaces = NULL;
+    s_dynamic_objects->cached_owners = NULL;
     s_dynamic_objects->cached_count = 0;
+    s_dynamic_objects->cached_capacity = 0;
 }
 
-void level_update_cached_object_surface_list()
+/**
+ * Resolves an object id to its slot, rejecting ids of deleted objects whose slot was reused.
+ */
+static struct LoadedSurfaceObject *dynamic_object_from_id( uint32_t objId )
 {
-    if(s_dynamic_objects->cached_surfaces!=NULL)
-    {
-        free(s_dynamic_objects->cached_surfaces);
-        s_dynamic_objects->cached_surfaces=NULL;
-        s_dynamic_objects->cached_count = 0;
-    }
+    uint32_t idx = objId & DYNAMIC_OBJECT_INDEX_MASK;
 
-    s_dynamic_objects->cached_count=0;
+    if( s_dynamic_objects == NULL || idx >= s_dynamic_objects->objectsCount )
+        return NULL;
 
-    for(int i=0; i<s_dynamic_objects->objectsCount; i++)
+    struct LoadedSurfaceObject *obj = &s_dynamic_objects->objects[idx];
+    if( !obj->loaded || obj->id != objId )
+        return NULL;
+
+    return obj;
+}
+
+static uint32_t cached_surface_push( struct Surface *surface, uint32_t objIdx, uint32_t surfIdx )
+{
+    if( s_dynamic_objects->cached_count == s_dynamic_objects->cached_capacity )
     {
-        s_dynamic_objects->cached_count+=s_dynamic_objects->objects[i].surfaceCount;
+        s_dynamic_objects->cached_capacity = s_dynamic_objects->cached_capacity == 0 ? 64 : s_dynamic_objects->cached_capacity * 2;
+        s_dynamic_objects->cached_surfaces = realloc( s_dynamic_objects->cached_surfaces, s_dynamic_objects->cached_capacity * sizeof( struct Surface* ));
+        s_dynamic_objects->cached_owners = realloc( s_dynamic_objects->cached_owners, s_dynamic_objects->cached_capacity * sizeof( struct CachedSurfaceOwner ));
     }
 
-    //make space for big floor surfaces
-    if(s_big_floor_hack!=NULL)
-        s_dynamic_objects->cached_count+=s_big_floor_hack->count;
-    
-    s_dynamic_objects->cached_surfaces = (struct Surface**)malloc(sizeof(struct Surface*)*s_dynamic_objects->cached_count);
+    uint32_t cacheIdx = s_dynamic_objects->cached_count++;
+    s_dynamic_objects->cached_surfaces[cacheIdx] = surface;
+    s_dynamic_objects->cached_owners[cacheIdx].objIdx = objIdx;
+    s_dynamic_objects->cached_owners[cacheIdx].surfIdx = surfIdx;
+    return cacheIdx;
+}
+
+static void cached_surface_remove( uint32_t cacheIdx )
+{
+    uint32_t last = --s_dynamic_objects->cached_count;
+    if( cacheIdx == last )
+        return;
+
+    // Fill the hole with the last surface and let its owner know where it went.
+    struct CachedSurfaceOwner owner = s_dynamic_objects->cached_owners[last];
+    s_dynamic_objects->cached_surfaces[cacheIdx] = s_dynamic_objects->cached_surfaces[last];
+    s_dynamic_objects->cached_owners[cacheIdx] = owner;
+    s_dynamic_objects->objects[owner.objIdx].cacheSlots[owner.surfIdx] = cacheIdx;
+}
+
+static uint32_t layout_cell_index( int32_t cellX, int32_t cellZ )
+{
+    // Far apart cells may share a slot, that only wakes a Mario more often than needed.
+    return ((uint32_t)cellX * 73856093u ^ (uint32_t)cellZ * 19349663u) & (LAYOUT_CELLS_COUNT - 1);
+}
+
+/**
+ * Gets the cells overlapped by [minX, maxX] x [minZ, maxZ], false if there are more than LAYOUT_CELLS_MAX_PER_CHANGE.
+ */
+static bool layout_cells_range( float minX, float maxX, float minZ, float maxZ, int32_t outRange[4] )
+{
+    float x0 = floorf( minX / LAYOUT_CELL_SIZE ), x1 = floorf( maxX / LAYOUT_CELL_SIZE );
+    float z0 = floorf( minZ / LAYOUT_CELL_SIZE ), z1 = floorf( maxZ / LAYOUT_CELL_SIZE );
+
+    // Written so a NaN bound fails it too.
+    if( !(( x1 - x0 + 1.0f ) * ( z1 - z0 + 1.0f ) <= LAYOUT_CELLS_MAX_PER_CHANGE ))
+        return false;
+
+    outRange[0] = (int32_t)x0;
+    outRange[1] = (int32_t)x1;
+    outRange[2] = (int32_t)z0;
+    outRange[3] = (int32_t)z1;
+    return true;
+}
 
-    int currentIdx=0;
-    for(int i=0; i<s_dynamic_objects->objectsCount; i++)
+static void dynamic_object_compute_radius( struct LoadedSurfaceObject *obj )
+{
+    float radiusSq = 0.0f;
+    for( uint32_t i = 0; i < obj->surfaceCount; ++i )
     {
-        for(int j=0; j<s_dynamic_objects->objects[i].surfaceCount; j++)
+        for( int v = 0; v < 3; ++v )
         {
-            s_dynamic_objects->cached_surfaces[currentIdx++] = &(s_dynamic_objects->objects[i].engineSurfaces[j]);
+            float x = (float)obj->libSurfaces[i].vertices[v][0];
+            float y = (float)obj->libSurfaces[i].vertices[v][1];
+            float z = (float)obj->libSurfaces[i].vertices[v][2];
+            if( x*x + y*y + z*z > radiusSq )
+                radiusSq = x*x + y*y + z*z;
         }
     }
+    obj->radius = sqrtf( radiusSq );
+}
+
+/**
+ * Marks the cells the object reaches at its current transform as changed, called before and after it moves.
+ */
+static void dynamic_object_touch_layout( const struct LoadedSurfaceObject *obj )
+{
+    int32_t range[4];
+    const struct SurfaceObjectTransform *t = obj->transform;
+    if( !layout_cells_range( t->aPosX - obj->radius, t->aPosX + obj->radius, t->aPosZ - obj->radius, t->aPosZ + obj->radius, range ))
+    {
+        s_level_layout_version++;
+        return;
+    }
 
-    if(s_big_floor_hack!=NULL)
+    uint32_t version = ++s_layout_cells_version;
+    for( int32_t x = range[0]; x <= range[1]; ++x )
     {
-        for(int i=0; i< s_big_floor_hack->count; i++)
+        for( int32_t z = range[2]; z <= range[3]; ++z )
         {
-            s_dynamic_objects->cached_surfaces[currentIdx++]=&(s_big_floor_hack->surfaces[i]);
+            s_layout_cells[layout_cell_index( x, z )] = version;
         }
     }
 }
 
+static void dynamic_object_update_surfaces( struct LoadedSurfaceObject *obj )
+{
+    Mat4 m;
+    transform_matrix( m, obj->transform );
+    for( uint32_t i = 0; i < obj->surfaceCount; ++i )
+    {
+        engine_surface_from_lib_surface_with_matrix( &obj->engineSurfaces[i], &obj->libSurfaces[i], obj->transform, m, EXTERNAL_SURFACE_TYPE_DYNAMIC_OBJECT );
+    }
+}
+
+static void dynamic_object_set_owners( struct LoadedSurfaceObject *obj )
+{
+    surface_owner_set( &obj->transform->owner, SURFACE_REF_DYNAMIC_OBJECT, obj->id, NULL );
+    for( uint32_t i = 0; i < obj->surfaceCount; ++i )
+    {
+        surface_owner_set( &obj->engineSurfaces[i].owner, SURFACE_REF_DYNAMIC_OBJECT, obj->id, NULL );
+    }
+}
+
 uint32_t level_load_dynamic_object( const struct SM64SurfaceObject *surfaceObject )
 {
-    bool pickedOldIndex = false;
-    uint32_t idx = s_dynamic_objects->objectsCount;
+    uint32_t idx = s_dynamic_objects->freeHead;
 
-    for( int i = 0; i < s_dynamic_objects->objectsCount; ++i )
+    if( idx != DYNAMIC_OBJECT_NO_SLOT )
+    {
+        s_dynamic_objects->freeHead = s_dynamic_objects->objects[idx].nextFree;
+    }
+    else
     {
-        if( s_dynamic_objects->objects[i].surfaceCount == 0 )
+        if( s_dynamic_objects->objectsCount > DYNAMIC_OBJECT_INDEX_MASK )
         {
-            pickedOldIndex = true;
-            idx = i;
-            break;
+            DEBUG_PRINT("Tried to create more than %u surface objects", DYNAMIC_OBJECT_INDEX_MASK + 1);
+            return 0;
         }
-    }
 
-    if( !pickedOldIndex )
-    {
-        idx = s_dynamic_objects->objectsCount;
-        s_dynamic_objects->objectsCount++;
-        s_dynamic_objects->objects = realloc( s_dynamic_objects->objects, s_dynamic_objects->objectsCount * sizeof( struct LoadedSurfaceObject ));
+        if( s_dynamic_objects->objectsCount == s_dynamic_objects->objectsCapacity )
+        {
+            s_dynamic_objects->objectsCapacity = s_dynamic_objects->objectsCapacity == 0 ? 16 : s_dynamic_objects->objectsCapacity * 2;
+            s_dynamic_objects->objects = realloc( s_dynamic_objects->objects, s_dynamic_objects->objectsCapacity * sizeof( struct LoadedSurfaceObject ));
+        }
+
+        idx = s_dynamic_objects->objectsCount++;
+        s_dynamic_objects->objects[idx].generation = 0;
     }
 
     struct LoadedSurfaceObject *obj = &s_dynamic_objects->objects[idx];
 
+    // Generation 0 is skipped so 0 is never a valid object id.
+    obj->generation = (obj->generation + 1) & DYNAMIC_OBJECT_GENERATION_MASK;
+    if( obj->generation == 0 )
+        obj->generation = 1;
+    obj->id = (obj->generation << DYNAMIC_OBJECT_INDEX_BITS) | idx;
+    obj->loaded = true;
+    obj->nextFree = DYNAMIC_OBJECT_NO_SLOT;
+
     obj->surfaceCount = surfaceObject->surfaceCount;
+    obj->version = ++s_level_version;
+    obj->geometryVersion = obj->version;
+    obj->libTransform = surfaceObject->transform;
 
     obj->transform = malloc( sizeof( struct SurfaceObjectTransform ));
     init_transform( obj->transform, &surfaceObject->transform );
 
     obj->libSurfaces = malloc( obj->surfaceCount * sizeof( struct SM64Surface ));
     memcpy( obj->libSurfaces, surfaceObject->surfaces, obj->surfaceCount * sizeof( struct SM64Surface ));
+    dynamic_object_compute_radius( obj );
+    dynamic_object_touch_layout( obj );
 
     obj->engineSurfaces = malloc( obj->surfaceCount * sizeof( struct Surface ));
+    obj->cacheSlots = malloc( obj->surfaceCount * sizeof( uint32_t ));
     for( int i = 0; i < obj->surfaceCount; ++i )
     {
         engine_surface_from_lib_surface( &obj->engineSurfaces[i], &obj->libSurfaces[i], obj->transform, EXTERNAL_SURFACE_TYPE_DYNAMIC_OBJECT);
+        obj->cacheSlots[i] = cached_surface_push( &obj->engineSurfaces[i], idx, i );
     }
-
-    level_update_cached_object_surface_list();
+    dynamic_object_set_owners( obj );
 
     #ifdef DEBUG_LEVEL_ROOMS
-        printf("Added Collider %d\n", idx);
+        printf("Added Collider %u\n", obj->id);
     #endif
 
-    return idx;
+    return obj->id;
 }
 
 void level_unload_dynamic_object( uint32_t objId, bool update_cache )
 {
-    if( objId >= s_dynamic_objects->objectsCount || s_dynamic_objects->objects[objId].surfaceCount == 0 )
+    struct LoadedSurfaceObject *obj = dynamic_object_from_id( objId );
+    if( obj == NULL )
     {
         DEBUG_PRINT("Tried to unload non-existant surface object with ID: %u", objId);
         return;
     }
 
-    free( s_dynamic_objects->objects[objId].transform );
-    free( s_dynamic_objects->objects[objId].libSurfaces );
-    free( s_dynamic_objects->objects[objId].engineSurfaces );
+    if(update_cache)
+    {
+        for( uint32_t i = 0; i < obj->surfaceCount; ++i )
+        {
+            cached_surface_remove( obj->cacheSlots[i] );
+        }
+    }
+
+    dynamic_object_touch_layout( obj );
+    free( obj->transform );
+    free( obj->libSurfaces );
+    free( obj->engineSurfaces );
+    free( obj->cacheSlots );
+
+    obj->loaded = false;
+    obj->surfaceCount = 0;
+    obj->version = ++s_level_version;
+    obj->transform = NULL;
+    obj->libSurfaces = NULL;
+    obj->engineSurfaces = NULL;
+    obj->cacheSlots = NULL;
 
-    s_dynamic_objects->objects[objId].surfaceCount = 0;
-    s_dynamic_objects->objects[objId].transform = NULL;
-    s_dynamic_objects->objects[objId].libSurfaces = NULL;
-    s_dynamic_objects->objects[objId].engineSurfaces = NULL;
+    uint32_t idx = objId & DYNAMIC_OBJECT_INDEX_MASK;
+    obj->nextFree = s_dynamic_objects->freeHead;
+    s_dynamic_objects->freeHead = idx;
 
     #ifdef DEBUG_LEVEL_ROOMS
-        printf("SM64: Removed Collider %d\n", objId);
+        printf("SM64: Removed Collider %u\n", objId);
     #endif
-
-    if(update_cache)
-    {
-        level_update_cached_object_surface_list();
-    }
 }
 
 void level_unload_all_dynamic_objects()
@@ -452,18 +652,24 @@ void level_unload_all_dynamic_objects()
     {
         for( int i = 0; i < s_dynamic_objects->objectsCount; ++i )
         {
-            level_unload_dynamic_object(i, false);
+            if( s_dynamic_objects->objects[i].loaded )
+                level_unload_dynamic_object(s_dynamic_objects->objects[i].id, false);
         }
         free( s_dynamic_objects->objects );
         s_dynamic_objects->objects = NULL;
         s_dynamic_objects->objectsCount = 0;
+        s_dynamic_objects->objectsCapacity = 0;
+        s_dynamic_objects->freeHead = DYNAMIC_OBJECT_NO_SLOT;
     }
 
     if(s_dynamic_objects->cached_surfaces != NULL)
     {
         free(s_dynamic_objects->cached_surfaces);
+        free(s_dynamic_objects->cached_owners);
         s_dynamic_objects->cached_surfaces = NULL;
+        s_dynamic_objects->cached_owners = NULL;
         s_dynamic_objects->cached_count = 0;
+        s_dynamic_objects->cached_capacity = 0;
     }
 
     free(s_dynamic_objects);
@@ -472,24 +678,62 @@ void level_unload_all_dynamic_objects()
 
 void level_update_dynamic_object_transform( uint32_t objId, const struct SM64ObjectTransform *newTransform )
 {
-    if( objId >= s_dynamic_objects->objectsCount || s_dynamic_objects->objects[objId].surfaceCount == 0 )
+    struct LoadedSurfaceObject *obj = dynamic_object_from_id( objId );
+    if( obj == NULL )
     {
         DEBUG_PRINT("Tried to update non-existant surface object with ID: %u", objId);
         return;
     }
 
-    update_transform( s_dynamic_objects->objects[objId].transform, newTransform );
-    for( int i = 0; i < s_dynamic_objects->objects[objId].surfaceCount; ++i )
+    obj->version = ++s_level_version;
+    obj->libTransform = *newTransform;
+    dynamic_object_touch_layout( obj );
+    update_transform( obj->transform, newTransform );
+    dynamic_object_touch_layout( obj );
+    dynamic_object_update_surfaces( obj );
+}
+
+void level_update_dynamic_objects_transforms( const uint32_t *objIds, const struct SM64ObjectTransform *newTransforms, uint32_t count )
+{
+    if( s_dynamic_objects == NULL )
+    {
+        return;
+    }
+
+    // Validate and move every object first, every transform is then final when the surfaces get rebuilt.
+    // Each object only touches its own surfaces, so the second loop is safe to split across threads.
+    uint32_t version = ++s_level_version;
+    for( uint32_t i = 0; i < count; ++i )
+    {
+        struct LoadedSurfaceObject *obj = dynamic_object_from_id( objIds[i] );
+        if( obj == NULL )
+        {
+            DEBUG_PRINT("Tried to update non-existant surface object with ID: %u", objIds[i]);
+            continue;
+        }
+
+        obj->version = version;
+        obj->libTransform = newTransforms[i];
+        dynamic_object_touch_layout( obj );
+        update_transform( obj->transform, &newTransforms[i] );
+        dynamic_object_touch_layout( obj );
+    }
+
+    for( uint32_t i = 0; i < count; ++i )
     {
-        struct LoadedSurfaceObject *obj = &s_dynamic_objects->objects[objId];
-        engine_surface_from_lib_surface( &obj->engineSurfaces[i], &obj->libSurfaces[i], obj->transform, EXTERNAL_SURFACE_TYPE_DYNAMIC_OBJECT );
+        struct LoadedSurfaceObject *obj = dynamic_object_from_id( objIds[i] );
+        if( obj != NULL )
+        {
+            dynamic_object_update_surfaces( obj );
+        }
     }
 }
 
 struct SurfaceObjectTransform *level_get_dynamic_object_transform( uint32_t objId )
 {
-    if( objId < s_dynamic_objects->objectsCount && s_dynamic_objects->objects[objId].surfaceCount != 0 )
-        return s_dynamic_objects->objects[objId].transform;
+    struct LoadedSurfaceObject *obj = dynamic_object_from_id( objId );
+    if( obj != NULL )
+        return obj->transform;
     
     return NULL;
 }
@@ -502,9 +746,11 @@ void level_init_rooms(int roomsCount)
 {
     s_level_rooms_count = roomsCount;
     s_level_rooms = (struct Room**)malloc(sizeof(struct Room*)*roomsCount);
+    s_level_rooms_versions = (uint32_t*)malloc(sizeof(uint32_t)*roomsCount);
     for(uint32_t i=0; i<roomsCount; i++)
     {
         s_level_rooms[i]=NULL;
+        s_level_rooms_versions[i]=0;
     }
 }
 
@@ -540,8 +786,35 @@ void level_load_room(uint32_t roomId, const struct SM64Surface *staticSurfaces,
 
     struct Room *room = (struct Room*)malloc(sizeof(struct Room));
     s_level_rooms[roomId] = room;
+    s_level_rooms_versions[roomId] = ++s_level_version;
+    room->slot = roomId;
+
+    struct SM64Surface *cleanSurfaces = NULL;
+    if( s_surface_cleanup_enabled )
+    {
+        cleanSurfaces = malloc( sizeof( struct SM64Surface ) * numSurfaces );
+        memcpy( cleanSurfaces, staticSurfaces, sizeof( struct SM64Surface ) * numSurfaces );
+        numSurfaces = surface_cleanup( cleanSurfaces, numSurfaces, &s_surface_cleanup_options, &room->cleanupStats );
+        staticSurfaces = cleanSurfaces;
+
+        #ifdef DEBUG_LEVEL_ROOMS
+            printf("SM64: room %d cleanup %d -> %d surfaces (%d welded vertices, %d degenerates, %d duplicates, %d merged pairs)\n", roomId,
+                room->cleanupStats.surfacesBefore, room->cleanupStats.surfacesAfter, room->cleanupStats.verticesWelded,
+                room->cleanupStats.degeneratesRemoved, room->cleanupStats.duplicatesRemoved, room->cleanupStats.pairsMerged);
+        #endif
+    }
+    else
+    {
+        memset( &room->cleanupStats, 0, sizeof( room->cleanupStats ));
+        room->cleanupStats.surfacesBefore = numSurfaces;
+        room->cleanupStats.surfacesAfter = numSurfaces;
+    }
 
     room->count = numSurfaces;
+    room->sharedSurfaces = false;
+    room->instances = NULL;
+    room->instancesCount = 0;
+    memset( &room->instancesGrid, 0, sizeof( struct MeshInstanceGrid ));
     for(int i=0; i<staticObjectsCount; i++)
     {
         room->count += staticObjects[i].surfaceCount;
@@ -563,6 +836,29 @@ void level_load_room(uint32_t roomId, const struct SM64Surface *staticSurfaces,
             engine_surface_from_lib_surface( &room->surfaces[cIdx++], &staticObjects[i].surfaces[j], transform, EXTERNAL_SURFACE_TYPE_STATIC_MESH );
         }
     }
+    room_set_owners( room );
+
+    free( cleanSurfaces );
+}
+
+void level_set_surface_cleanup(const struct SM64SurfaceCleanupOptions *options)
+{
+    s_surface_cleanup_enabled = options != NULL;
+    if( options != NULL )
+    {
+        s_surface_cleanup_options = *options;
+    }
+}
+
+bool level_get_room_cleanup_stats(uint32_t roomId, struct SM64SurfaceCleanupStats *outStats)
+{
+    if( s_level_rooms == NULL || roomId >= s_level_rooms_count || s_level_rooms[roomId] == NULL )
+    {
+        return false;
+    }
+
+    *outStats = s_level_rooms[roomId]->cleanupStats;
+    return true;
 }
 
 void level_unload_all_rooms()
@@ -576,6 +872,8 @@ void level_unload_all_rooms()
 
         free(s_level_rooms);
         s_level_rooms=NULL;
+        free(s_level_rooms_versions);
+        s_level_rooms_versions=NULL;
         s_level_rooms_count = 0;
     }
 }
@@ -599,7 +897,9 @@ void level_unload_room(uint32_t roomId)
         return;
     }
 
-    if( room->surfaces != NULL )
+    s_level_rooms_versions[roomId] = ++s_level_version;
+
+    if( room->surfaces != NULL && !room->sharedSurfaces )
     {
         struct SurfaceObjectTransform *previousTransform=NULL;
         for(int i=0; i<room->count; i++)
@@ -614,6 +914,27 @@ void level_unload_room(uint32_t roomId)
         room->surfaces = NULL;
     }
 
+    if( room->instances != NULL )
+    {
+        for(uint32_t i=0; i<room->instancesCount; i++)
+        {
+            if(room->instances[i]->surfaces != NULL)
+            {
+                s_mesh_instances_built_surfaces -= s_meshes[room->instances[i]->meshId].count;
+            }
+            free(room->instances[i]->surfaces);
+            free(room->instances[i]);
+        }
+        free(room->instances);
+        room->instances = NULL;
+        room->instancesCount = 0;
+        free(room->instancesGrid.cellStarts);
+        free(room->instancesGrid.cellInstances);
+        memset(&room->instancesGrid, 0, sizeof(struct MeshInstanceGrid));
+
+        mesh_instances_queries_reset();
+    }
+
     free(room);
     s_level_rooms[roomId]=NULL;
 }
@@ -625,261 +946,1970 @@ void level_rooms_switch(int switchedRooms[][2], int switchedRoomsCount)
         int src = switchedRooms[i][0];
         int dst = switchedRooms[i][1];
 
+        if( src < 0 || dst < 0 || src >= s_level_rooms_count || dst >= s_level_rooms_count )
+        {
+            DEBUG_PRINT("Tried to switch rooms %d and %d out of %u rooms", src, dst, s_level_rooms_count);
+            continue;
+        }
+
         #ifdef DEBUG_LEVEL_ROOMS
             printf("SM64: Switched room %d with room %d\n", src, dst);
         #endif
 
-        // If the room we are about to unload was active in wither player we need to keep the loaded rooms updated to the new pointer
-        int idx_in_loaded_room[MAX_MARIO_PLAYERS];        
-        for(int i=0; i<MAX_MARIO_PLAYERS; i++)
-        {
-            idx_in_loaded_room[i]=-1;
-
-            if(s_mario_loaded_rooms[i].marioId==-1){
-                continue;
-            }
-
-            for(int j=0; j<s_mario_loaded_rooms[i].count; j++)
-            {
-                if(s_level_rooms[src] == s_mario_loaded_rooms[i].rooms[j])
-                {
-                    idx_in_loaded_room[i] = j;
-                    break;
-                }
-            }
-        }
-
+        // Players keep room ids, so swapping the slots is enough for them to follow the switch.
         struct Room* tmp = s_level_rooms[src];
         s_level_rooms[src] = s_level_rooms[dst];
-
-        // if the src room was activated in either player we need to switch it to the new one
-        for(int i=0; i<MAX_MARIO_PLAYERS; i++)
-        {
-            if(idx_in_loaded_room[i]>=0)
-            {
-                s_mario_loaded_rooms[i].rooms[idx_in_loaded_room[i]] = s_level_rooms[src];
-            }
-        }
-
         s_level_rooms[dst] = tmp;
+        if( s_level_rooms[src] != NULL )
+            s_level_rooms[src]->slot = src;
+        if( s_level_rooms[dst] != NULL )
+            s_level_rooms[dst]->slot = dst;
+
+        s_level_rooms_versions[src] = ++s_level_version;
+        s_level_rooms_versions[dst] = ++s_level_version;
     }
 }
 
 #pragma endregion
 
-#pragma region Player Loaded Rooms
+#pragma region Mesh instances
 
-void level_init_player_loaded_rooms()
+static void mesh_instance_compute_bounds( struct MeshInstance *instance )
 {
-    for(int i=0; i<MAX_MARIO_PLAYERS; i++)
-    {
-        s_mario_loaded_rooms[i].marioId=-1;
-        s_mario_loaded_rooms[i].count=0;
-        s_mario_loaded_rooms[i].rooms=NULL;
-        s_mario_loaded_rooms[i].clippersCount=0;
-    }
-}
+    struct RegisteredMesh *mesh = &s_meshes[instance->meshId];
 
-void level_load_player_loaded_rooms(int marioId)
-{
-    for(int i=0; i<MAX_MARIO_PLAYERS; i++)
+    Mat4 m;
+    transform_matrix( m, &instance->transform );
+
+    for(int i=0; i<8; i++)
     {
-        if(s_mario_loaded_rooms[i].marioId == -1)
+        Vec3f corner = {
+            (i & 1) ? mesh->localMax[0] : mesh->localMin[0],
+            (i & 2) ? mesh->localMax[1] : mesh->localMin[1],
+            (i & 4) ? mesh->localMax[2] : mesh->localMin[2]
+        };
+        mtxf_mul_vec3f( m, corner );
+
+        for(int k=0; k<3; k++)
         {
-            s_mario_loaded_rooms[i].marioId = marioId;
-            s_mario_loaded_rooms[i].count=0;
-            s_mario_loaded_rooms[i].rooms=(struct Room**)malloc((sizeof(struct Room*) * s_level_rooms_count));
-            s_current_loaded_rooms = &(s_mario_loaded_rooms[i]);
-            s_mario_loaded_rooms[i].clippersCount=0;
-
-            return;
+            // +-1 covers the truncation done when the surfaces get converted to integers
+            int32_t lo = (int32_t)floorf(corner[k]) - 1;
+            int32_t hi = (int32_t)ceilf(corner[k]) + 1;
+            if(i==0 || lo < instance->worldMin[k]) instance->worldMin[k] = lo;
+            if(i==0 || hi > instance->worldMax[k]) instance->worldMax[k] = hi;
         }
     }
 }
 
-void level_unload_player_loaded_rooms(int marioId)
+/**
+ * Builds the world surfaces of an instance the first time a query gets near it.
+ * Queries can run on several threads, so the surfaces are published with a compare and swap and the loser frees its copy.
+ */
+static void mesh_instance_set_owner( struct MeshInstance *instance, struct Room *room, uint32_t index )
 {
-    for(int i=0; i<MAX_MARIO_PLAYERS; i++)
-    {
-        if(s_mario_loaded_rooms[i].marioId == marioId)
-        {
-            s_mario_loaded_rooms[i].marioId=-1;
-            s_mario_loaded_rooms[i].count=0;
-            s_mario_loaded_rooms[i].clippersCount=0;
-            if(s_mario_loaded_rooms[i].rooms!=NULL){
-                free(s_mario_loaded_rooms[i].rooms);
-                s_mario_loaded_rooms[i].rooms=NULL;
-            }
-            s_current_loaded_rooms = NULL;
-        }
-    }
+    instance->room = room;
+    instance->index = index;
+    surface_owner_set( &instance->transform.owner, SURFACE_REF_MESH_INSTANCE, 0, instance );
 }
 
-void level_unload_all_player_loaded_rooms()
+static void mesh_instance_build_surfaces( struct MeshInstance *instance )
 {
-    s_current_loaded_rooms = NULL;
-    for(int i=0; i<MAX_MARIO_PLAYERS; i++)
+    struct RegisteredMesh *mesh = &s_meshes[instance->meshId];
+
+    Mat4 m;
+    transform_matrix( m, &instance->transform );
+
+    struct Surface *surfaces = malloc( sizeof( struct Surface ) * mesh->count );
+    for( uint32_t i = 0; i < mesh->count; ++i )
     {
-        s_mario_loaded_rooms[i].marioId=-1;
-        s_mario_loaded_rooms[i].count=0;
-        s_mario_loaded_rooms[i].clippersCount=0;
-        if(s_mario_loaded_rooms[i].rooms!=NULL){
-            free(s_mario_loaded_rooms[i].rooms);
-            s_mario_loaded_rooms[i].rooms=NULL;
-        }
+        engine_surface_from_lib_surface_with_matrix( &surfaces[i], &mesh->libSurfaces[i], &instance->transform, m, EXTERNAL_SURFACE_TYPE_STATIC_MESH );
+        surface_owner_set( &surfaces[i].owner, SURFACE_REF_MESH_INSTANCE, 0, instance );
     }
-}
 
-void level_update_player_loaded_Rooms_with_clippers(int marioId, int *newloadedRooms, int loadedCount, const struct SM64Surface clippers[MAX_CLIPPER_BLOCKS_FACES], uint32_t clippersCount)
-{
-    for(int i=0; i<MAX_MARIO_PLAYERS; i++)
+    struct Surface *expected = NULL;
+    if( !__atomic_compare_exchange_n( &instance->surfaces, &expected, surfaces, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE ))
     {
-        if(s_mario_loaded_rooms[i].marioId == marioId)
-        {
-            struct MarioLoadedRooms *loadedRooms = &(s_mario_loaded_rooms[i]);
-            if(loadedRooms->rooms == NULL || loadedCount==0)
-            {
-                return;
-            }
-            loadedRooms->count=0;
-            for(uint32_t i=0; i<loadedCount; i++)
-            {
-                loadedRooms->rooms[loadedRooms->count++]=s_level_rooms[newloadedRooms[i]];
-            }
-            
-            loadedRooms->clippersCount=clippersCount;
-            for( uint32_t i = 0; i < clippersCount; ++i )
-            {
-                engine_surface_from_lib_surface( &(loadedRooms->clippers[i]), &clippers[i], NULL, EXTERNAL_SURFACE_TYPE_WALL_CLIPPER );
-            }
-        }
+        free( surfaces );
+        return;
     }
+    __atomic_add_fetch( &s_mesh_instances_built_surfaces, mesh->count, __ATOMIC_RELAXED );
 }
 
-void level_update_player_loaded_Rooms(int marioId, int *newloadedRooms, int loadedCount)
+#define MESH_INSTANCE_CELL_SIZE 1024
+#define MESH_INSTANCE_GRID_MAX_CELLS 128
+
+static int32_t mesh_instances_grid_cell( int32_t origin, int32_t cellSize, uint32_t cells, float value )
 {
-    level_update_player_loaded_Rooms_with_clippers(marioId, newloadedRooms, loadedCount, NULL, 0);
+    float cell = floorf(( value - (float)origin ) / (float)cellSize );
+    if( cell < 0.0f ) return 0;
+    if( cell >= (float)cells ) return (int32_t)cells - 1;
+    return (int32_t)cell;
 }
 
-void level_set_active_mario(int marioId)
+/**
+ * Buckets every instance of the room into the cells its bounds overlap. Rebuilt whole when instances are added,
+ * the cells grow past MESH_INSTANCE_CELL_SIZE when the instances spread over more than MESH_INSTANCE_GRID_MAX_CELLS.
+ */
+static void mesh_instances_grid_build( struct Room *room )
 {
-    if(s_current_loaded_rooms!=NULL && s_current_loaded_rooms->marioId==marioId)
+    struct MeshInstanceGrid *grid = &room->instancesGrid;
+    free( grid->cellStarts );
+    free( grid->cellInstances );
+    memset( grid, 0, sizeof( struct MeshInstanceGrid ));
+    if( room->instancesCount == 0 )
     {
         return;
     }
-    for(int i=0; i<MAX_MARIO_PLAYERS; i++)
+
+    int32_t minX = room->instances[0]->worldMin[0], maxX = room->instances[0]->worldMax[0];
+    int32_t minZ = room->instances[0]->worldMin[2], maxZ = room->instances[0]->worldMax[2];
+    for( uint32_t i = 1; i < room->instancesCount; ++i )
     {
-        if(s_mario_loaded_rooms[i].marioId==marioId)
-        {
-            s_current_loaded_rooms = &(s_mario_loaded_rooms[i]);
-        }
+        const struct MeshInstance *instance = room->instances[i];
+        if( instance->worldMin[0] < minX ) minX = instance->worldMin[0];
+        if( instance->worldMax[0] > maxX ) maxX = instance->worldMax[0];
+        if( instance->worldMin[2] < minZ ) minZ = instance->worldMin[2];
+        if( instance->worldMax[2] > maxZ ) maxZ = instance->worldMax[2];
     }
-}
 
-#pragma endregion
+    int64_t span = (int64_t)maxX - minX > (int64_t)maxZ - minZ ? (int64_t)maxX - minX : (int64_t)maxZ - minZ;
+    int64_t cellSize = MESH_INSTANCE_CELL_SIZE;
+    while( span / cellSize >= MESH_INSTANCE_GRID_MAX_CELLS )
+    {
+        cellSize *= 2;
+    }
 
+    grid->originX = minX;
+    grid->originZ = minZ;
+    grid->cellSize = (int32_t)cellSize;
+    grid->cellsX = (uint32_t)(((int64_t)maxX - minX) / cellSize + 1);
+    grid->cellsZ = (uint32_t)(((int64_t)maxZ - minZ) / cellSize + 1);
 
-#pragma region Level management
+    uint32_t cellsCount = grid->cellsX * grid->cellsZ;
+    grid->cellStarts = calloc( cellsCount + 1, sizeof( uint32_t ));
+    if( grid->cellStarts == NULL )
+    {
+        memset( grid, 0, sizeof( struct MeshInstanceGrid ));
+        return;
+    }
+
+    // Counted into the start of the next cell, then summed into offsets
+    for( int pass = 0; pass < 2; ++pass )
+    {
+        for( uint32_t i = 0; i < room->instancesCount; ++i )
+        {
+            const struct MeshInstance *instance = room->instances[i];
+            int32_t x0 = mesh_instances_grid_cell( grid->originX, grid->cellSize, grid->cellsX, (float)instance->worldMin[0] );
+            int32_t x1 = mesh_instances_grid_cell( grid->originX, grid->cellSize, grid->cellsX, (float)instance->worldMax[0] );
+            int32_t z0 = mesh_instances_grid_cell( grid->originZ, grid->cellSize, grid->cellsZ, (float)instance->worldMin[2] );
+            int32_t z1 = mesh_instances_grid_cell( grid->originZ, grid->cellSize, grid->cellsZ, (float)instance->worldMax[2] );
+            for( int32_t z = z0; z <= z1; ++z )
+            {
+                for( int32_t x = x0; x <= x1; ++x )
+                {
+                    uint32_t cell = (uint32_t)z * grid->cellsX + (uint32_t)x;
+                    if( pass == 0 )
+                        grid->cellStarts[cell + 1]++;
+                    else
+                        grid->cellInstances[grid->cellStarts[cell]++] = i;
+                }
+            }
+        }
+
+        if( pass == 0 )
+        {
+            for( uint32_t c = 0; c < cellsCount; ++c )
+                grid->cellStarts[c + 1] += grid->cellStarts[c];
+
+            grid->cellInstances = malloc( sizeof( uint32_t ) * ( grid->cellStarts[cellsCount] + 1 ));
+            if( grid->cellInstances == NULL )
+            {
+                free( grid->cellStarts );
+                memset( grid, 0, sizeof( struct MeshInstanceGrid ));
+                return;
+            }
+        }
+    }
+
+    // Filling moved every start to the end of its cell, which is the start of the next one
+    for( uint32_t c = cellsCount; c > 0; --c )
+        grid->cellStarts[c] = grid->cellStarts[c - 1];
+    grid->cellStarts[0] = 0;
+}
+
+uint32_t level_register_mesh(const struct SM64Surface *surfaces, uint32_t numSurfaces)
+{
+    if( !s_level_loaded )
+    {
+        #ifdef DEBUG_LEVEL_ROOMS
+            printf("SM64: tried to register a mesh into non-loaded level.\n");
+        #endif
+        return UINT32_MAX;
+    }
+
+    uint32_t meshId = s_meshes_count;
+    s_meshes_count++;
+    s_meshes = realloc( s_meshes, s_meshes_count * sizeof( struct RegisteredMesh ));
+
+    struct RegisteredMesh *mesh = &s_meshes[meshId];
+    mesh->libSurfaces = malloc( numSurfaces * sizeof( struct SM64Surface ));
+    memcpy( mesh->libSurfaces, surfaces, numSurfaces * sizeof( struct SM64Surface ));
+    if( s_surface_cleanup_enabled )
+    {
+        numSurfaces = surface_cleanup( mesh->libSurfaces, numSurfaces, &s_surface_cleanup_options, NULL );
+    }
+    mesh->count = numSurfaces;
+    surfaces = mesh->libSurfaces;
+
+    for(int k=0; k<3; k++)
+    {
+        mesh->localMin[k] = 0;
+        mesh->localMax[k] = 0;
+    }
+    for(uint32_t i=0; i<numSurfaces; i++)
+    {
+        for(int v=0; v<3; v++)
+        {
+            for(int k=0; k<3; k++)
+            {
+                int32_t value = surfaces[i].vertices[v][k];
+                if((i==0 && v==0) || value < mesh->localMin[k]) mesh->localMin[k] = value;
+                if((i==0 && v==0) || value > mesh->localMax[k]) mesh->localMax[k] = value;
+            }
+        }
+    }
+
+    #ifdef DEBUG_LEVEL_ROOMS
+        printf("SM64: registered mesh %d with %d surfaces\n", meshId, numSurfaces);
+    #endif
+
+    return meshId;
+}
+
+void level_load_room_mesh_instances(uint32_t roomId, const struct SM64MeshInstance *instances, uint32_t instancesCount)
+{
+    if( s_level_rooms == NULL || roomId >= s_level_rooms_count || s_level_rooms[roomId] == NULL )
+    {
+        #ifdef DEBUG_LEVEL_ROOMS
+            printf("SM64: tried to add mesh instances to non-loaded room %d.\n", roomId);
+        #endif
+        return;
+    }
+
+    struct Room *room = s_level_rooms[roomId];
+    s_level_rooms_versions[roomId] = ++s_level_version;
+    room->instances = realloc( room->instances, (room->instancesCount + instancesCount) * sizeof( struct MeshInstance* ));
+
+    for(uint32_t i=0; i<instancesCount; i++)
+    {
+        if( instances[i].meshId >= s_meshes_count )
+        {
+            DEBUG_PRINT("Tried to instance non-existant mesh with ID: %u", instances[i].meshId);
+            continue;
+        }
+
+        struct MeshInstance *instance = malloc( sizeof( struct MeshInstance ));
+        mesh_instance_set_owner( instance, room, room->instancesCount );
+        room->instances[room->instancesCount++] = instance;
+        instance->meshId = instances[i].meshId;
+        instance->surfaces = NULL;
+        init_transform( &instance->transform, &instances[i].transform );
+        mesh_instance_compute_bounds( instance );
+    }
+
+    mesh_instances_grid_build( room );
+
+    // The new instances may be in reach of the last queries.
+    mesh_instances_queries_reset();
+}
+
+static bool mesh_instance_in_use( const struct MeshInstance *instance, const Vec3f *positions, uint32_t positionsCount, float margin, const struct Surface *const *pinned, uint32_t pinnedCount )
+{
+    for(uint32_t i=0; i<positionsCount; i++)
+    {
+        if( positions[i][0] + margin >= instance->worldMin[0] && positions[i][0] - margin <= instance->worldMax[0] &&
+            positions[i][2] + margin >= instance->worldMin[2] && positions[i][2] - margin <= instance->worldMax[2] )
+        {
+            return true;
+        }
+    }
+
+    const struct Surface *end = instance->surfaces + s_meshes[instance->meshId].count;
+    for(uint32_t i=0; i<pinnedCount; i++)
+    {
+        if( pinned[i] >= instance->surfaces && pinned[i] < end )
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void level_release_mesh_instances_surfaces(const Vec3f *positions, uint32_t positionsCount, float margin, const struct Surface *const *pinned, uint32_t pinnedCount)
+{
+    if( s_level_rooms == NULL || s_meshes == NULL )
+    {
+        return;
+    }
+
+    bool released = false;
+    for(uint32_t i=0; i<s_level_rooms_count; i++)
+    {
+        struct Room *room = s_level_rooms[i];
+        if( room == NULL )
+        {
+            continue;
+        }
+
+        for(uint32_t j=0; j<room->instancesCount; j++)
+        {
+            struct MeshInstance *instance = room->instances[j];
+            if( instance->surfaces == NULL || mesh_instance_in_use( instance, positions, positionsCount, margin, pinned, pinnedCount ))
+            {
+                continue;
+            }
+
+            free( instance->surfaces );
+            instance->surfaces = NULL;
+            s_mesh_instances_built_surfaces -= s_meshes[instance->meshId].count;
+            released = true;
+        }
+    }
+
+    // The next query of each player gathers the instances again and rebuilds the ones it reaches.
+    if( released )
+    {
+        mesh_instances_queries_reset();
+    }
+}
+
+/**
+ * Frees the instances far from the last query of every player. A player's floor, wall and ceiling come from queries
+ * around it, so they stay. When most built surfaces are in use the next release waits for twice as many.
+ */
+static void mesh_instances_release_far()
+{
+    uint32_t playersCount = 0;
+    for(uint32_t i=0; i<s_mario_loaded_rooms_capacity; i++)
+        playersCount += s_mario_loaded_rooms[i] != NULL;
+    for(struct MarioLoadedRooms *it=s_private_loaded_rooms; it!=NULL; it=it->nextPrivate)
+        playersCount++;
+
+    Vec3f *positions = malloc( sizeof( Vec3f ) * ( playersCount + 1 ));
+    if( positions == NULL )
+    {
+        return;
+    }
+
+    uint32_t count = 0;
+    for(uint32_t i=0; i<s_mario_loaded_rooms_capacity; i++)
+    {
+        struct MarioLoadedRooms *player = s_mario_loaded_rooms[i];
+        if( player != NULL && player->hasQueried )
+        {
+            positions[count][0] = player->lastQueryX;
+            positions[count][1] = 0.0f;
+            positions[count][2] = player->lastQueryZ;
+            count++;
+        }
+    }
+    for(struct MarioLoadedRooms *it=s_private_loaded_rooms; it!=NULL; it=it->nextPrivate)
+    {
+        if( it->hasQueried )
+        {
+            positions[count][0] = it->lastQueryX;
+            positions[count][1] = 0.0f;
+            positions[count][2] = it->lastQueryZ;
+            count++;
+        }
+    }
+
+    level_release_mesh_instances_surfaces( (const Vec3f *)positions, count, MESH_INSTANCE_KEEP_DISTANCE, NULL, 0 );
+    free( positions );
+
+    s_mesh_instances_release_at = s_mesh_instances_built_surfaces * 2 > MESH_INSTANCES_SURFACES_BUDGET ? s_mesh_instances_built_surfaces * 2 : MESH_INSTANCES_SURFACES_BUDGET;
+}
+
+void level_queries_parallel_begin(void)
+{
+    s_parallel_queries = true;
+}
+
+uint32_t level_get_mesh_instances_built_surfaces(void)
+{
+    return s_mesh_instances_built_surfaces;
+}
+
+void level_queries_parallel_end(void)
+{
+    s_parallel_queries = false;
+    if( s_mesh_instances_built_surfaces >= s_mesh_instances_release_at )
+    {
+        mesh_instances_release_far();
+    }
+}
+
+static void mesh_instances_query_add( struct MarioLoadedRooms *player, struct MeshInstance *instance )
+{
+    if( __atomic_load_n( &instance->surfaces, __ATOMIC_ACQUIRE ) == NULL )
+    {
+        mesh_instance_build_surfaces( instance );
+    }
+
+    uint32_t meshCount = s_meshes[instance->meshId].count;
+    if( player->instancesQueryCount + meshCount > player->instancesQueryCapacity )
+    {
+        while( player->instancesQueryCount + meshCount > player->instancesQueryCapacity )
+        {
+            player->instancesQueryCapacity = player->instancesQueryCapacity == 0 ? 64 : player->instancesQueryCapacity * 2;
+        }
+        player->instancesQuery = realloc( player->instancesQuery, player->instancesQueryCapacity * sizeof( struct Surface* ));
+    }
+
+    for(uint32_t k=0; k<meshCount; k++)
+    {
+        player->instancesQuery[player->instancesQueryCount++] = &instance->surfaces[k];
+    }
+}
+
+void level_update_mesh_instances_query(float x, float z, float margin)
+{
+    struct MarioLoadedRooms *player = s_current_loaded_rooms;
+    if( player == NULL )
+    {
+        return;
+    }
+
+    if( !s_parallel_queries && s_mesh_instances_built_surfaces >= s_mesh_instances_release_at )
+    {
+        mesh_instances_release_far();
+    }
+
+    player->lastQueryX = x;
+    player->lastQueryZ = z;
+    player->hasQueried = true;
+    player->instancesQueryCount = 0;
+    if( s_meshes == NULL )
+    {
+        return;
+    }
+
+    for(uint32_t i=0; i<s_current_loaded_rooms->count; i++)
+    {
+        struct Room *room = level_resolve_loaded_room(i);
+        if( room == NULL || room->instancesGrid.cellStarts == NULL )
+        {
+            continue;
+        }
+
+        const struct MeshInstanceGrid *grid = &room->instancesGrid;
+        int32_t qx0 = mesh_instances_grid_cell( grid->originX, grid->cellSize, grid->cellsX, x - margin );
+        int32_t qx1 = mesh_instances_grid_cell( grid->originX, grid->cellSize, grid->cellsX, x + margin );
+        int32_t qz0 = mesh_instances_grid_cell( grid->originZ, grid->cellSize, grid->cellsZ, z - margin );
+        int32_t qz1 = mesh_instances_grid_cell( grid->originZ, grid->cellSize, grid->cellsZ, z + margin );
+
+        for(int32_t cz=qz0; cz<=qz1; cz++)
+        {
+            for(int32_t cx=qx0; cx<=qx1; cx++)
+            {
+                uint32_t cell = (uint32_t)cz * grid->cellsX + (uint32_t)cx;
+                for(uint32_t j=grid->cellStarts[cell]; j<grid->cellStarts[cell + 1]; j++)
+                {
+                    struct MeshInstance *instance = room->instances[grid->cellInstances[j]];
+                    if( x + margin < instance->worldMin[0] || x - margin > instance->worldMax[0] ||
+                        z + margin < instance->worldMin[2] || z - margin > instance->worldMax[2] )
+                    {
+                        continue;
+                    }
+
+                    // An instance over several cells is only taken in the first cell it shares with the query
+                    int32_t ix0 = mesh_instances_grid_cell( grid->originX, grid->cellSize, grid->cellsX, (float)instance->worldMin[0] );
+                    int32_t iz0 = mesh_instances_grid_cell( grid->originZ, grid->cellSize, grid->cellsZ, (float)instance->worldMin[2] );
+                    if( cx != ( ix0 > qx0 ? ix0 : qx0 ) || cz != ( iz0 > qz0 ? iz0 : qz0 ))
+                    {
+                        continue;
+                    }
+
+                    mesh_instances_query_add( player, instance );
+                }
+            }
+        }
+    }
+}
+
+void level_unload_all_meshes()
+{
+    if( s_meshes != NULL )
+    {
+        for(uint32_t i=0; i<s_meshes_count; i++)
+        {
+            free( s_meshes[i].libSurfaces );
+        }
+        free( s_meshes );
+        s_meshes = NULL;
+        s_meshes_count = 0;
+    }
+
+    mesh_instances_queries_reset();
+}
+
+#pragma endregion
+
+#pragma region Player Loaded Rooms
+
+void level_init_player_loaded_rooms()
+{
+    for(uint32_t i=0; i<s_mario_loaded_rooms_capacity; i++)
+    {
+        s_mario_loaded_rooms[i]=NULL;
+    }
+}
+
+static void player_loaded_rooms_clear(struct MarioLoadedRooms *loadedRooms)
+{
+    loadedRooms->marioId=-1;
+    loadedRooms->count=0;
+    loadedRooms->clippersCount=0;
+    loadedRooms->roomIds=NULL;
+    free(loadedRooms->instancesQuery);
+    loadedRooms->instancesQuery=NULL;
+    loadedRooms->instancesQueryCount=0;
+    loadedRooms->instancesQueryCapacity=0;
+    loadedRooms->hasQueried=false;
+}
+
+struct MarioLoadedRooms *level_find_player_loaded_rooms(int marioId)
+{
+    for(uint32_t i=0; i<s_mario_loaded_rooms_capacity; i++)
+    {
+        if(s_mario_loaded_rooms[i]!=NULL && s_mario_loaded_rooms[i]->marioId == marioId)
+        {
+            return s_mario_loaded_rooms[i];
+        }
+    }
+    for(struct MarioLoadedRooms *it=s_private_loaded_rooms; it!=NULL; it=it->nextPrivate)
+    {
+        if(it->marioId == marioId)
+        {
+            return it;
+        }
+    }
+    return NULL;
+}
+
+bool level_load_player_loaded_rooms(int marioId, struct MarioLoadedRooms *loadedRooms, uint32_t *roomIds)
+{
+    uint32_t slot = 0;
+    while(slot<s_mario_loaded_rooms_capacity && s_mario_loaded_rooms[slot]!=NULL)
+    {
+        slot++;
+    }
+
+    if(slot == s_mario_loaded_rooms_capacity)
+    {
+        uint32_t capacity = s_mario_loaded_rooms_capacity == 0 ? MARIO_PLAYERS_INITIAL_CAPACITY : s_mario_loaded_rooms_capacity * 2;
+        struct MarioLoadedRooms **grown = realloc(s_mario_loaded_rooms, sizeof(struct MarioLoadedRooms*) * capacity);
+        if(grown == NULL)
+        {
+            DEBUG_PRINT("No memory left for the loaded rooms of Mario %d", marioId);
+            return false;
+        }
+        for(uint32_t i=s_mario_loaded_rooms_capacity; i<capacity; i++)
+        {
+            grown[i] = NULL;
+        }
+        s_mario_loaded_rooms = grown;
+        s_mario_loaded_rooms_capacity = capacity;
+    }
+
+    s_mario_loaded_rooms[slot] = loadedRooms;
+    loadedRooms->marioId = marioId;
+    loadedRooms->count=0;
+    loadedRooms->roomIds=roomIds;
+    s_current_loaded_rooms = loadedRooms;
+    loadedRooms->clippersCount=0;
+    loadedRooms->instancesQuery=NULL;
+    loadedRooms->instancesQueryCount=0;
+    loadedRooms->instancesQueryCapacity=0;
+    loadedRooms->hasQueried=false;
+    loadedRooms->nextPrivate=NULL;
+
+    level_load_big_floor_hack(&(loadedRooms->playerSurfaces[0]));
+    level_load_big_floor_hack(&(loadedRooms->playerSurfaces[1]));
+    level_update_big_floor_hack(0.0f, 0.0f, 0.0f);
+
+    return true;
+}
+
+void level_unload_player_loaded_rooms(int marioId)
+{
+    for(uint32_t i=0; i<s_mario_loaded_rooms_capacity; i++)
+    {
+        if(s_mario_loaded_rooms[i]!=NULL && s_mario_loaded_rooms[i]->marioId == marioId)
+        {
+            player_loaded_rooms_clear(s_mario_loaded_rooms[i]);
+            s_mario_loaded_rooms[i] = NULL;
+            s_current_loaded_rooms = NULL;
+        }
+    }
+}
+
+void level_copy_player_loaded_rooms(int marioId, struct MarioLoadedRooms *dst, const struct MarioLoadedRooms *src, uint32_t *roomIds)
+{
+    memcpy(dst->playerSurfaces, src->playerSurfaces, sizeof(src->playerSurfaces));
+    memcpy(roomIds, src->roomIds, sizeof(uint32_t) * src->count);
+    dst->marioId = marioId;
+    dst->roomIds = roomIds;
+    dst->count = src->count;
+    dst->clippersCount = src->clippersCount;
+    dst->instancesQuery = NULL;
+    dst->instancesQueryCount = 0;
+    dst->instancesQueryCapacity = 0;
+    dst->lastQueryX = src->lastQueryX;
+    dst->lastQueryZ = src->lastQueryZ;
+    dst->hasQueried = src->hasQueried;
+    dst->nextPrivate = s_private_loaded_rooms;
+    s_private_loaded_rooms = dst;
+}
+
+void level_bind_loaded_rooms(struct MarioLoadedRooms *loadedRooms)
+{
+    s_current_loaded_rooms = loadedRooms;
+}
+
+void level_release_loaded_rooms(struct MarioLoadedRooms *loadedRooms)
+{
+    if(s_current_loaded_rooms == loadedRooms)
+    {
+        s_current_loaded_rooms = NULL;
+    }
+    for(struct MarioLoadedRooms **it=&s_private_loaded_rooms; *it!=NULL; it=&(*it)->nextPrivate)
+    {
+        if(*it == loadedRooms)
+        {
+            *it = loadedRooms->nextPrivate;
+            break;
+        }
+    }
+    loadedRooms->nextPrivate = NULL;
+    player_loaded_rooms_clear(loadedRooms);
+}
+
+void level_unload_all_player_loaded_rooms()
+{
+    s_current_loaded_rooms = NULL;
+    for(uint32_t i=0; i<s_mario_loaded_rooms_capacity; i++)
+    {
+        if(s_mario_loaded_rooms[i]!=NULL)
+        {
+            player_loaded_rooms_clear(s_mario_loaded_rooms[i]);
+            s_mario_loaded_rooms[i] = NULL;
+        }
+    }
+    free(s_mario_loaded_rooms);
+    s_mario_loaded_rooms = NULL;
+    s_mario_loaded_rooms_capacity = 0;
+}
+
+void level_update_player_loaded_Rooms_with_clippers(int marioId, int *newloadedRooms, int loadedCount, const struct SM64Surface clippers[MAX_CLIPPER_BLOCKS_FACES], uint32_t clippersCount)
+{
+    struct MarioLoadedRooms *loadedRooms = level_find_player_loaded_rooms(marioId);
+    if(loadedRooms == NULL || loadedRooms->roomIds == NULL || loadedCount==0)
+    {
+        return;
+    }
+    loadedRooms->count=0;
+    for(uint32_t i=0; i<loadedCount && loadedRooms->count<s_level_rooms_count; i++)
+    {
+        if(newloadedRooms[i] < 0 || newloadedRooms[i] >= s_level_rooms_count)
+        {
+            continue;
+        }
+        loadedRooms->roomIds[loadedRooms->count++]=newloadedRooms[i];
+    }
+    
+    s_level_layout_version++;
+    loadedRooms->clippersCount=clippersCount;
+    for( uint32_t i = 0; i < clippersCount; ++i )
+    {
+        engine_surface_from_lib_surface( &(loadedRooms->playerSurfaces[BIG_FLOOR_HACK_SURFACES_COUNT + i]), &clippers[i], NULL, EXTERNAL_SURFACE_TYPE_WALL_CLIPPER );
+    }
+}
+
+void level_update_player_loaded_Rooms(int marioId, int *newloadedRooms, int loadedCount)
+{
+    level_update_player_loaded_Rooms_with_clippers(marioId, newloadedRooms, loadedCount, NULL, 0);
+}
+
+void level_set_active_mario(int marioId)
+{
+    if(s_current_loaded_rooms!=NULL && s_current_loaded_rooms->marioId==marioId)
+    {
+        return;
+    }
+    struct MarioLoadedRooms *loadedRooms = level_find_player_loaded_rooms(marioId);
+    if(loadedRooms!=NULL)
+    {
+        s_current_loaded_rooms = loadedRooms;
+    }
+    #ifdef DEBUG_LEVEL_ROOMS
+    else
+    {
+        printf("SM64: Mario %d has no loaded rooms.\n", marioId);
+    }
+    #endif
+}
+
+#pragma endregion
+
+
+#pragma region Level management
+
+bool level_init(uint32_t roomsCount)
+{
+    #ifdef DEBUG_LEVEL_ROOMS
+        printf("SM64: init level\n");
+    #endif
+    if(s_level_loaded)
+    {
+        printf("SM64: Aborted trying to load a level already loaded.");
+        return false;
+    }
+
+    s_level_version = 1;
+    s_level_layout_version++;
+    level_init_rooms(roomsCount);
+    level_init_player_loaded_rooms();
+    level_init_dynamic_objects();
+
+    s_level_loaded = true;
+
+    return true;
+}
+
+void level_unload()
+{
+    #ifdef DEBUG_LEVEL_ROOMS
+        printf("SM64: unload level\n");
+    #endif
+
+    s_level_loaded=false;
+
+    level_unload_all_rooms();
+    level_unload_all_player_loaded_rooms();
+    level_unload_all_dynamic_objects();
+    level_unload_all_meshes();
+    shared_memory_close( &s_shared_rooms );
+
+    s_mesh_instances_built_surfaces = 0;
+    s_mesh_instances_release_at = MESH_INSTANCES_SURFACES_BUDGET;
+}
+
+#pragma endregion
+
+#pragma region Counts and Surfaces getters
+
+uint32_t level_get_room_count(void)
+{
+    // Nothing to query until a Mario with loaded rooms is bound.
+    if(s_current_loaded_rooms == NULL)
+    {
+        return 0;
+    }
+    return s_current_loaded_rooms->count+3;
+}
+
+uint32_t level_get_room_slots_count(void)
+{
+    return s_level_rooms_count;
+}
+
+uint32_t level_get_room_surfaces_count(uint32_t roomIndex)
+{
+    if(roomIndex == s_current_loaded_rooms->count)
+    {
+        if(s_dynamic_objects){
+            return s_dynamic_objects->cached_count;
+        }
+        return 0; //dynamic objects still weren't loaded
+    }
+    if(roomIndex == s_current_loaded_rooms->count+1)
+    {
+        return BIG_FLOOR_HACK_SURFACES_COUNT + s_current_loaded_rooms->clippersCount;
+    }
+    if(roomIndex > s_current_loaded_rooms->count+1)
+    {
+        return s_current_loaded_rooms->instancesQueryCount;
+    }
+
+    struct Room *room = level_resolve_loaded_room(roomIndex);
+    return room != NULL ? room->count : 0;
+}
+
+struct Surface *level_get_room_surface(uint32_t roomIndex, uint32_t surfaceIndex)
+{
+    if(roomIndex == s_current_loaded_rooms->count){
+        return s_dynamic_objects->cached_surfaces[surfaceIndex];
+    }
+    if(roomIndex == s_current_loaded_rooms->count+1){
+        return &(s_current_loaded_rooms->playerSurfaces[surfaceIndex]);
+    }
+    if(roomIndex > s_current_loaded_rooms->count+1){
+        return s_current_loaded_rooms->instancesQuery[surfaceIndex];
+    }
+
+    return &(level_resolve_loaded_room(roomIndex)->surfaces[surfaceIndex]);
+}
+
+void level_get_room_surface_span(uint32_t roomIndex, struct SurfaceSpan *span)
+{
+    span->surfaces = NULL;
+    span->indirect = NULL;
+    span->count = level_get_room_surfaces_count(roomIndex);
+
+    if(roomIndex == s_current_loaded_rooms->count)
+    {
+        span->indirect = s_dynamic_objects ? s_dynamic_objects->cached_surfaces : NULL;
+    }
+    else if(roomIndex == s_current_loaded_rooms->count+1)
+    {
+        span->surfaces = s_current_loaded_rooms->playerSurfaces;
+    }
+    else if(roomIndex > s_current_loaded_rooms->count+1)
+    {
+        span->indirect = s_current_loaded_rooms->instancesQuery;
+    }
+    else
+    {
+        struct Room *room = level_resolve_loaded_room(roomIndex);
+        span->surfaces = room != NULL ? room->surfaces : NULL;
+    }
+}
+
+void level_surface_iterator_begin(struct LevelSurfaceIterator *it)
+{
+    it->roomIndex = 0;
+    it->surfaceIndex = 0;
+    level_get_room_surface_span(0, &it->span);
+}
+
+struct Surface *level_surface_iterator_next(struct LevelSurfaceIterator *it)
+{
+    uint32_t roomCount = level_get_room_count();
+
+    while(it->surfaceIndex >= it->span.count)
+    {
+        if(++it->roomIndex >= roomCount)
+        {
+            it->roomIndex = roomCount;
+            it->surfaceIndex = 0;
+            it->span.count = 0;
+            return NULL;
+        }
+        it->surfaceIndex = 0;
+        level_get_room_surface_span(it->roomIndex, &it->span);
+    }
+
+    return surface_span_get(&it->span, it->surfaceIndex++);
+}
+
+#pragma endregion
+
+
+#pragma region Versioned export
+
+void level_copy_debug_surface(struct SM64DebugSurface *dst, const struct Surface *src)
+{
+    if( src && src->isValid ) {
+        vec3i2f_copy(dst->v1, (s32*)src->vertex1);
+        vec3i2f_copy(dst->v2, (s32*)src->vertex2);
+        vec3i2f_copy(dst->v3, (s32*)src->vertex3);
+        dst->color = src->eSurfaceType;
+        dst->valid = true;
+    }
+    else
+    {
+        vec3f_reset(dst->v1, 0);
+        vec3f_reset(dst->v2, 0);
+        vec3f_reset(dst->v3, 0);
+        dst->color = 0;
+        dst->valid = false;
+    }
+}
+
+static uint32_t room_total_surfaces_count(struct Room *room)
+{
+    uint32_t count = room->count;
+    for(uint32_t i=0; i<room->instancesCount; i++)
+    {
+        count += s_meshes[room->instances[i]->meshId].count;
+    }
+    return count;
+}
+
+void level_get_layout_stamp(float x, float z, struct LevelLayoutStamp *outStamp)
+{
+    outStamp->level = s_level_layout_version;
+
+    // Room versions all come from s_level_version, any change of a room makes it the newest.
+    outStamp->rooms = 0;
+    for( uint32_t i = 0; s_current_loaded_rooms != NULL && s_level_rooms_versions != NULL && i < s_current_loaded_rooms->count; ++i )
+    {
+        uint32_t version = s_level_rooms_versions[s_current_loaded_rooms->roomIds[i]];
+        if( version > outStamp->rooms )
+            outStamp->rooms = version;
+    }
+
+    int32_t range[4];
+    if( !layout_cells_range( x - LAYOUT_NEAR_MARGIN, x + LAYOUT_NEAR_MARGIN, z - LAYOUT_NEAR_MARGIN, z + LAYOUT_NEAR_MARGIN, range ))
+    {
+        outStamp->objects = s_layout_cells_version;
+        return;
+    }
+
+    outStamp->objects = 0;
+    for( int32_t cx = range[0]; cx <= range[1]; ++cx )
+    {
+        for( int32_t cz = range[2]; cz <= range[3]; ++cz )
+        {
+            uint32_t version = s_layout_cells[layout_cell_index( cx, cz )];
+            if( version > outStamp->objects )
+                outStamp->objects = version;
+        }
+    }
+}
+
+uint32_t level_get_version(void)
+{
+    return s_level_version;
+}
+
+uint32_t level_get_changed_rooms(uint32_t sinceVersion, struct SM64DebugRoomDelta *outRooms, uint32_t maxRooms)
+{
+    uint32_t changed = 0;
+    if( s_level_rooms_versions == NULL )
+    {
+        return 0;
+    }
+
+    for(uint32_t i=0; i<s_level_rooms_count; i++)
+    {
+        if( s_level_rooms_versions[i] <= sinceVersion )
+        {
+            continue;
+        }
+
+        if( outRooms != NULL && changed < maxRooms )
+        {
+            struct SM64DebugRoomDelta *delta = &outRooms[changed];
+            delta->roomId = i;
+            delta->version = s_level_rooms_versions[i];
+            delta->loaded = s_level_rooms[i] != NULL;
+            delta->surfacesCount = delta->loaded ? room_total_surfaces_count(s_level_rooms[i]) : 0;
+        }
+        changed++;
+    }
+
+    return changed;
+}
+
+uint32_t level_export_room_surfaces(uint32_t roomId, struct SM64DebugSurface *outSurfaces)
+{
+    if( s_level_rooms == NULL || roomId >= s_level_rooms_count || s_level_rooms[roomId] == NULL )
+    {
+        return 0;
+    }
+
+    struct Room *room = s_level_rooms[roomId];
+    uint32_t idx = 0;
+    for(uint32_t i=0; i<room->count; i++)
+    {
+        level_copy_debug_surface(&outSurfaces[idx++], &room->surfaces[i]);
+    }
+
+    for(uint32_t i=0; i<room->instancesCount; i++)
+    {
+        struct MeshInstance *instance = room->instances[i];
+        struct RegisteredMesh *mesh = &s_meshes[instance->meshId];
+        for(uint32_t j=0; j<mesh->count; j++)
+        {
+            // Don't build the instance surfaces only for the debug view
+            struct Surface surface;
+            if( instance->surfaces != NULL )
+            {
+                level_copy_debug_surface(&outSurfaces[idx++], &instance->surfaces[j]);
+                continue;
+            }
+            engine_surface_from_lib_surface( &surface, &mesh->libSurfaces[j], &instance->transform, EXTERNAL_SURFACE_TYPE_STATIC_MESH );
+            level_copy_debug_surface(&outSurfaces[idx++], &surface);
+        }
+    }
+
+    return idx;
+}
+
+uint32_t level_get_changed_dynamic_objects(uint32_t sinceVersion, struct SM64DebugObjectDelta *outObjects, uint32_t maxObjects)
+{
+    uint32_t changed = 0;
+    if( s_dynamic_objects == NULL )
+    {
+        return 0;
+    }
+
+    for(uint32_t i=0; i<s_dynamic_objects->objectsCount; i++)
+    {
+        struct LoadedSurfaceObject *obj = &s_dynamic_objects->objects[i];
+        if( obj->version <= sinceVersion )
+        {
+            continue;
+        }
+
+        if( outObjects != NULL && changed < maxObjects )
+        {
+            struct SM64DebugObjectDelta *delta = &outObjects[changed];
+            delta->objectId = obj->id;
+            delta->version = obj->version;
+            delta->loaded = obj->loaded;
+            delta->geometryChanged = delta->loaded && obj->geometryVersion > sinceVersion;
+            delta->transform = obj->libTransform;
+            delta->surfacesCount = obj->surfaceCount;
+        }
+        changed++;
+    }
+
+    return changed;
+}
+
+uint32_t level_export_dynamic_object_surfaces(uint32_t objId, struct SM64DebugSurface *outSurfaces)
+{
+    struct LoadedSurfaceObject *obj = dynamic_object_from_id( objId );
+    if( obj == NULL )
+    {
+        return 0;
+    }
+
+    for(uint32_t i=0; i<obj->surfaceCount; i++)
+    {
+        struct Surface surface;
+        engine_surface_from_lib_surface( &surface, &obj->libSurfaces[i], NULL, EXTERNAL_SURFACE_TYPE_DYNAMIC_OBJECT );
+        level_copy_debug_surface(&outSurfaces[i], &surface);
+    }
+
+    return obj->surfaceCount;
+}
+
+#pragma endregion
+
+#pragma region Snapshots
+
+#define SNAPSHOT_MAGIC 0x4C344D53 // "SM4L"
+#define SNAPSHOT_VERSION 2
+
+/**
+ * Snapshots are a flat sequence of fixed-size records, the structs are written as they are in memory
+ * and pointers are replaced by indexes, so loading them is mostly memcpy. The sizes of the structs are
+ * stored in the header and a snapshot is only accepted by a build with the same layout.
+ */
+struct SnapshotHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t surfaceSize;
+    uint32_t transformSize;
+    uint32_t libSurfaceSize;
+    uint32_t instanceSize;
+    uint32_t roomsCount;
+    uint32_t meshesCount;
+    uint32_t objectsCount;
+};
+
+struct SnapshotReader
+{
+    const uint8_t *data;
+    size_t size;
+    size_t offset;
+};
+
+static bool snapshot_write( FILE *file, const void *data, size_t size )
+{
+    return size == 0 || fwrite( data, size, 1, file ) == 1;
+}
+
+static const void *snapshot_read( struct SnapshotReader *reader, size_t size )
+{
+    if( size > reader->size - reader->offset )
+    {
+        return NULL;
+    }
+
+    const void *result = reader->data + reader->offset;
+    reader->offset += size;
+    return result;
+}
+
+static bool snapshot_read_u32( struct SnapshotReader *reader, uint32_t *value )
+{
+    const void *data = snapshot_read( reader, sizeof( uint32_t ));
+    if( data == NULL )
+        return false;
+    memcpy( value, data, sizeof( uint32_t ));
+    return true;
+}
+
+/**
+ * Writes the surfaces with their transform pointer replaced by 1 + the index of the transform, 0 if they have none.
+ */
+static bool snapshot_write_surfaces( FILE *file, const struct Surface *surfaces, uint32_t count, struct SurfaceObjectTransform **transforms, uint32_t transformsCount )
+{
+    for( uint32_t i = 0; i < count; ++i )
+    {
+        struct Surface surface = surfaces[i];
+        uintptr_t transformIdx = 0;
+        for( uint32_t j = 0; j < transformsCount && surface.transform != NULL; ++j )
+        {
+            if( transforms[j] == surface.transform )
+            {
+                transformIdx = j + 1;
+                break;
+            }
+        }
+        surface.transform = (struct SurfaceObjectTransform *)transformIdx;
+
+        if( !snapshot_write( file, &surface, sizeof( struct Surface )))
+            return false;
+    }
+    return true;
+}
+
+static bool snapshot_read_surfaces( struct SnapshotReader *reader, struct Surface *surfaces, uint32_t count, struct SurfaceObjectTransform **transforms, uint32_t transformsCount )
+{
+    const void *data = snapshot_read( reader, sizeof( struct Surface ) * count );
+    if( data == NULL )
+        return false;
+
+    memcpy( surfaces, data, sizeof( struct Surface ) * count );
+    for( uint32_t i = 0; i < count; ++i )
+    {
+        uintptr_t transformIdx = (uintptr_t)surfaces[i].transform;
+        if( transformIdx > transformsCount )
+            return false;
+        surfaces[i].transform = transformIdx == 0 ? NULL : transforms[transformIdx - 1];
+    }
+    return true;
+}
+
+static bool snapshot_write_room( FILE *file, struct Room *room )
+{
+    // The static objects transforms are only referenced by the surfaces, consecutive ones share it.
+    uint32_t transformsCount = 0;
+    struct SurfaceObjectTransform **transforms = malloc( sizeof( struct SurfaceObjectTransform* ) * (room->count + 1) );
+    for( uint32_t i = 0; i < room->count; ++i )
+    {
+        struct SurfaceObjectTransform *transform = room->surfaces[i].transform;
+        if( transform != NULL && (transformsCount == 0 || transforms[transformsCount - 1] != transform) )
+        {
+            transforms[transformsCount++] = transform;
+        }
+    }
+
+    bool ok = snapshot_write( file, &room->count, sizeof( uint32_t ))
+        && snapshot_write( file, &transformsCount, sizeof( uint32_t ))
+        && snapshot_write( file, &room->instancesCount, sizeof( uint32_t ))
+        && snapshot_write( file, &room->cleanupStats, sizeof( struct SM64SurfaceCleanupStats ));
+
+    for( uint32_t i = 0; ok && i < transformsCount; ++i )
+    {
+        ok = snapshot_write( file, transforms[i], sizeof( struct SurfaceObjectTransform ));
+    }
+
+    ok = ok && snapshot_write_surfaces( file, room->surfaces, room->count, transforms, transformsCount );
+
+    for( uint32_t i = 0; ok && i < room->instancesCount; ++i )
+    {
+        struct MeshInstance instance = *room->instances[i];
+        instance.surfaces = NULL;
+        ok = snapshot_write( file, &instance, sizeof( struct MeshInstance ));
+    }
+
+    free( transforms );
+    return ok;
+}
+
+static bool snapshot_read_room( struct SnapshotReader *reader, uint32_t roomId )
+{
+    uint32_t count, transformsCount, instancesCount;
+    const void *stats;
+    if( !snapshot_read_u32( reader, &count ) || !snapshot_read_u32( reader, &transformsCount ) || !snapshot_read_u32( reader, &instancesCount ) ||
+        transformsCount > count || (stats = snapshot_read( reader, sizeof( struct SM64SurfaceCleanupStats ))) == NULL )
+    {
+        return false;
+    }
+
+    struct Room *room = (struct Room*)malloc(sizeof(struct Room));
+    memcpy( &room->cleanupStats, stats, sizeof( struct SM64SurfaceCleanupStats ));
+    room->count = 0;
+    room->surfaces = malloc( sizeof( struct Surface ) * count );
+    room->sharedSurfaces = false;
+    room->instancesCount = 0;
+    room->instances = NULL;
+    memset( &room->instancesGrid, 0, sizeof( struct MeshInstanceGrid ));
+    room->slot = roomId;
+    s_level_rooms[roomId] = room;
+    s_level_rooms_versions[roomId] = ++s_level_version;
+
+    struct SurfaceObjectTransform **transforms = malloc( sizeof( struct SurfaceObjectTransform* ) * (transformsCount + 1) );
+    bool ok = true;
+    for( uint32_t i = 0; i < transformsCount; ++i )
+    {
+        const void *data = snapshot_read( reader, sizeof( struct SurfaceObjectTransform ));
+        transforms[i] = malloc( sizeof( struct SurfaceObjectTransform ));
+        if( data == NULL )
+        {
+            // Zeroed so the transforms after this one still get freed with the room
+            memset( transforms[i], 0, sizeof( struct SurfaceObjectTransform ));
+            ok = false;
+            continue;
+        }
+        memcpy( transforms[i], data, sizeof( struct SurfaceObjectTransform ));
+    }
+
+    if( ok && snapshot_read_surfaces( reader, room->surfaces, count, transforms, transformsCount ) )
+    {
+        room->count = count;
+        room_set_owners( room );
+    }
+    else
+    {
+        for( uint32_t i = 0; i < transformsCount; ++i )
+            free( transforms[i] );
+        ok = false;
+    }
+    free( transforms );
+
+    if( ok && instancesCount > 0 )
+    {
+        const void *data = snapshot_read( reader, sizeof( struct MeshInstance ) * instancesCount );
+        if( data == NULL )
+            return false;
+
+        room->instances = malloc( sizeof( struct MeshInstance* ) * instancesCount );
+        for( uint32_t i = 0; i < instancesCount; ++i )
+        {
+            struct MeshInstance *instance = malloc( sizeof( struct MeshInstance ));
+            memcpy( instance, (const uint8_t*)data + sizeof( struct MeshInstance ) * i, sizeof( struct MeshInstance ));
+            instance->surfaces = NULL;
+            mesh_instance_set_owner( instance, room, room->instancesCount );
+            room->instances[room->instancesCount++] = instance;
+            if( instance->meshId >= s_meshes_count )
+            {
+                return false;
+            }
+        }
+        mesh_instances_grid_build( room );
+    }
+
+    return ok;
+}
+
+static bool snapshot_write_dynamic_object( FILE *file, struct LoadedSurfaceObject *obj )
+{
+    uint32_t loaded = obj->loaded;
+    bool ok = snapshot_write( file, &loaded, sizeof( uint32_t ))
+        && snapshot_write( file, &obj->generation, sizeof( uint32_t ));
+
+    if( ok && obj->loaded )
+    {
+        ok = snapshot_write( file, &obj->surfaceCount, sizeof( uint32_t ))
+            && snapshot_write( file, &obj->libTransform, sizeof( struct SM64ObjectTransform ))
+            && snapshot_write( file, obj->transform, sizeof( struct SurfaceObjectTransform ))
+            && snapshot_write( file, obj->libSurfaces, sizeof( struct SM64Surface ) * obj->surfaceCount )
+            && snapshot_write_surfaces( file, obj->engineSurfaces, obj->surfaceCount, &obj->transform, 1 );
+    }
+    return ok;
+}
+
+static bool snapshot_read_dynamic_object( struct SnapshotReader *reader, uint32_t idx )
+{
+    struct LoadedSurfaceObject *obj = &s_dynamic_objects->objects[idx];
+    uint32_t loaded;
+
+    if( !snapshot_read_u32( reader, &loaded ) || !snapshot_read_u32( reader, &obj->generation ))
+        return false;
+
+    obj->id = (obj->generation << DYNAMIC_OBJECT_INDEX_BITS) | idx;
+    obj->version = ++s_level_version;
+    obj->geometryVersion = obj->version;
+
+    if( !loaded )
+    {
+        return true;
+    }
+
+    uint32_t count;
+    const void *libTransform, *transform, *libSurfaces;
+    if( !snapshot_read_u32( reader, &count ) ||
+        (libTransform = snapshot_read( reader, sizeof( struct SM64ObjectTransform ))) == NULL ||
+        (transform = snapshot_read( reader, sizeof( struct SurfaceObjectTransform ))) == NULL ||
+        (libSurfaces = snapshot_read( reader, sizeof( struct SM64Surface ) * count )) == NULL )
+    {
+        return false;
+    }
+
+    obj->loaded = true;
+    obj->nextFree = DYNAMIC_OBJECT_NO_SLOT;
+    memcpy( &obj->libTransform, libTransform, sizeof( struct SM64ObjectTransform ));
+    obj->transform = malloc( sizeof( struct SurfaceObjectTransform ));
+    memcpy( obj->transform, transform, sizeof( struct SurfaceObjectTransform ));
+    obj->libSurfaces = malloc( sizeof( struct SM64Surface ) * count );
+    memcpy( obj->libSurfaces, libSurfaces, sizeof( struct SM64Surface ) * count );
+    obj->engineSurfaces = malloc( sizeof( struct Surface ) * count );
+    obj->cacheSlots = malloc( sizeof( uint32_t ) * count );
+    obj->surfaceCount = count;
+    dynamic_object_compute_radius( obj );
+
+    if( !snapshot_read_surfaces( reader, obj->engineSurfaces, count, &obj->transform, 1 ))
+    {
+        return false;
+    }
+
+    for( uint32_t i = 0; i < count; ++i )
+    {
+        obj->cacheSlots[i] = cached_surface_push( &obj->engineSurfaces[i], idx, i );
+    }
+    dynamic_object_set_owners( obj );
+    return true;
+}
 
-bool level_init(uint32_t roomsCount)
+bool level_save_snapshot(const char *path)
 {
+    if( !s_level_loaded )
+    {
+        DEBUG_PRINT("Tried to save a snapshot of a non-loaded level");
+        return false;
+    }
+
+    FILE *file = fopen( path, "wb" );
+    if( file == NULL )
+    {
+        DEBUG_PRINT("Could not open snapshot file %s for writing", path);
+        return false;
+    }
+
+    struct SnapshotHeader header;
+    header.magic = SNAPSHOT_MAGIC;
+    header.version = SNAPSHOT_VERSION;
+    header.surfaceSize = sizeof( struct Surface );
+    header.transformSize = sizeof( struct SurfaceObjectTransform );
+    header.libSurfaceSize = sizeof( struct SM64Surface );
+    header.instanceSize = sizeof( struct MeshInstance );
+    header.roomsCount = s_level_rooms_count;
+    header.meshesCount = s_meshes_count;
+    header.objectsCount = s_dynamic_objects->objectsCount;
+
+    bool ok = snapshot_write( file, &header, sizeof( header ));
+
+    for( uint32_t i = 0; ok && i < s_meshes_count; ++i )
+    {
+        ok = snapshot_write( file, &s_meshes[i].count, sizeof( uint32_t ))
+            && snapshot_write( file, s_meshes[i].localMin, sizeof( s_meshes[i].localMin ))
+            && snapshot_write( file, s_meshes[i].localMax, sizeof( s_meshes[i].localMax ))
+            && snapshot_write( file, s_meshes[i].libSurfaces, sizeof( struct SM64Surface ) * s_meshes[i].count );
+    }
+
+    for( uint32_t i = 0; ok && i < s_level_rooms_count; ++i )
+    {
+        uint32_t loaded = s_level_rooms[i] != NULL;
+        ok = snapshot_write( file, &loaded, sizeof( uint32_t ))
+            && (!loaded || snapshot_write_room( file, s_level_rooms[i] ));
+    }
+
+    for( uint32_t i = 0; ok && i < s_dynamic_objects->objectsCount; ++i )
+    {
+        ok = snapshot_write_dynamic_object( file, &s_dynamic_objects->objects[i] );
+    }
+
+    ok = fclose( file ) == 0 && ok;
+    if( !ok )
+    {
+        DEBUG_PRINT("Failed writing snapshot file %s", path);
+        return false;
+    }
+
     #ifdef DEBUG_LEVEL_ROOMS
-        printf("SM64: init level\n");
+        printf("SM64: saved level snapshot %s\n", path);
     #endif
-    if(s_level_loaded)
+
+    return true;
+}
+
+static bool level_read_snapshot(struct SnapshotReader *reader)
+{
+    const struct SnapshotHeader *header = snapshot_read( reader, sizeof( struct SnapshotHeader ));
+    if( header == NULL || header->magic != SNAPSHOT_MAGIC || header->version != SNAPSHOT_VERSION ||
+        header->surfaceSize != sizeof( struct Surface ) || header->transformSize != sizeof( struct SurfaceObjectTransform ) ||
+        header->libSurfaceSize != sizeof( struct SM64Surface ) || header->instanceSize != sizeof( struct MeshInstance ) ||
+        header->objectsCount > DYNAMIC_OBJECT_INDEX_MASK + 1 )
     {
-        printf("SM64: Aborted trying to load a level already loaded.");
+        DEBUG_PRINT("Snapshot was not written by this build of libsm64");
         return false;
     }
 
-    level_init_rooms(roomsCount);
-    level_init_player_loaded_rooms();
-    level_init_dynamic_objects();
-    level_init_big_floor_hack();
-    level_update_cached_object_surface_list();
+    uint32_t meshesCount = header->meshesCount;
+    uint32_t objectsCount = header->objectsCount;
 
-    s_level_loaded = true;
+    // Every room, mesh and object takes at least its fixed-size fields, so counts the rest of the file can't hold are
+    // rejected before anything is allocated from them.
+    uint64_t minimumSize = (uint64_t)header->roomsCount * sizeof( uint32_t )
+        + (uint64_t)meshesCount * ( sizeof( uint32_t ) + sizeof( int32_t ) * 6 )
+        + (uint64_t)objectsCount * sizeof( uint32_t ) * 2;
+    if( minimumSize > reader->size - reader->offset )
+    {
+        DEBUG_PRINT("Snapshot counts don't fit in the file");
+        return false;
+    }
+
+    if( s_level_loaded )
+    {
+        level_unload();
+    }
+    if( !level_init( header->roomsCount ))
+    {
+        return false;
+    }
+
+    for( uint32_t i = 0; i < meshesCount; ++i )
+    {
+        uint32_t count;
+        const void *localMin, *localMax, *libSurfaces;
+        if( !snapshot_read_u32( reader, &count ) ||
+            (localMin = snapshot_read( reader, sizeof( int32_t ) * 3 )) == NULL ||
+            (localMax = snapshot_read( reader, sizeof( int32_t ) * 3 )) == NULL ||
+            (libSurfaces = snapshot_read( reader, sizeof( struct SM64Surface ) * count )) == NULL )
+        {
+            return false;
+        }
+
+        s_meshes = realloc( s_meshes, (s_meshes_count + 1) * sizeof( struct RegisteredMesh ));
+        struct RegisteredMesh *mesh = &s_meshes[s_meshes_count++];
+        mesh->count = count;
+        memcpy( mesh->localMin, localMin, sizeof( mesh->localMin ));
+        memcpy( mesh->localMax, localMax, sizeof( mesh->localMax ));
+        mesh->libSurfaces = malloc( sizeof( struct SM64Surface ) * count );
+        memcpy( mesh->libSurfaces, libSurfaces, sizeof( struct SM64Surface ) * count );
+    }
+
+    for( uint32_t i = 0; i < s_level_rooms_count; ++i )
+    {
+        uint32_t loaded;
+        if( !snapshot_read_u32( reader, &loaded ))
+            return false;
+        if( loaded && !snapshot_read_room( reader, i ))
+            return false;
+    }
+
+    if( objectsCount > 0 )
+    {
+        // Zeroed slots are unloaded, so the level can still be unloaded if the snapshot is cut short.
+        s_dynamic_objects->objects = calloc( objectsCount, sizeof( struct LoadedSurfaceObject ));
+        s_dynamic_objects->objectsCapacity = objectsCount;
+        s_dynamic_objects->objectsCount = objectsCount;
+    }
+
+    for( uint32_t i = 0; i < objectsCount; ++i )
+    {
+        if( !snapshot_read_dynamic_object( reader, i ))
+        {
+            return false;
+        }
+    }
+
+    // Rebuilt backwards so the free list hands out the lowest slots first
+    s_dynamic_objects->freeHead = DYNAMIC_OBJECT_NO_SLOT;
+    for( uint32_t i = objectsCount; i-- > 0; )
+    {
+        if( !s_dynamic_objects->objects[i].loaded )
+        {
+            s_dynamic_objects->objects[i].nextFree = s_dynamic_objects->freeHead;
+            s_dynamic_objects->freeHead = i;
+        }
+    }
 
     return true;
 }
 
-void level_unload()
+uint8_t *level_read_snapshot_file(const char *path, size_t *outSize)
+{
+    FILE *file = fopen( path, "rb" );
+    if( file == NULL )
+    {
+        DEBUG_PRINT("Could not open snapshot file %s", path);
+        return NULL;
+    }
+
+    fseek( file, 0, SEEK_END );
+    long size = ftell( file );
+    fseek( file, 0, SEEK_SET );
+
+    // An unreadable file comes back empty rather than NULL, loading it then fails like a corrupt one.
+    *outSize = size > 0 ? (size_t)size : 0;
+    uint8_t *data = malloc( *outSize > 0 ? *outSize : 1 );
+    if( data != NULL && *outSize > 0 && fread( data, *outSize, 1, file ) != 1 )
+    {
+        *outSize = 0;
+    }
+    fclose( file );
+    return data;
+}
+
+bool level_load_snapshot_data(const uint8_t *data, size_t size)
 {
+    struct SnapshotReader reader;
+    reader.data = data;
+    reader.size = size;
+    reader.offset = 0;
+
+    if( size == 0 || !level_read_snapshot( &reader ))
+    {
+        if( s_level_loaded )
+        {
+            level_unload();
+        }
+        return false;
+    }
+    return true;
+}
+
+bool level_load_snapshot(const char *path)
+{
+    size_t size;
+    uint8_t *data = level_read_snapshot_file( path, &size );
+    if( data == NULL )
+    {
+        return false;
+    }
+
+    bool ok = level_load_snapshot_data( data, size );
+    free( data );
+
+    if( !ok )
+    {
+        DEBUG_PRINT("Failed loading snapshot file %s", path);
+        return false;
+    }
+
     #ifdef DEBUG_LEVEL_ROOMS
-        printf("SM64: unload level\n");
+        printf("SM64: loaded level snapshot %s\n", path);
     #endif
 
-    s_level_loaded=false;
-
-    level_unload_all_rooms();
-    level_unload_all_player_loaded_rooms();
-    level_unload_all_dynamic_objects();
-    level_unload_big_floor_hack();
+    return true;
 }
 
 #pragma endregion
 
-#pragma region Counts and Surfaces getters
+#pragma region Shared rooms
 
-uint32_t level_get_room_count(void)
+#define SHARED_ROOMS_MAGIC 0x5234534D // "MS4R"
+#define SHARED_ROOMS_VERSION 2
+#define SHARED_ROOMS_ALIGNMENT 16
+
+/**
+ * The region starts with the header and one entry per room, followed by the engine surfaces and the mesh
+ * instances of every published room. Offsets are relative to the start of the region so each process can map it anywhere.
+ * Instances only carry their mesh id, so the attaching process must register the same meshes in the same order.
+ */
+struct SharedRoomsHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t surfaceSize;
+    uint32_t roomsCount;
+};
+
+struct SharedRoomEntry
+{
+    uint32_t loaded;
+    uint32_t count;
+    uint64_t offset;
+    uint32_t instancesCount;
+    uint64_t instancesOffset;
+    struct SM64SurfaceCleanupStats cleanupStats;
+};
+
+struct SharedMeshInstance
+{
+    uint32_t meshId;
+    struct SurfaceObjectTransform transform;
+};
+
+static size_t shared_rooms_align( size_t offset )
 {
-    return s_current_loaded_rooms->count+2;
+    return (offset + SHARED_ROOMS_ALIGNMENT - 1) & ~(size_t)(SHARED_ROOMS_ALIGNMENT - 1);
 }
 
-uint32_t level_get_room_surfaces_count(uint32_t roomIndex)
+bool level_share_rooms(const char *name)
 {
-    if(roomIndex == s_current_loaded_rooms->count)
+    if( !s_level_loaded || s_shared_rooms.data != NULL )
     {
-        if(s_dynamic_objects){
-            return s_dynamic_objects->cached_count;
+        DEBUG_PRINT("Can't share rooms of a non-loaded level or a level that already uses shared rooms");
+        return false;
+    }
+
+    size_t size = shared_rooms_align( sizeof( struct SharedRoomsHeader ) + sizeof( struct SharedRoomEntry ) * s_level_rooms_count );
+    for( uint32_t i = 0; i < s_level_rooms_count; ++i )
+    {
+        if( s_level_rooms[i] == NULL )
+            continue;
+
+        size = shared_rooms_align( size + sizeof( struct Surface ) * s_level_rooms[i]->count );
+        size = shared_rooms_align( size + sizeof( struct SharedMeshInstance ) * s_level_rooms[i]->instancesCount );
+    }
+
+    if( !shared_memory_create( &s_shared_rooms, name, size ))
+    {
+        return false;
+    }
+
+    uint8_t *data = (uint8_t*)s_shared_rooms.data;
+    struct SharedRoomsHeader *header = (struct SharedRoomsHeader*)data;
+    struct SharedRoomEntry *entries = (struct SharedRoomEntry*)(data + sizeof( struct SharedRoomsHeader ));
+
+    header->magic = SHARED_ROOMS_MAGIC;
+    header->version = SHARED_ROOMS_VERSION;
+    header->surfaceSize = sizeof( struct Surface );
+    header->roomsCount = s_level_rooms_count;
+
+    size_t offset = shared_rooms_align( sizeof( struct SharedRoomsHeader ) + sizeof( struct SharedRoomEntry ) * s_level_rooms_count );
+    for( uint32_t i = 0; i < s_level_rooms_count; ++i )
+    {
+        struct Room *room = s_level_rooms[i];
+        memset( &entries[i], 0, sizeof( struct SharedRoomEntry ));
+        if( room == NULL )
+            continue;
+
+        entries[i].loaded = 1;
+        entries[i].count = room->count;
+        entries[i].offset = offset;
+        entries[i].cleanupStats = room->cleanupStats;
+
+        struct Surface *surfaces = (struct Surface*)(data + offset);
+        memcpy( surfaces, room->surfaces, sizeof( struct Surface ) * room->count );
+        for( uint32_t j = 0; j < room->count; ++j )
+        {
+            // Static transforms never move, so dropping them doesn't change how Mario stands on them.
+            surfaces[j].transform = NULL;
+            // The room address means nothing to the attaching process, references to these surfaces find the room by searching.
+            surfaces[j].owner.container = NULL;
         }
-        return 0; //dynamic objects still weren't loaded
+        offset = shared_rooms_align( offset + sizeof( struct Surface ) * room->count );
+
+        // Instances get their world-space surfaces built by each process, only what they instance and where is published.
+        entries[i].instancesCount = room->instancesCount;
+        entries[i].instancesOffset = offset;
+        struct SharedMeshInstance *instances = (struct SharedMeshInstance*)(data + offset);
+        for( uint32_t j = 0; j < room->instancesCount; ++j )
+        {
+            memset( &instances[j], 0, sizeof( struct SharedMeshInstance ));
+            instances[j].meshId = room->instances[j]->meshId;
+            instances[j].transform = room->instances[j]->transform;
+        }
+        offset = shared_rooms_align( offset + sizeof( struct SharedMeshInstance ) * room->instancesCount );
+    }
+
+    #ifdef DEBUG_LEVEL_ROOMS
+        printf("SM64: shared %d rooms in %s (%zu bytes)\n", s_level_rooms_count, name, size);
+    #endif
+
+    return true;
+}
+
+uint32_t level_attach_shared_rooms(const char *name)
+{
+    if( !s_level_loaded || s_shared_rooms.data != NULL )
+    {
+        DEBUG_PRINT("Can't attach shared rooms to a non-loaded level or a level that already uses shared rooms");
+        return 0;
+    }
+
+    if( !shared_memory_open( &s_shared_rooms, name ))
+    {
+        return 0;
     }
-    if(roomIndex>s_current_loaded_rooms->count)
+
+    uint8_t *data = (uint8_t*)s_shared_rooms.data;
+    size_t size = s_shared_rooms.size;
+    const struct SharedRoomsHeader *header = (const struct SharedRoomsHeader*)data;
+    size_t entriesEnd = sizeof( struct SharedRoomsHeader ) + sizeof( struct SharedRoomEntry ) * s_level_rooms_count;
+
+    if( size < sizeof( struct SharedRoomsHeader ) || header->magic != SHARED_ROOMS_MAGIC || header->version != SHARED_ROOMS_VERSION ||
+        header->surfaceSize != sizeof( struct Surface ) || header->roomsCount != s_level_rooms_count || size < entriesEnd )
+    {
+        DEBUG_PRINT("Shared rooms %s don't match this level or this build", name);
+        shared_memory_close( &s_shared_rooms );
+        return 0;
+    }
+
+    const struct SharedRoomEntry *entries = (const struct SharedRoomEntry*)(data + sizeof( struct SharedRoomsHeader ));
+    uint32_t attached = 0;
+    for( uint32_t i = 0; i < s_level_rooms_count; ++i )
     {
-        return s_current_loaded_rooms->clippersCount;
+        const struct SharedRoomEntry *entry = &entries[i];
+        if( !entry->loaded || s_level_rooms[i] != NULL )
+            continue;
+
+        if( entry->offset < entriesEnd || entry->offset > size || entry->count > (size - entry->offset) / sizeof( struct Surface ))
+        {
+            DEBUG_PRINT("Shared room %u is out of the bounds of %s", i, name);
+            continue;
+        }
+
+        if( entry->instancesOffset < entriesEnd || entry->instancesOffset > size || entry->instancesCount > (size - entry->instancesOffset) / sizeof( struct SharedMeshInstance ))
+        {
+            DEBUG_PRINT("Shared mesh instances of room %u are out of the bounds of %s", i, name);
+            continue;
+        }
+
+        struct Room *room = (struct Room*)malloc(sizeof(struct Room));
+        room->surfaces = (struct Surface*)(data + entry->offset);
+        room->count = entry->count;
+        room->sharedSurfaces = true;
+        room->instances = NULL;
+        room->instancesCount = 0;
+        memset( &room->instancesGrid, 0, sizeof( struct MeshInstanceGrid ));
+        room->cleanupStats = entry->cleanupStats;
+        room->slot = i;
+
+        const struct SharedMeshInstance *instances = (const struct SharedMeshInstance*)(data + entry->instancesOffset);
+        if( entry->instancesCount > 0 )
+        {
+            room->instances = malloc( entry->instancesCount * sizeof( struct MeshInstance* ));
+        }
+        for( uint32_t j = 0; j < entry->instancesCount; ++j )
+        {
+            if( instances[j].meshId >= s_meshes_count )
+            {
+                DEBUG_PRINT("Shared room %u instances mesh %u which isn't registered in this process", i, instances[j].meshId);
+                continue;
+            }
+
+            struct MeshInstance *instance = malloc( sizeof( struct MeshInstance ));
+            instance->meshId = instances[j].meshId;
+            instance->surfaces = NULL;
+            instance->transform = instances[j].transform;
+            mesh_instance_set_owner( instance, room, room->instancesCount );
+            room->instances[room->instancesCount++] = instance;
+            mesh_instance_compute_bounds( instance );
+        }
+        mesh_instances_grid_build( room );
+
+        s_level_rooms[i] = room;
+        s_level_rooms_versions[i] = ++s_level_version;
+        attached++;
     }
 
-    return s_current_loaded_rooms->rooms[roomIndex]->count;
+    // The attached instances may be in reach of the last queries.
+    mesh_instances_queries_reset();
+
+    #ifdef DEBUG_LEVEL_ROOMS
+        printf("SM64: attached %d rooms from %s\n", attached, name);
+    #endif
+
+    return attached;
 }
 
-struct Surface *level_get_room_surface(uint32_t roomIndex, uint32_t surfaceIndex)
+#pragma endregion
+
+#pragma region Surface references
+
+static bool surface_in_array( const struct Surface *surface, const struct Surface *array, uint32_t count, uint32_t *outIndex )
 {
-    if(roomIndex == s_current_loaded_rooms->count){
-        return s_dynamic_objects->cached_surfaces[surfaceIndex];
+    if( array == NULL || surface < array || surface >= array + count )
+        return false;
+
+    *outIndex = (uint32_t)(surface - array);
+    return true;
+}
+
+void level_surface_to_ref( const struct Surface *surface, struct SurfaceRef *outRef )
+{
+    memset( outRef, 0, sizeof( struct SurfaceRef ));
+    if( surface == NULL )
+        return;
+
+    // The engine's own pseudo floor and the player surfaces are checked first, they don't belong to the level.
+    if( surface == &gWaterSurfacePseudoFloor )
+    {
+        outRef->kind = SURFACE_REF_WATER_PSEUDO_FLOOR;
+        return;
+    }
+
+    if( s_current_loaded_rooms != NULL && surface_in_array( surface, s_current_loaded_rooms->playerSurfaces, BIG_FLOOR_HACK_SURFACES_COUNT + MAX_CLIPPER_BLOCKS_FACES, &outRef->index ))
+    {
+        outRef->kind = SURFACE_REF_PLAYER;
+        return;
     }
-    if(roomIndex > s_current_loaded_rooms->count){
-        return &(s_current_loaded_rooms->clippers[surfaceIndex]);
+
+    // Everything else was stamped with its owner when it was built.
+    switch( surface->owner.kind )
+    {
+        case SURFACE_REF_ROOM:
+        {
+            const struct Room *room = surface->owner.container;
+            if( room != NULL )
+            {
+                outRef->kind = SURFACE_REF_ROOM;
+                outRef->owner = room->slot;
+                outRef->index = (uint32_t)(surface - room->surfaces);
+                return;
+            }
+
+            // Shared room surfaces can't be stamped by this process, only the rooms are searched for them.
+            for( uint32_t i = 0; s_level_rooms != NULL && i < s_level_rooms_count; ++i )
+            {
+                if( s_level_rooms[i] != NULL && surface_in_array( surface, s_level_rooms[i]->surfaces, s_level_rooms[i]->count, &outRef->index ))
+                {
+                    outRef->kind = SURFACE_REF_ROOM;
+                    outRef->owner = i;
+                    return;
+                }
+            }
+            break;
+        }
+
+        case SURFACE_REF_MESH_INSTANCE:
+        {
+            const struct MeshInstance *instance = surface->owner.container;
+            outRef->kind = SURFACE_REF_MESH_INSTANCE;
+            outRef->owner = instance->room->slot;
+            outRef->instance = instance->index;
+            outRef->index = (uint32_t)(surface - instance->surfaces);
+            return;
+        }
+
+        case SURFACE_REF_DYNAMIC_OBJECT:
+        {
+            const struct LoadedSurfaceObject *obj = dynamic_object_from_id( surface->owner.id );
+            if( obj != NULL )
+            {
+                outRef->kind = SURFACE_REF_DYNAMIC_OBJECT;
+                outRef->owner = obj->id;
+                outRef->index = (uint32_t)(surface - obj->engineSurfaces);
+                return;
+            }
+            break;
+        }
     }
 
-    return &(s_current_loaded_rooms->rooms[roomIndex]->surfaces[surfaceIndex]);
+    #ifdef DEBUG_LEVEL_ROOMS
+        printf("SM64: surface %p doesn't belong to the level.\n", (const void *)surface);
+    #endif
 }
 
-struct Surface **level_get_all_loaded_surfaces(int *resultCount)
+struct Surface *level_surface_from_ref( const struct SurfaceRef *ref )
 {
-    *resultCount = 0;
-    for(int i=0; i<s_current_loaded_rooms->count; i++)
+    switch( ref->kind )
     {
-        *resultCount+=s_current_loaded_rooms->rooms[i]->count;
+        case SURFACE_REF_PLAYER:
+            if( s_current_loaded_rooms == NULL || ref->index >= BIG_FLOOR_HACK_SURFACES_COUNT + MAX_CLIPPER_BLOCKS_FACES )
+                return NULL;
+            return &s_current_loaded_rooms->playerSurfaces[ref->index];
+
+        case SURFACE_REF_ROOM:
+        {
+            struct Room *room = ref->owner < s_level_rooms_count ? s_level_rooms[ref->owner] : NULL;
+            if( room == NULL || ref->index >= room->count )
+                return NULL;
+            return &room->surfaces[ref->index];
+        }
+
+        case SURFACE_REF_MESH_INSTANCE:
+        {
+            struct Room *room = ref->owner < s_level_rooms_count ? s_level_rooms[ref->owner] : NULL;
+            if( room == NULL || ref->instance >= room->instancesCount )
+                return NULL;
+
+            struct MeshInstance *instance = room->instances[ref->instance];
+            if( ref->index >= s_meshes[instance->meshId].count )
+                return NULL;
+            if( __atomic_load_n( &instance->surfaces, __ATOMIC_ACQUIRE ) == NULL )
+                mesh_instance_build_surfaces( instance );
+            return &instance->surfaces[ref->index];
+        }
+
+        case SURFACE_REF_DYNAMIC_OBJECT:
+        {
+            struct LoadedSurfaceObject *obj = dynamic_object_from_id( ref->owner );
+            if( obj == NULL || ref->index >= obj->surfaceCount )
+                return NULL;
+            return &obj->engineSurfaces[ref->index];
+        }
+
+        case SURFACE_REF_WATER_PSEUDO_FLOOR:
+            return &gWaterSurfacePseudoFloor;
+
+        default:
+            return NULL;
     }
-    *resultCount+=s_dynamic_objects->cached_count;
+}
 
-    struct Surface **result=(struct Surface **)malloc(sizeof(struct Surface *)*(*resultCount));
+void level_transform_to_ref( const struct SurfaceObjectTransform *transform, struct SurfaceRef *outRef )
+{
+    memset( outRef, 0, sizeof( struct SurfaceRef ));
+    if( transform == NULL )
+        return;
 
-    int idx=0;
-    for(int i=0;i<s_current_loaded_rooms->count;i++)
+    switch( transform->owner.kind )
     {
-        for(int j=0; j<s_current_loaded_rooms->rooms[i]->count; j++)
+        case SURFACE_REF_ROOM:
+        {
+            const struct Room *room = transform->owner.container;
+            outRef->kind = SURFACE_REF_ROOM;
+            outRef->owner = room->slot;
+            outRef->index = transform->owner.id;
+            return;
+        }
+
+        case SURFACE_REF_MESH_INSTANCE:
         {
-            result[idx++]=&(s_current_loaded_rooms->rooms[i]->surfaces[j]);
+            const struct MeshInstance *instance = transform->owner.container;
+            outRef->kind = SURFACE_REF_MESH_INSTANCE;
+            outRef->owner = instance->room->slot;
+            outRef->instance = instance->index;
+            return;
         }
+
+        case SURFACE_REF_DYNAMIC_OBJECT:
+            outRef->kind = SURFACE_REF_DYNAMIC_OBJECT;
+            outRef->owner = transform->owner.id;
+            return;
     }
+}
 
-    for(int i=0; i<s_dynamic_objects->cached_count; i++)
+struct SurfaceObjectTransform *level_transform_from_ref( const struct SurfaceRef *ref )
+{
+    switch( ref->kind )
     {
-        result[idx++]=s_dynamic_objects->cached_surfaces[i];
+        case SURFACE_REF_ROOM:
+        {
+            struct Room *room = ref->owner < s_level_rooms_count ? s_level_rooms[ref->owner] : NULL;
+            if( room == NULL || ref->index >= room->count )
+                return NULL;
+            return room->surfaces[ref->index].transform;
+        }
+
+        case SURFACE_REF_MESH_INSTANCE:
+        {
+            struct Room *room = ref->owner < s_level_rooms_count ? s_level_rooms[ref->owner] : NULL;
+            if( room == NULL || ref->instance >= room->instancesCount )
+                return NULL;
+            return &room->instances[ref->instance]->transform;
+        }
+
+        case SURFACE_REF_DYNAMIC_OBJECT:
+            return level_get_dynamic_object_transform( ref->owner );
+
+        default:
+            return NULL;
     }
-    return result;
 }
 
 #pragma endregion
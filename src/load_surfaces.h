@@ -7,36 +7,144 @@
 
 struct LoadedSurfaceObject
 {
+    uint32_t id;
+    uint32_t generation;
+    bool loaded;
+    uint32_t nextFree;
+
+    uint32_t version;
+    uint32_t geometryVersion;
+    struct SM64ObjectTransform libTransform;
+
     struct SurfaceObjectTransform *transform;
     uint32_t surfaceCount;
     struct SM64Surface *libSurfaces;
-    struct Surface *engineSurfaces;    
+    struct Surface *engineSurfaces;
+    uint32_t *cacheSlots; // index of each engine surface in DynamicObjects::cached_surfaces
+    float radius; // farthest vertex from the object origin, bounds the cells it reaches
+};
+
+struct RegisteredMesh
+{
+    struct SM64Surface *libSurfaces;
+    uint32_t count;
+
+    int32_t localMin[3];
+    int32_t localMax[3];
+};
+
+struct MeshInstance
+{
+    uint32_t meshId;
+    struct SurfaceObjectTransform transform;
+
+    int32_t worldMin[3];
+    int32_t worldMax[3];
+
+    // World-space copy of the mesh surfaces, only built once a query reaches the instance bounds.
+    struct Surface *surfaces;
+
+    // Room holding the instance and its position in room->instances, they give the references to its surfaces.
+    struct Room *room;
+    uint32_t index;
+};
+
+// Mesh instances bucketed by the XZ cells their bounds overlap, so a query only looks at the instances around it.
+// cellStarts has cellsX * cellsZ + 1 entries, cell c holds cellInstances[cellStarts[c]] up to cellInstances[cellStarts[c+1]].
+struct MeshInstanceGrid
+{
+    int32_t originX;
+    int32_t originZ;
+    int32_t cellSize;
+    uint32_t cellsX;
+    uint32_t cellsZ;
+    uint32_t *cellStarts;
+    uint32_t *cellInstances;
 };
 
 struct Room
 {
     struct Surface *surfaces;
     uint32_t count;
+
+    // Each instance is allocated on its own, the surfaces built from it and Mario's platform point at its transform.
+    struct MeshInstance **instances;
+    uint32_t instancesCount;
+    struct MeshInstanceGrid instancesGrid;
+
+    struct SM64SurfaceCleanupStats cleanupStats;
+
+    // Surfaces point into the shared rooms mapping and are not owned by the room.
+    bool sharedSurfaces;
+
+    // Level slot the room is in right now, room switches move it.
+    uint32_t slot;
 };
 
+#define BIG_FLOOR_HACK_SURFACES_COUNT 2
+
 struct MarioLoadedRooms
 {
     int32_t marioId;
     
-    struct Room **rooms;
+    // Room slots in the level, resolved on every query so room switches don't need to touch them.
+    uint32_t *roomIds;
     uint32_t count;
     
-    struct Surface clippers[MAX_CLIPPER_BLOCKS_FACES];
+    // The big floor hack followed by the clippers, both are queried as one group.
+    // Each player moves its own big floor so players ticked on different threads don't share it.
+    struct Surface playerSurfaces[BIG_FLOOR_HACK_SURFACES_COUNT + MAX_CLIPPER_BLOCKS_FACES];
     uint32_t clippersCount;
+
+    // Mesh instance surfaces near the last query of this player.
+    struct Surface **instancesQuery;
+    uint32_t instancesQueryCount;
+    uint32_t instancesQueryCapacity;
+    // Where the last query was made, the instances around it are kept when the level frees the far ones.
+    float lastQueryX;
+    float lastQueryZ;
+    bool hasQueried;
+
+    // Next private copy made by level_copy_player_loaded_rooms, they aren't in the player table.
+    struct MarioLoadedRooms *nextPrivate;
+};
+
+struct CachedSurfaceOwner
+{
+    uint32_t objIdx;
+    uint32_t surfIdx;
+};
+
+enum SurfaceRefKind
+{
+    SURFACE_REF_NONE,
+    SURFACE_REF_ROOM,
+    SURFACE_REF_MESH_INSTANCE,
+    SURFACE_REF_DYNAMIC_OBJECT,
+    SURFACE_REF_PLAYER,
+    SURFACE_REF_WATER_PSEUDO_FLOOR // gWaterSurfacePseudoFloor, the floor of a Mario walking on the water bed
+};
+
+// Identifies a surface by where it is stored instead of by address, so it can be saved and resolved again later.
+struct SurfaceRef
+{
+    uint32_t kind;
+    uint32_t owner; // room slot or surface object id
+    uint32_t instance;
+    uint32_t index;
 };
 
 struct DynamicObjects
 {
     struct LoadedSurfaceObject *objects;
     uint32_t objectsCount;
+    uint32_t objectsCapacity;
+    uint32_t freeHead;
 
     struct Surface **cached_surfaces;
+    struct CachedSurfaceOwner *cached_owners;
     uint32_t cached_count;
+    uint32_t cached_capacity;
 };
 
 extern bool level_init(uint32_t roomsCount);
@@ -47,40 +155,275 @@ extern void level_load_room(uint32_t roomId, const struct SM64Surface *staticSur
 extern void level_rooms_switch(int switchedRooms[][2], int switchedRoomsCount);
 extern void level_unload_room(uint32_t roomId);
 
-extern void level_load_player_loaded_rooms(int marioId);
+/**
+ * @brief Enables the cleanup pass run on the static surfaces of every room loaded afterwards and on registered meshes.
+ * 
+ * @param options cleanup steps to run or NULL to disable it.
+ */
+extern void level_set_surface_cleanup(const struct SM64SurfaceCleanupOptions *options);
+extern bool level_get_room_cleanup_stats(uint32_t roomId, struct SM64SurfaceCleanupStats *outStats);
+
+/**
+ * @brief Registers a collision mesh in local space so it can be placed many times with level_load_room_mesh_instances.
+ * 
+ * @return uint32_t the mesh id or UINT32_MAX if no level is loaded.
+ */
+extern uint32_t level_register_mesh(const struct SM64Surface *surfaces, uint32_t numSurfaces);
+/**
+ * @brief Adds instances of registered meshes to an already loaded room.
+ * Only the transform and bounds of each instance are stored until a query reaches it.
+ */
+extern void level_load_room_mesh_instances(uint32_t roomId, const struct SM64MeshInstance *instances, uint32_t instancesCount);
+/**
+ * @brief Gathers the surfaces of the mesh instances in the current Mario's rooms whose bounds contain the given point.
+ * They are exposed to the collision queries as the last activated room. Only the instances bucketed in the cells of
+ * each room's MeshInstanceGrid around the point are tested.
+ * 
+ * @param margin horizontal distance added around each instance bounds (wall radius).
+ */
+extern void level_update_mesh_instances_query(float x, float z, float margin);
+/**
+ * @brief Frees the world surfaces of the mesh instances no position is near and no pinned surface belongs to.
+ * The next query reaching such an instance builds them again. Must not run while a query runs on another thread.
+ * 
+ * @param margin horizontal distance added around each instance bounds.
+ * @param pinned surfaces still referenced from outside the queries, like the floor, wall and ceiling of each Mario.
+ */
+extern void level_release_mesh_instances_surfaces(const Vec3f *positions, uint32_t positionsCount, float margin, const struct Surface *const *pinned, uint32_t pinnedCount);
+/**
+ * @brief Brackets collision queries made concurrently by several threads.
+ * Mesh instances are freed by the queries themselves once their built surfaces pass a budget, which can only happen
+ * while a single thread queries. In between, the release is held back and level_queries_parallel_end runs it if due.
+ */
+extern void level_queries_parallel_begin(void);
+extern void level_queries_parallel_end(void);
+/**
+ * @brief Gets the number of surfaces currently built for mesh instances.
+ */
+extern uint32_t level_get_mesh_instances_built_surfaces(void);
+
+/**
+ * @brief Registers the loaded rooms of a Mario, the storage stays owned by the caller until it is unloaded.
+ * 
+ * @param roomIds room list with space for level_get_room_slots_count() entries.
+ */
+/**
+ * @brief Registers the loaded rooms record of a Mario, the table grows with the number of Marios.
+ * @return false if there was no memory left to grow the table, the record is left unregistered.
+ */
+extern bool level_load_player_loaded_rooms(int marioId, struct MarioLoadedRooms *loadedRooms, uint32_t *roomIds);
 extern void level_unload_player_loaded_rooms(int marioId);
 extern void level_update_player_loaded_Rooms(int marioId, int *newloadedRooms, int loadedCount);
+/**
+ * @brief Sets up a private copy of src's rooms, clippers and big floor that isn't listed in the player table.
+ * Such records are bound with level_bind_loaded_rooms and given back with level_release_loaded_rooms. They are still
+ * found by marioId, so level_set_active_mario and the loaded rooms updates work on them too.
+ * 
+ * @param roomIds has room for the room count of the level, it replaces src's list.
+ */
+extern void level_copy_player_loaded_rooms(int marioId, struct MarioLoadedRooms *dst, const struct MarioLoadedRooms *src, uint32_t *roomIds);
+/**
+ * @brief Finds the loaded rooms of a Mario, in the player table or among the private copies. NULL if it has none.
+ */
+extern struct MarioLoadedRooms *level_find_player_loaded_rooms(int marioId);
+extern void level_bind_loaded_rooms(struct MarioLoadedRooms *loadedRooms);
+extern void level_release_loaded_rooms(struct MarioLoadedRooms *loadedRooms);
 extern void level_update_player_loaded_Rooms_with_clippers(int marioId, int *newloadedRooms, int loadedCount, const struct SM64Surface clippers[MAX_CLIPPER_BLOCKS_FACES], uint32_t clippersCount);
 
+/**
+ * @brief Loads a surface object into a free slot.
+ * 
+ * @return uint32_t the object id, it carries the slot generation so it stops being valid once the object is unloaded.
+ */
 extern uint32_t level_load_dynamic_object( const struct SM64SurfaceObject *surfaceObject );
 extern void level_unload_dynamic_object( uint32_t objId, bool update_cache );
 extern void level_update_dynamic_object_transform( uint32_t objId, const struct SM64ObjectTransform *newTransform );
+/**
+ * @brief Moves many surface objects at once. Invalid ids are reported and skipped.
+ */
+extern void level_update_dynamic_objects_transforms( const uint32_t *objIds, const struct SM64ObjectTransform *newTransforms, uint32_t count );
 extern struct SurfaceObjectTransform *level_get_dynamic_object_transform( uint32_t objId );
 
 /**
- * @brief Gets the number of activated rooms for the current Mario +1 for the dynamic objects.
+ * @brief Gets the number of room indices of the current Mario, its loaded rooms count + 3, or 0 when no Mario is bound.
+ * Indices 0 to count-1 are the loaded rooms in list order, count is the dynamic objects, count+1 the player surfaces
+ * (big floor hack then clippers) and count+2 the mesh instances gathered by the last level_update_mesh_instances_query.
  * 
  * @return uint32_t
  */
 extern uint32_t level_get_room_count(void);
 /**
- * @brief Gets the number of surfaces contained by the given selected activated room.
- * If the roomIndex is the last one it will correspond to the dynamic objects surfaces.
+ * @brief Gets the number of room slots of the loaded level, the most rooms a Mario can have loaded at once.
+ * Unlike level_get_room_count it doesn't depend on the bound Mario.
+ * 
+ * @return uint32_t
+ */
+extern uint32_t level_get_room_slots_count(void);
+/**
+ * @brief Gets the number of surfaces behind a room index of the current Mario, see level_get_room_count for the layout.
+ * A loaded room whose slot is empty has none.
  * 
- * @param roomIndex activated room index from which to get the number of surfaces.
+ * @param roomIndex room index below level_get_room_count().
  * @return uint32_t
  */
 extern uint32_t level_get_room_surfaces_count(uint32_t roomIndex);
 /**
- * @brief Gets a surface from the given selected activated room.
- * If the roomIndex is the last one it will correspond to the dynamic objects surfaces.
+ * @brief Gets a surface behind a room index of the current Mario, see level_get_room_count for the layout.
  * 
- * @param roomIndex activated room index from which to get the surface.
- * @param surfaceIndex surface index to get from the given activated room.
+ * @param roomIndex room index below level_get_room_count().
+ * @param surfaceIndex surface index below level_get_room_surfaces_count(roomIndex).
  * @return struct Surface*
  */
 extern struct Surface *level_get_room_surface(uint32_t roomIndex, uint32_t surfaceIndex);
 
-extern struct Surface **level_get_all_loaded_surfaces(int *resultCount);
+/**
+ * @brief Contiguous view over the surfaces behind one room index.
+ * Rooms and clippers are backed by an array of surfaces, dynamic objects and mesh instances by an array of pointers.
+ */
+struct SurfaceSpan
+{
+    struct Surface *surfaces;
+    struct Surface **indirect;
+    uint32_t count;
+};
+
+/**
+ * @brief Allocation-free iterator over every surface active for the current Mario.
+ */
+struct LevelSurfaceIterator
+{
+    uint32_t roomIndex;
+    uint32_t surfaceIndex;
+    struct SurfaceSpan span;
+};
+
+static inline struct Surface *surface_span_get(const struct SurfaceSpan *span, uint32_t index)
+{
+    return span->surfaces != NULL ? &span->surfaces[index] : span->indirect[index];
+}
+
+/**
+ * @brief Gets a view over the surfaces behind a room index of the current Mario without copying them.
+ * See level_get_room_count for the layout: loaded rooms and the player surfaces are direct, dynamic objects and mesh
+ * instances indirect. An empty loaded room slot gives an empty span.
+ * 
+ * @param roomIndex room index below level_get_room_count().
+ * @param span filled with the room surfaces.
+ */
+extern void level_get_room_surface_span(uint32_t roomIndex, struct SurfaceSpan *span);
+
+extern void level_surface_iterator_begin(struct LevelSurfaceIterator *it);
+/**
+ * @brief Gets the next surface active for the current Mario.
+ * The mesh instances are the ones of the last level_update_mesh_instances_query, refresh it first outside a collision query.
+ * 
+ * @return struct Surface* or NULL once every room has been visited.
+ */
+extern struct Surface *level_surface_iterator_next(struct LevelSurfaceIterator *it);
+
+extern void level_update_big_floor_hack(float x, float y, float z);
+
+/**
+ * @brief Saves the rooms, registered meshes and surface objects of the level to a file.
+ * The file stores the converted engine surfaces, so it can only be loaded by the same build of libsm64.
+ */
+extern bool level_save_snapshot(const char *path);
+/**
+ * @brief Replaces the current level with the one saved in the snapshot file.
+ * Surface object ids are kept. Like level_init it drops the players loaded rooms, so it must be called before creating Marios.
+ */
+extern bool level_load_snapshot(const char *path);
+/**
+ * @brief Reads a whole snapshot file, the recorder keeps the bytes so the replay doesn't need the file.
+ * @return NULL if the file can't be opened, otherwise a buffer to free. outSize is 0 if the file couldn't be read.
+ */
+extern uint8_t *level_read_snapshot_file(const char *path, size_t *outSize);
+/**
+ * @brief Same as level_load_snapshot for a snapshot already in memory.
+ */
+extern bool level_load_snapshot_data(const uint8_t *data, size_t size);
 
-extern void level_update_big_floor_hack(float x, float y, float z);
\ No newline at end of file
+/**
+ * @brief Publishes the static surfaces of the loaded rooms in a named shared memory region so other processes can attach them.
+ * Static object transforms are not shared, their surfaces are published without one.
+ * The mesh instances of the rooms are published by mesh id and transform.
+ * The region name is removed when this level is unloaded. Fails if the name doesn't fit in SharedMemory::name.
+ */
+extern bool level_share_rooms(const char *name);
+/**
+ * @brief Maps the rooms published by another process read-only and uses them for every room not loaded yet.
+ * The level must have been initialized with the same rooms count as the publisher and registered the same meshes
+ * in the same order, instances of a mesh that isn't registered are skipped.
+ * @return uint32_t the number of rooms attached.
+ */
+extern uint32_t level_attach_shared_rooms(const char *name);
+
+/**
+ * @brief Finds where a surface is stored. Player surfaces are looked up in the loaded rooms of the active Mario.
+ */
+extern void level_surface_to_ref(const struct Surface *surface, struct SurfaceRef *outRef);
+/**
+ * @brief Resolves a reference made by level_surface_to_ref, NULL if the surface doesn't exist anymore.
+ */
+extern struct Surface *level_surface_from_ref(const struct SurfaceRef *ref);
+/**
+ * @brief Finds what a transform belongs to, so a platform can be saved like a surface.
+ */
+extern void level_transform_to_ref(const struct SurfaceObjectTransform *transform, struct SurfaceRef *outRef);
+/**
+ * @brief Resolves a reference made by level_transform_to_ref, NULL if the transform doesn't exist anymore.
+ */
+extern struct SurfaceObjectTransform *level_transform_from_ref(const struct SurfaceRef *ref);
+
+extern void level_copy_debug_surface(struct SM64DebugSurface *dst, const struct Surface *src);
+
+/**
+ * @brief Versions of the collision around a point, any change of them means cached floor or wall queries there may be stale.
+ */
+struct LevelLayoutStamp
+{
+    // Level loads, loaded rooms updates and surface objects too large to track by cell.
+    uint32_t level;
+    // Newest version of the rooms loaded by the bound Mario.
+    uint32_t rooms;
+    // Newest change of the surface objects reaching the point.
+    uint32_t objects;
+};
+
+/**
+ * @brief Fills the versions of the collision the bound Mario can reach around (x, z), collision elsewhere doesn't change them.
+ */
+extern void level_get_layout_stamp(float x, float z, struct LevelLayoutStamp *outStamp);
+/**
+ * @brief Gets the version of the last change made to the rooms or the surface objects.
+ * Every room load, unload, switch and every surface object create, move or delete increases it.
+ * 
+ * @return uint32_t
+ */
+extern uint32_t level_get_version(void);
+/**
+ * @brief Lists the room slots changed after the given version.
+ * 
+ * @param outRooms array filled with at most maxRooms entries, can be NULL to only count them.
+ * @return uint32_t the number of changed rooms, even if it doesn't fit in outRooms.
+ */
+extern uint32_t level_get_changed_rooms(uint32_t sinceVersion, struct SM64DebugRoomDelta *outRooms, uint32_t maxRooms);
+/**
+ * @brief Exports the world-space surfaces of a loaded room, including its mesh instances.
+ * 
+ * @return uint32_t the number of surfaces written.
+ */
+extern uint32_t level_export_room_surfaces(uint32_t roomId, struct SM64DebugSurface *outSurfaces);
+/**
+ * @brief Lists the surface object slots changed after the given version.
+ * 
+ * @param outObjects array filled with at most maxObjects entries, can be NULL to only count them.
+ * @return uint32_t the number of changed objects, even if it doesn't fit in outObjects.
+ */
+extern uint32_t level_get_changed_dynamic_objects(uint32_t sinceVersion, struct SM64DebugObjectDelta *outObjects, uint32_t maxObjects);
+/**
+ * @brief Exports the surfaces of a surface object in its local space, they must be placed with the object transform.
+ * 
+ * @return uint32_t the number of surfaces written.
+ */
+extern uint32_t level_export_dynamic_object_surfaces(uint32_t objId, struct SM64DebugSurface *outSurfaces);
\ No newline at end of file
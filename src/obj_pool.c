@@ -2,36 +2,90 @@
 
 #include <stdlib.h>
 
-uint32_t obj_pool_alloc_index( struct ObjPool *pool, size_t size )
+static uint32_t obj_pool_make_id( uint32_t index, uint32_t generation )
 {
-    for( uint32_t i = 0; i < pool->size; ++i )
+    return index | (generation << OBJ_POOL_INDEX_BITS);
+}
+
+uint32_t obj_pool_alloc( struct ObjPool *pool, size_t size )
+{
+    uint32_t index;
+    if( pool->freeHead != 0 )
     {
-        if( pool->objects[i] == NULL )
-        {
-            pool->objects[i] = malloc( size );
-            return i;
-        }
+        index = pool->freeHead - 1;
+        pool->freeHead = pool->slots[index].nextFree;
     }
+    else
+    {
+        if( pool->size > OBJ_POOL_INDEX_MASK )
+            return OBJ_POOL_INVALID_ID;
+
+        index = pool->size;
+        pool->size++;
+        pool->slots = realloc( pool->slots, pool->size * sizeof( struct ObjPoolSlot ));
+        pool->slots[index].generation = 1;
+        pool->slots[index].memory = NULL;
+        pool->slots[index].capacity = 0;
+    }
+
+    struct ObjPoolSlot *slot = &pool->slots[index];
+    if( slot->capacity < size )
+    {
+        free( slot->memory );
+        slot->memory = malloc( size + OBJ_POOL_ALIGNMENT - 1 );
+        slot->capacity = size;
+    }
+    slot->object = (void *)(((uintptr_t)slot->memory + OBJ_POOL_ALIGNMENT - 1) & ~(uintptr_t)(OBJ_POOL_ALIGNMENT - 1));
+    slot->nextFree = 0;
+    return obj_pool_make_id( index, slot->generation );
+}
 
-    uint32_t i = pool->size;
-    pool->size++;
-    pool->objects = realloc( pool->objects, pool->size * sizeof( void * ));
-    pool->objects[i] = malloc( size );
-    return i;
+void *obj_pool_get( const struct ObjPool *pool, uint32_t id )
+{
+    uint32_t index = id & OBJ_POOL_INDEX_MASK;
+    if( id == OBJ_POOL_INVALID_ID || index >= pool->size )
+        return NULL;
+
+    const struct ObjPoolSlot *slot = &pool->slots[index];
+    if( slot->object == NULL || slot->generation != (id >> OBJ_POOL_INDEX_BITS) )
+        return NULL;
+
+    return slot->object;
 }
 
-void obj_pool_free_index( struct ObjPool *pool, uint32_t index )
+void obj_pool_free( struct ObjPool *pool, uint32_t id )
 {
-    free( pool->objects[index] );
-    pool->objects[index] = NULL;
+    if( obj_pool_get( pool, id ) == NULL )
+        return;
+
+    uint32_t index = id & OBJ_POOL_INDEX_MASK;
+    struct ObjPoolSlot *slot = &pool->slots[index];
+    slot->object = NULL;
+
+    // Generation 0 is skipped so a zeroed id never matches a live object.
+    slot->generation = (slot->generation + 1) & OBJ_POOL_GENERATION_MASK;
+    if( slot->generation == 0 )
+        slot->generation = 1;
+
+    slot->nextFree = pool->freeHead;
+    pool->freeHead = index + 1;
+}
+
+uint32_t obj_pool_id_at( const struct ObjPool *pool, uint32_t index )
+{
+    if( index >= pool->size || pool->slots[index].object == NULL )
+        return OBJ_POOL_INVALID_ID;
+
+    return obj_pool_make_id( index, pool->slots[index].generation );
 }
 
 void obj_pool_free_all( struct ObjPool *pool )
 {
     for( uint32_t i = 0; i < pool->size; ++i )
-        free( pool->objects[i] );
-    free( pool->objects );
+        free( pool->slots[i].memory );
+    free( pool->slots );
 
     pool->size = 0;
-    pool->objects = NULL;
-}
\ No newline at end of file
+    pool->slots = NULL;
+    pool->freeHead = 0;
+}
@@ -3,12 +3,39 @@
 #include <stddef.h>
 #include <stdint.h>
 
+// Ids pack the slot index with the generation of the slot, so an id stops resolving once its object is freed
+// even if the slot is reused. They stay positive when stored in an int32_t.
+#define OBJ_POOL_INDEX_BITS 20
+#define OBJ_POOL_INDEX_MASK ((1u << OBJ_POOL_INDEX_BITS) - 1)
+#define OBJ_POOL_GENERATION_MASK ((1u << (31 - OBJ_POOL_INDEX_BITS)) - 1)
+#define OBJ_POOL_INVALID_ID UINT32_MAX
+// Objects start on a cache line so the hot parts of one object don't share lines with its neighbours.
+#define OBJ_POOL_ALIGNMENT 64
+
+struct ObjPoolSlot
+{
+    void *object;
+    // The allocation backing the slot, kept when the object is freed so the next object in the slot reuses it.
+    void *memory;
+    size_t capacity;
+    uint32_t generation;
+    // 1 + index of the next free slot, 0 ends the free list.
+    uint32_t nextFree;
+};
+
 struct ObjPool
 {
     size_t size;
-    void **objects;
+    struct ObjPoolSlot *slots;
+    // 1 + index of the first free slot, 0 if every slot is used.
+    uint32_t freeHead;
 };
 
-extern uint32_t obj_pool_alloc_index( struct ObjPool *pool, size_t size );
-extern void obj_pool_free_index( struct ObjPool *pool, uint32_t index );
-extern void obj_pool_free_all( struct ObjPool *pool );
\ No newline at end of file
+extern uint32_t obj_pool_alloc( struct ObjPool *pool, size_t size );
+extern void *obj_pool_get( const struct ObjPool *pool, uint32_t id );
+extern void obj_pool_free( struct ObjPool *pool, uint32_t id );
+/**
+ * @brief Gets the id of the object stored in the given slot, OBJ_POOL_INVALID_ID if the slot is free.
+ */
+extern uint32_t obj_pool_id_at( const struct ObjPool *pool, uint32_t index );
+extern void obj_pool_free_all( struct ObjPool *pool );
@@ -0,0 +1,486 @@
+// Before any system header, libsm64.h sets _XOPEN_SOURCE
+#include "debug_print.h"
+#include "recorder.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+static FILE *s_file = NULL;
+static volatile bool s_active = false;
+
+// Calls can come from several threads, each record is built in this buffer and written while holding the lock.
+static pthread_mutex_t s_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint8_t *s_record = NULL;
+static uint32_t s_record_size = 0;
+static uint32_t s_record_capacity = 0;
+// Set when the record buffer couldn't grow, record_end then stops the recording instead of writing a truncated record.
+static bool s_record_failed = false;
+
+static void record_bytes( const void *data, uint32_t size )
+{
+    if( s_record_failed )
+        return;
+
+    if( s_record_size + size > s_record_capacity )
+    {
+        uint32_t capacity = ( s_record_size + size ) * 2;
+        uint8_t *record = realloc( s_record, capacity );
+        if( record == NULL )
+        {
+            s_record_failed = true;
+            return;
+        }
+        s_record = record;
+        s_record_capacity = capacity;
+    }
+
+    memcpy( s_record + s_record_size, data, size );
+    s_record_size += size;
+}
+
+static void record_u32( uint32_t value ) { record_bytes( &value, sizeof( value )); }
+static void record_i32( int32_t value ) { record_bytes( &value, sizeof( value )); }
+static void record_f32( float value ) { record_bytes( &value, sizeof( value )); }
+
+/**
+ * Starts a record, returns false without locking if the recording was stopped meanwhile.
+ */
+static bool record_begin( uint8_t type )
+{
+    pthread_mutex_lock( &s_lock );
+    if( s_file == NULL )
+    {
+        pthread_mutex_unlock( &s_lock );
+        return false;
+    }
+
+    s_record_size = 0;
+    s_record_failed = false;
+    record_bytes( &type, 1 );
+    record_u32( 0 );
+    return true;
+}
+
+static void record_end( void )
+{
+    if( s_record_failed )
+    {
+        DEBUG_PRINT("Out of memory building a record, the recording is stopped");
+        s_active = false;
+        fclose( s_file );
+        s_file = NULL;
+        pthread_mutex_unlock( &s_lock );
+        return;
+    }
+
+    uint32_t payloadSize = s_record_size - 1 - sizeof( uint32_t );
+    memcpy( s_record + 1, &payloadSize, sizeof( uint32_t ));
+
+    if( fwrite( s_record, 1, s_record_size, s_file ) != s_record_size )
+    {
+        DEBUG_PRINT("Failed writing the recording, it is stopped");
+        s_active = false;
+        fclose( s_file );
+        s_file = NULL;
+    }
+
+    pthread_mutex_unlock( &s_lock );
+}
+
+bool recorder_start( const char *path )
+{
+    recorder_stop();
+
+    FILE *file = fopen( path, "wb" );
+    if( file == NULL )
+    {
+        DEBUG_PRINT("Failed opening recording file %s", path);
+        return false;
+    }
+
+    uint32_t header[2] = { RECORDING_MAGIC, RECORDING_VERSION };
+    fwrite( header, sizeof( header ), 1, file );
+
+    pthread_mutex_lock( &s_lock );
+    s_file = file;
+    s_active = true;
+    pthread_mutex_unlock( &s_lock );
+    return true;
+}
+
+void recorder_stop( void )
+{
+    pthread_mutex_lock( &s_lock );
+    s_active = false;
+    if( s_file != NULL )
+        fclose( s_file );
+    s_file = NULL;
+
+    free( s_record );
+    s_record = NULL;
+    s_record_size = 0;
+    s_record_capacity = 0;
+    pthread_mutex_unlock( &s_lock );
+}
+
+bool recorder_active( void )
+{
+    return s_active;
+}
+
+// FNV-1a over the fields one by one, the struct padding is never initialized.
+#define CHECKSUM_FIELD( hash, field ) checksum_bytes( hash, &(field), sizeof( field ))
+
+static uint32_t checksum_bytes( uint32_t hash, const void *data, size_t size )
+{
+    const uint8_t *bytes = data;
+    for( size_t i = 0; i < size; ++i )
+    {
+        hash ^= bytes[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+uint32_t recorder_state_checksum( const struct SM64MarioState *state )
+{
+    uint32_t hash = 2166136261u;
+    hash = CHECKSUM_FIELD( hash, state->position );
+    hash = CHECKSUM_FIELD( hash, state->velocity );
+    hash = CHECKSUM_FIELD( hash, state->angleVel );
+    hash = CHECKSUM_FIELD( hash, state->faceAngle );
+    hash = CHECKSUM_FIELD( hash, state->pitchAngle );
+    hash = CHECKSUM_FIELD( hash, state->health );
+    hash = CHECKSUM_FIELD( hash, state->action );
+    hash = CHECKSUM_FIELD( hash, state->flags );
+    hash = CHECKSUM_FIELD( hash, state->particleFlags );
+    hash = CHECKSUM_FIELD( hash, state->invincTimer );
+    hash = CHECKSUM_FIELD( hash, state->burnTimer );
+    hash = CHECKSUM_FIELD( hash, state->fallDamage );
+    return hash;
+}
+
+static void record_surfaces( const struct SM64Surface *surfaces, uint32_t count )
+{
+    record_u32( count );
+    if( count > 0 )
+        record_bytes( surfaces, count * sizeof( struct SM64Surface ));
+}
+
+static void record_surface_object( const struct SM64SurfaceObject *surfaceObject )
+{
+    record_bytes( &surfaceObject->transform, sizeof( struct SM64ObjectTransform ));
+    record_surfaces( surfaceObject->surfaces, surfaceObject->surfaceCount );
+}
+
+static void record_inputs( const struct SM64MarioInputs *inputs )
+{
+    record_f32( inputs->camLookX );
+    record_f32( inputs->camLookZ );
+    record_f32( inputs->stickX );
+    record_f32( inputs->stickY );
+    uint8_t buttons[3] = { inputs->buttonA, inputs->buttonB, inputs->buttonZ };
+    record_bytes( buttons, sizeof( buttons ));
+}
+
+void recorder_log_setter( uint8_t type, const struct RecordedSetter *setter )
+{
+    if( !record_begin( type ))
+        return;
+
+    record_i32( setter->marioId );
+    record_bytes( setter->ints, sizeof( setter->ints ));
+    record_bytes( setter->floats, sizeof( setter->floats ));
+    record_end();
+}
+
+void recorder_log_level_init( uint32_t roomsCount )
+{
+    if( !record_begin( RECORD_LEVEL_INIT ))
+        return;
+
+    record_u32( roomsCount );
+    record_end();
+}
+
+void recorder_log_level_unload( void )
+{
+    if( !record_begin( RECORD_LEVEL_UNLOAD ))
+        return;
+
+    record_end();
+}
+
+void recorder_log_level_load_snapshot( const uint8_t *data, uint32_t size )
+{
+    if( !record_begin( RECORD_LEVEL_LOAD_SNAPSHOT ))
+        return;
+
+    // The whole file goes in the record, the replay can't count on it still being there.
+    record_u32( size );
+    record_bytes( data, size );
+    record_end();
+}
+
+void recorder_log_release_mesh_instances( void )
+{
+    if( !record_begin( RECORD_RELEASE_MESH_INSTANCES ))
+        return;
+
+    record_end();
+}
+
+void recorder_log_unsupported( const char *call )
+{
+    if( !record_begin( RECORD_UNSUPPORTED ))
+        return;
+
+    record_bytes( call, (uint32_t)strlen( call ));
+    record_end();
+
+    DEBUG_PRINT("%s can't be replayed, the recording is stopped", call);
+    recorder_stop();
+}
+
+void recorder_log_load_room( uint32_t roomId, const struct SM64Surface *staticSurfaces, uint32_t numSurfaces, const struct SM64SurfaceObject *staticObjects, uint32_t staticObjectsCount )
+{
+    if( !record_begin( RECORD_LOAD_ROOM ))
+        return;
+
+    record_u32( roomId );
+    record_surfaces( staticSurfaces, numSurfaces );
+    record_u32( staticObjectsCount );
+    for( uint32_t i = 0; i < staticObjectsCount; ++i )
+        record_surface_object( &staticObjects[i] );
+    record_end();
+}
+
+void recorder_log_unload_room( uint32_t roomId )
+{
+    if( !record_begin( RECORD_UNLOAD_ROOM ))
+        return;
+
+    record_u32( roomId );
+    record_end();
+}
+
+void recorder_log_rooms_switch( int switchedRooms[][2], int switchedRoomsCount )
+{
+    if( !record_begin( RECORD_ROOMS_SWITCH ))
+        return;
+
+    record_i32( switchedRoomsCount );
+    for( int i = 0; i < switchedRoomsCount; ++i )
+    {
+        record_i32( switchedRooms[i][0] );
+        record_i32( switchedRooms[i][1] );
+    }
+    record_end();
+}
+
+void recorder_log_surface_cleanup( const struct SM64SurfaceCleanupOptions *options )
+{
+    if( !record_begin( RECORD_SURFACE_CLEANUP ))
+        return;
+
+    uint8_t enabled = options != NULL;
+    record_bytes( &enabled, 1 );
+    if( options != NULL )
+    {
+        uint8_t flags[3] = { options->removeDegenerates, options->removeDuplicates, options->mergeCoplanarPairs };
+        record_i32( options->weldDistance );
+        record_bytes( flags, sizeof( flags ));
+    }
+    record_end();
+}
+
+void recorder_log_register_mesh( const struct SM64Surface *surfaces, uint32_t numSurfaces, uint32_t meshId )
+{
+    if( !record_begin( RECORD_REGISTER_MESH ))
+        return;
+
+    record_u32( meshId );
+    record_surfaces( surfaces, numSurfaces );
+    record_end();
+}
+
+void recorder_log_mesh_instances( uint32_t roomId, const struct SM64MeshInstance *instances, uint32_t instancesCount )
+{
+    if( !record_begin( RECORD_MESH_INSTANCES ))
+        return;
+
+    record_u32( roomId );
+    record_u32( instancesCount );
+    for( uint32_t i = 0; i < instancesCount; ++i )
+    {
+        record_u32( instances[i].meshId );
+        record_bytes( &instances[i].transform, sizeof( struct SM64ObjectTransform ));
+    }
+    record_end();
+}
+
+void recorder_log_loaded_rooms( int marioId, const int *loadedRooms, int loadedCount, const struct SM64Surface *clippers, uint32_t clippersCount )
+{
+    if( !record_begin( RECORD_LOADED_ROOMS ))
+        return;
+
+    record_i32( marioId );
+    record_i32( loadedCount );
+    for( int i = 0; i < loadedCount; ++i )
+        record_i32( loadedRooms[i] );
+    record_surfaces( clippers, clippersCount );
+    record_end();
+}
+
+void recorder_log_object_create( const struct SM64SurfaceObject *surfaceObject, uint32_t objectId )
+{
+    if( !record_begin( RECORD_OBJECT_CREATE ))
+        return;
+
+    record_u32( objectId );
+    record_surface_object( surfaceObject );
+    record_end();
+}
+
+void recorder_log_object_move( uint32_t objectId, const struct SM64ObjectTransform *transform )
+{
+    if( !record_begin( RECORD_OBJECT_MOVE ))
+        return;
+
+    record_u32( objectId );
+    record_bytes( transform, sizeof( struct SM64ObjectTransform ));
+    record_end();
+}
+
+void recorder_log_objects_move_batch( const uint32_t *objectIds, const struct SM64ObjectTransform *transforms, uint32_t count )
+{
+    if( !record_begin( RECORD_OBJECTS_MOVE_BATCH ))
+        return;
+
+    record_u32( count );
+    record_bytes( objectIds, count * sizeof( uint32_t ));
+    record_bytes( transforms, count * sizeof( struct SM64ObjectTransform ));
+    record_end();
+}
+
+void recorder_log_object_delete( uint32_t objectId )
+{
+    if( !record_begin( RECORD_OBJECT_DELETE ))
+        return;
+
+    record_u32( objectId );
+    record_end();
+}
+
+void recorder_log_mario_create( float x, float y, float z, int16_t rx, int16_t ry, int16_t rz, uint8_t fake, const int *loadedRooms, int loadedCount, int32_t marioId )
+{
+    if( !record_begin( RECORD_MARIO_CREATE ))
+        return;
+
+    int16_t angles[3] = { rx, ry, rz };
+    record_i32( marioId );
+    record_f32( x );
+    record_f32( y );
+    record_f32( z );
+    record_bytes( angles, sizeof( angles ));
+    record_bytes( &fake, 1 );
+    record_i32( loadedCount );
+    for( int i = 0; i < loadedCount; ++i )
+        record_i32( loadedRooms[i] );
+    record_end();
+}
+
+void recorder_log_mario_clone( int32_t templateId, float x, float y, float z, int16_t rx, int16_t ry, int16_t rz, const int *loadedRooms, int loadedCount, int32_t marioId )
+{
+    if( !record_begin( RECORD_MARIO_CLONE ))
+        return;
+
+    int16_t angles[3] = { rx, ry, rz };
+    record_i32( marioId );
+    record_i32( templateId );
+    record_f32( x );
+    record_f32( y );
+    record_f32( z );
+    record_bytes( angles, sizeof( angles ));
+    record_i32( loadedCount );
+    for( int i = 0; i < loadedCount; ++i )
+        record_i32( loadedRooms[i] );
+    record_end();
+}
+
+void recorder_log_mario_fork( int32_t marioId, int32_t forkId )
+{
+    if( !record_begin( RECORD_MARIO_FORK ))
+        return;
+
+    record_i32( forkId );
+    record_i32( marioId );
+    record_end();
+}
+
+void recorder_log_mario_delete( int32_t marioId )
+{
+    if( !record_begin( RECORD_MARIO_DELETE ))
+        return;
+
+    record_i32( marioId );
+    record_end();
+}
+
+void recorder_log_mario_tick( int32_t marioId, const struct SM64MarioInputs *inputs, const struct SM64MarioState *outState, bool geometry )
+{
+    if( !record_begin( RECORD_MARIO_TICK ))
+        return;
+
+    uint8_t flag = geometry;
+    record_i32( marioId );
+    record_inputs( inputs );
+    record_bytes( &flag, 1 );
+    record_u32( recorder_state_checksum( outState ));
+    record_end();
+}
+
+void recorder_log_mario_tick_batch( const int32_t *marioIds, const struct SM64MarioInputs *inputs, const struct SM64MarioState *outStates, uint32_t count, bool geometry )
+{
+    if( !record_begin( RECORD_MARIO_TICK_BATCH ))
+        return;
+
+    uint8_t flag = geometry;
+    record_u32( count );
+    record_bytes( &flag, 1 );
+    for( uint32_t i = 0; i < count; ++i )
+    {
+        record_i32( marioIds[i] );
+        record_inputs( &inputs[i] );
+        record_u32( recorder_state_checksum( &outStates[i] ));
+    }
+    record_end();
+}
+
+void recorder_log_mario_anim_tick( int32_t marioId, uint32_t stateFlags, const struct SM64AnimInfo *animInfo, const int16_t rot[3], bool geometry )
+{
+    if( !record_begin( RECORD_MARIO_ANIM_TICK ))
+        return;
+
+    uint8_t flag = geometry;
+    int16_t values[4] = { animInfo->animID, rot[0], rot[1], rot[2] };
+    record_i32( marioId );
+    record_u32( stateFlags );
+    record_i32( animInfo->animAccel );
+    record_bytes( values, sizeof( values ));
+    record_bytes( &flag, 1 );
+    record_end();
+}
+
+void recorder_log_mario_load_state( int32_t marioId, const uint8_t *buffer, uint32_t size )
+{
+    if( !record_begin( RECORD_MARIO_LOAD_STATE ))
+        return;
+
+    record_i32( marioId );
+    record_u32( size );
+    record_bytes( buffer, size );
+    record_end();
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "libsm64.h"
+
+#define RECORDING_MAGIC 0x43455253 // "SREC"
+#define RECORDING_VERSION 1
+
+// Every record is the type as one byte, the payload size as an uint32_t and the payload.
+// Values are stored with the byte order and float format of the recording machine.
+enum RecordType
+{
+    RECORD_LEVEL_INIT = 1,
+    RECORD_LEVEL_UNLOAD,
+    RECORD_LOAD_ROOM,
+    RECORD_UNLOAD_ROOM,
+    RECORD_ROOMS_SWITCH,
+    RECORD_SURFACE_CLEANUP,
+    RECORD_REGISTER_MESH,
+    RECORD_MESH_INSTANCES,
+    RECORD_LOADED_ROOMS,
+    RECORD_OBJECT_CREATE,
+    RECORD_OBJECT_MOVE,
+    RECORD_OBJECTS_MOVE_BATCH,
+    RECORD_OBJECT_DELETE,
+    RECORD_MARIO_CREATE,
+    RECORD_MARIO_DELETE,
+    RECORD_MARIO_TICK,
+    RECORD_MARIO_TICK_BATCH,
+    RECORD_MARIO_ANIM_TICK,
+    RECORD_MARIO_LOAD_STATE,
+
+    // Setters, their payload is a RecordedSetter.
+    RECORD_SET_POSITION,
+    RECORD_ADD_POSITION,
+    RECORD_SET_ANGLE,
+    RECORD_SET_FACEANGLE,
+    RECORD_SET_VELOCITY,
+    RECORD_SET_FORWARD_VELOCITY,
+    RECORD_SET_ACTION,
+    RECORD_SET_ACTION_ARG,
+    RECORD_SET_ANIMATION,
+    RECORD_SET_ANIM_FRAME,
+    RECORD_SET_STATE,
+    RECORD_SET_WATER_LEVEL,
+    RECORD_SET_FLOOR_OVERRIDE,
+    RECORD_TAKE_DAMAGE,
+    RECORD_HEAL,
+    RECORD_SET_HEALTH,
+    RECORD_KILL,
+    RECORD_INTERACT_CAP,
+    RECORD_ATTACK,
+    RECORD_SET_TANK_MODE,
+
+    // Added after the first recordings, kept last so the earlier types keep their values.
+    RECORD_MARIO_CLONE,
+    RECORD_MARIO_FORK,
+    RECORD_LEVEL_LOAD_SNAPSHOT,
+    RECORD_RELEASE_MESH_INSTANCES,
+    // Written for a call the replay can't reproduce, the recording stops right after it.
+    RECORD_UNSUPPORTED,
+};
+
+struct RecordedSetter
+{
+    int32_t marioId;
+    uint32_t ints[3];
+    float floats[4];
+};
+
+extern bool recorder_start( const char *path );
+extern void recorder_stop( void );
+extern bool recorder_active( void );
+
+/**
+ * @brief Hashes the fields of a tick output, the replay compares it to catch diverging simulations.
+ */
+extern uint32_t recorder_state_checksum( const struct SM64MarioState *state );
+
+extern void recorder_log_setter( uint8_t type, const struct RecordedSetter *setter );
+extern void recorder_log_level_init( uint32_t roomsCount );
+extern void recorder_log_level_unload( void );
+extern void recorder_log_level_load_snapshot( const uint8_t *data, uint32_t size );
+extern void recorder_log_release_mesh_instances( void );
+/**
+ * @brief Ends the recording with a record naming the call it can't reproduce, replaying it then fails there.
+ */
+extern void recorder_log_unsupported( const char *call );
+extern void recorder_log_load_room( uint32_t roomId, const struct SM64Surface *staticSurfaces, uint32_t numSurfaces, const struct SM64SurfaceObject *staticObjects, uint32_t staticObjectsCount );
+extern void recorder_log_unload_room( uint32_t roomId );
+extern void recorder_log_rooms_switch( int switchedRooms[][2], int switchedRoomsCount );
+extern void recorder_log_surface_cleanup( const struct SM64SurfaceCleanupOptions *options );
+extern void recorder_log_register_mesh( const struct SM64Surface *surfaces, uint32_t numSurfaces, uint32_t meshId );
+extern void recorder_log_mesh_instances( uint32_t roomId, const struct SM64MeshInstance *instances, uint32_t instancesCount );
+extern void recorder_log_loaded_rooms( int marioId, const int *loadedRooms, int loadedCount, const struct SM64Surface *clippers, uint32_t clippersCount );
+extern void recorder_log_object_create( const struct SM64SurfaceObject *surfaceObject, uint32_t objectId );
+extern void recorder_log_object_move( uint32_t objectId, const struct SM64ObjectTransform *transform );
+extern void recorder_log_objects_move_batch( const uint32_t *objectIds, const struct SM64ObjectTransform *transforms, uint32_t count );
+extern void recorder_log_object_delete( uint32_t objectId );
+extern void recorder_log_mario_create( float x, float y, float z, int16_t rx, int16_t ry, int16_t rz, uint8_t fake, const int *loadedRooms, int loadedCount, int32_t marioId );
+extern void recorder_log_mario_clone( int32_t templateId, float x, float y, float z, int16_t rx, int16_t ry, int16_t rz, const int *loadedRooms, int loadedCount, int32_t marioId );
+extern void recorder_log_mario_fork( int32_t marioId, int32_t forkId );
+extern void recorder_log_mario_delete( int32_t marioId );
+extern void recorder_log_mario_tick( int32_t marioId, const struct SM64MarioInputs *inputs, const struct SM64MarioState *outState, bool geometry );
+extern void recorder_log_mario_tick_batch( const int32_t *marioIds, const struct SM64MarioInputs *inputs, const struct SM64MarioState *outStates, uint32_t count, bool geometry );
+extern void recorder_log_mario_anim_tick( int32_t marioId, uint32_t stateFlags, const struct SM64AnimInfo *animInfo, const int16_t rot[3], bool geometry );
+extern void recorder_log_mario_load_state( int32_t marioId, const uint8_t *buffer, uint32_t size );
+
+#define RECORD_SETTER( type, marioId, i0, i1, i2, f0, f1, f2, f3 ) \
+    do { \
+        if( recorder_active() ) \
+        { \
+            struct RecordedSetter recordedSetter = { (marioId), { (uint32_t)(i0), (uint32_t)(i1), (uint32_t)(i2) }, { (f0), (f1), (f2), (f3) } }; \
+            recorder_log_setter( (type), &recordedSetter ); \
+        } \
+    } while( 0 )
+
+/**
+ * @brief Runs every call of a recording through the library as fast as possible.
+ */
+extern bool replay_run( const char *path, uint32_t flags, struct SM64ReplayStats *outStats );
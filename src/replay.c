@@ -0,0 +1,630 @@
+// Before any system header, libsm64.h sets _XOPEN_SOURCE
+#include "debug_print.h"
+#include "recorder.h"
+#include "load_surfaces.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+struct ReplayReader
+{
+    const uint8_t *data;
+    uint32_t size;
+    uint32_t cursor;
+    bool ok;
+};
+
+static const void *read_bytes( struct ReplayReader *reader, uint32_t size )
+{
+    if( !reader->ok || size > reader->size - reader->cursor )
+    {
+        reader->ok = false;
+        return NULL;
+    }
+
+    const void *result = reader->data + reader->cursor;
+    reader->cursor += size;
+    return result;
+}
+
+static void read_into( struct ReplayReader *reader, void *dst, uint32_t size )
+{
+    const void *src = read_bytes( reader, size );
+    if( src != NULL )
+        memcpy( dst, src, size );
+    else
+        memset( dst, 0, size );
+}
+
+static uint32_t read_u32( struct ReplayReader *reader ) { uint32_t v; read_into( reader, &v, sizeof( v )); return v; }
+static int32_t read_i32( struct ReplayReader *reader ) { int32_t v; read_into( reader, &v, sizeof( v )); return v; }
+static float read_f32( struct ReplayReader *reader ) { float v; read_into( reader, &v, sizeof( v )); return v; }
+static uint8_t read_u8( struct ReplayReader *reader ) { uint8_t v; read_into( reader, &v, sizeof( v )); return v; }
+
+/**
+ * Copies an array out of the file so it is aligned for its type, the caller frees it.
+ */
+static void *read_array( struct ReplayReader *reader, uint32_t count, uint32_t elementSize )
+{
+    if( count > ( reader->size - reader->cursor ) / elementSize )
+    {
+        reader->ok = false;
+        return NULL;
+    }
+
+    void *result = malloc( (size_t)count * elementSize + 1 );
+    if( result == NULL )
+    {
+        reader->ok = false;
+        return NULL;
+    }
+    read_into( reader, result, count * elementSize );
+    return result;
+}
+
+static struct SM64Surface *read_surfaces( struct ReplayReader *reader, uint32_t *outCount )
+{
+    *outCount = read_u32( reader );
+    return read_array( reader, *outCount, sizeof( struct SM64Surface ));
+}
+
+static void read_surface_object( struct ReplayReader *reader, struct SM64SurfaceObject *outObject )
+{
+    read_into( reader, &outObject->transform, sizeof( struct SM64ObjectTransform ));
+    outObject->surfaces = read_surfaces( reader, &outObject->surfaceCount );
+}
+
+static void read_inputs( struct ReplayReader *reader, struct SM64MarioInputs *outInputs )
+{
+    outInputs->camLookX = read_f32( reader );
+    outInputs->camLookZ = read_f32( reader );
+    outInputs->stickX = read_f32( reader );
+    outInputs->stickY = read_f32( reader );
+    outInputs->buttonA = read_u8( reader );
+    outInputs->buttonB = read_u8( reader );
+    outInputs->buttonZ = read_u8( reader );
+}
+
+// Ids handed out during the replay can differ from the recorded ones, calls are translated through this map.
+struct ReplayIdMap
+{
+    uint32_t *recorded;
+    uint32_t *live;
+    uint32_t count;
+};
+
+// Returns false when out of memory, the map is left as it was.
+static bool id_map_set( struct ReplayIdMap *map, uint32_t recorded, uint32_t live )
+{
+    for( uint32_t i = 0; i < map->count; ++i )
+    {
+        if( map->recorded[i] == recorded )
+        {
+            map->live[i] = live;
+            return true;
+        }
+    }
+
+    // Each array is only replaced once it grew, a failure leaves a larger but still valid block behind.
+    uint32_t *recordedIds = realloc( map->recorded, ( map->count + 1 ) * sizeof( uint32_t ));
+    if( recordedIds == NULL )
+        return false;
+    map->recorded = recordedIds;
+
+    uint32_t *liveIds = realloc( map->live, ( map->count + 1 ) * sizeof( uint32_t ));
+    if( liveIds == NULL )
+        return false;
+    map->live = liveIds;
+
+    map->recorded[map->count] = recorded;
+    map->live[map->count] = live;
+    map->count++;
+    return true;
+}
+
+static uint32_t id_map_get( const struct ReplayIdMap *map, uint32_t recorded )
+{
+    for( uint32_t i = 0; i < map->count; ++i )
+    {
+        if( map->recorded[i] == recorded )
+            return map->live[i];
+    }
+
+    // Unknown ids were already invalid when recorded, passing them on keeps the call a no-op.
+    return recorded;
+}
+
+static void id_map_free( struct ReplayIdMap *map )
+{
+    free( map->recorded );
+    free( map->live );
+    memset( map, 0, sizeof( struct ReplayIdMap ));
+}
+
+struct Replay
+{
+    uint32_t flags;
+    struct SM64ReplayStats *stats;
+    struct ReplayIdMap marios;
+    struct ReplayIdMap objects;
+    struct ReplayIdMap meshes;
+
+    // Geometry output of the replayed ticks, one set of buffers per Mario of the largest batch.
+    struct SM64MarioGeometryBuffers *buffers;
+    uint32_t buffersCount;
+
+    // Set when an id couldn't be mapped, every later call on it would go to the wrong object so the replay stops.
+    bool failed;
+};
+
+static void replay_map_id( struct Replay *replay, struct ReplayIdMap *map, uint32_t recorded, uint32_t live )
+{
+    if( !id_map_set( map, recorded, live ))
+    {
+        DEBUG_PRINT("Out of memory mapping the replay ids, the replay is stopped");
+        replay->failed = true;
+    }
+}
+
+static struct SM64MarioGeometryBuffers *replay_buffers( struct Replay *replay, bool recorded, uint32_t count )
+{
+    if( !recorded || ( replay->flags & SM64_REPLAY_SKIP_GEOMETRY ))
+        return NULL;
+
+    if( count > replay->buffersCount )
+    {
+        // Without buffers the Marios tick physics only, which doesn't change their state.
+        struct SM64MarioGeometryBuffers *buffers = realloc( replay->buffers, count * sizeof( struct SM64MarioGeometryBuffers ));
+        if( buffers == NULL )
+            return NULL;
+        replay->buffers = buffers;
+        for( uint32_t i = replay->buffersCount; i < count; ++i )
+        {
+            replay->buffers[i].position = malloc( sizeof( float ) * 9 * SM64_GEO_MAX_TRIANGLES );
+            replay->buffers[i].normal = malloc( sizeof( float ) * 9 * SM64_GEO_MAX_TRIANGLES );
+            replay->buffers[i].color = malloc( sizeof( float ) * 9 * SM64_GEO_MAX_TRIANGLES );
+            replay->buffers[i].uv = malloc( sizeof( float ) * 6 * SM64_GEO_MAX_TRIANGLES );
+            replay->buffers[i].numTrianglesUsed = 0;
+        }
+        replay->buffersCount = count;
+    }
+
+    return replay->buffers;
+}
+
+static void replay_check_state( struct Replay *replay, const struct SM64MarioState *state, uint32_t checksum )
+{
+    if(( replay->flags & SM64_REPLAY_CHECK_STATES ) && recorder_state_checksum( state ) != checksum )
+    {
+        if( replay->stats->mismatches == 0 )
+            replay->stats->firstMismatchTick = replay->stats->ticks;
+        replay->stats->mismatches++;
+    }
+    replay->stats->ticks++;
+}
+
+static void replay_setter( struct Replay *replay, uint8_t type, struct ReplayReader *reader )
+{
+    struct RecordedSetter s;
+    s.marioId = (int32_t)id_map_get( &replay->marios, (uint32_t)read_i32( reader ));
+    read_into( reader, s.ints, sizeof( s.ints ));
+    read_into( reader, s.floats, sizeof( s.floats ));
+    if( !reader->ok )
+        return;
+
+    switch( type )
+    {
+        case RECORD_SET_POSITION:         sm64_set_mario_position( s.marioId, s.floats[0], s.floats[1], s.floats[2] ); break;
+        case RECORD_ADD_POSITION:         sm64_add_mario_position( s.marioId, s.floats[0], s.floats[1], s.floats[2] ); break;
+        case RECORD_SET_ANGLE:            sm64_set_mario_angle( s.marioId, (int16_t)s.ints[0], (int16_t)s.ints[1], (int16_t)s.ints[2] ); break;
+        case RECORD_SET_FACEANGLE:        sm64_set_mario_faceangle( s.marioId, (int16_t)s.ints[0] ); break;
+        case RECORD_SET_VELOCITY:         sm64_set_mario_velocity( s.marioId, s.floats[0], s.floats[1], s.floats[2] ); break;
+        case RECORD_SET_FORWARD_VELOCITY: sm64_set_mario_forward_velocity( s.marioId, s.floats[0] ); break;
+        case RECORD_SET_ACTION:           sm64_set_mario_action( s.marioId, s.ints[0] ); break;
+        case RECORD_SET_ACTION_ARG:       sm64_set_mario_action_arg( s.marioId, s.ints[0], s.ints[1] ); break;
+        case RECORD_SET_ANIMATION:        sm64_set_mario_animation( s.marioId, (int32_t)s.ints[0] ); break;
+        case RECORD_SET_ANIM_FRAME:       sm64_set_mario_anim_frame( s.marioId, (int16_t)s.ints[0] ); break;
+        case RECORD_SET_STATE:            sm64_set_mario_state( s.marioId, s.ints[0] ); break;
+        case RECORD_SET_WATER_LEVEL:      sm64_set_mario_water_level( s.marioId, (signed int)s.ints[0] ); break;
+        case RECORD_SET_FLOOR_OVERRIDE:   sm64_set_mario_floor_override( s.marioId, (uint16_t)s.ints[0], (int16_t)s.ints[1] ); break;
+        case RECORD_TAKE_DAMAGE:          sm64_mario_take_damage( s.marioId, s.ints[0], s.ints[1], s.floats[0], s.floats[1], s.floats[2] ); break;
+        case RECORD_HEAL:                 sm64_mario_heal( s.marioId, (uint8_t)s.ints[0] ); break;
+        case RECORD_SET_HEALTH:           sm64_mario_set_health( s.marioId, (uint16_t)s.ints[0] ); break;
+        case RECORD_KILL:                 sm64_mario_kill( s.marioId ); break;
+        case RECORD_INTERACT_CAP:         sm64_mario_interact_cap( s.marioId, s.ints[0], (uint16_t)s.ints[1], (uint8_t)s.ints[2] ); break;
+        case RECORD_ATTACK:               sm64_mario_attack( s.marioId, s.floats[0], s.floats[1], s.floats[2], s.floats[3] ); break;
+        case RECORD_SET_TANK_MODE:        sm64_set_mario_tank_mode( s.marioId, s.ints[0] != 0 ); break;
+    }
+}
+
+static void replay_record( struct Replay *replay, uint8_t type, struct ReplayReader *reader )
+{
+    switch( type )
+    {
+        case RECORD_LEVEL_INIT:
+            sm64_level_init( read_u32( reader ));
+            break;
+
+        case RECORD_LEVEL_UNLOAD:
+            sm64_level_unload();
+            id_map_free( &replay->objects );
+            id_map_free( &replay->meshes );
+            break;
+
+        case RECORD_LEVEL_LOAD_SNAPSHOT:
+        {
+            uint32_t size = read_u32( reader );
+            const uint8_t *data = read_bytes( reader, size );
+            if( reader->ok )
+                level_load_snapshot_data( data, size );
+            // The snapshot keeps the ids it was saved with, they are the same in the recording and here.
+            id_map_free( &replay->objects );
+            id_map_free( &replay->meshes );
+            break;
+        }
+
+        case RECORD_RELEASE_MESH_INSTANCES:
+            sm64_level_release_mesh_instances();
+            break;
+
+        case RECORD_UNSUPPORTED:
+            DEBUG_PRINT("The recording stopped at %.*s which can't be replayed", (int)( reader->size < 64 ? reader->size : 64 ), (const char*)reader->data);
+            replay->failed = true;
+            break;
+
+        case RECORD_LOAD_ROOM:
+        {
+            uint32_t roomId = read_u32( reader );
+            uint32_t surfacesCount;
+            struct SM64Surface *surfaces = read_surfaces( reader, &surfacesCount );
+            uint32_t objectsCount = read_u32( reader );
+            if( objectsCount > reader->size - reader->cursor )
+                reader->ok = false;
+            if( !reader->ok )
+                objectsCount = 0;
+
+            struct SM64SurfaceObject *objects = calloc( objectsCount + 1, sizeof( struct SM64SurfaceObject ));
+            for( uint32_t i = 0; reader->ok && i < objectsCount; ++i )
+                read_surface_object( reader, &objects[i] );
+
+            if( reader->ok )
+                sm64_level_load_room( roomId, surfaces, surfacesCount, objects, objectsCount );
+
+            for( uint32_t i = 0; i < objectsCount; ++i )
+                free( objects[i].surfaces );
+            free( objects );
+            free( surfaces );
+            break;
+        }
+
+        case RECORD_UNLOAD_ROOM:
+            sm64_level_unload_room( read_u32( reader ));
+            break;
+
+        case RECORD_ROOMS_SWITCH:
+        {
+            int32_t count = read_i32( reader );
+            int (*switched)[2] = count > 0 ? read_array( reader, (uint32_t)count, sizeof( int[2] )) : NULL;
+            if( reader->ok )
+                sm64_level_rooms_switch( switched, count );
+            free( switched );
+            break;
+        }
+
+        case RECORD_SURFACE_CLEANUP:
+            if( read_u8( reader ))
+            {
+                struct SM64SurfaceCleanupOptions options;
+                options.weldDistance = read_i32( reader );
+                options.removeDegenerates = read_u8( reader );
+                options.removeDuplicates = read_u8( reader );
+                options.mergeCoplanarPairs = read_u8( reader );
+                sm64_level_set_surface_cleanup( &options );
+            }
+            else
+            {
+                sm64_level_set_surface_cleanup( NULL );
+            }
+            break;
+
+        case RECORD_REGISTER_MESH:
+        {
+            uint32_t meshId = read_u32( reader );
+            uint32_t count;
+            struct SM64Surface *surfaces = read_surfaces( reader, &count );
+            if( reader->ok )
+                replay_map_id( replay, &replay->meshes, meshId, sm64_level_register_mesh( surfaces, count ));
+            free( surfaces );
+            break;
+        }
+
+        case RECORD_MESH_INSTANCES:
+        {
+            uint32_t roomId = read_u32( reader );
+            uint32_t count = read_u32( reader );
+            struct SM64MeshInstance *instances = calloc( count + 1, sizeof( struct SM64MeshInstance ));
+            for( uint32_t i = 0; reader->ok && i < count; ++i )
+            {
+                instances[i].meshId = id_map_get( &replay->meshes, read_u32( reader ));
+                read_into( reader, &instances[i].transform, sizeof( struct SM64ObjectTransform ));
+            }
+            if( reader->ok )
+                sm64_level_load_room_mesh_instances( roomId, instances, count );
+            free( instances );
+            break;
+        }
+
+        case RECORD_LOADED_ROOMS:
+        {
+            int32_t marioId = (int32_t)id_map_get( &replay->marios, (uint32_t)read_i32( reader ));
+            int32_t roomsCount = read_i32( reader );
+            int *rooms = roomsCount > 0 ? read_array( reader, (uint32_t)roomsCount, sizeof( int )) : NULL;
+            uint32_t clippersCount;
+            struct SM64Surface *clippers = read_surfaces( reader, &clippersCount );
+            if( reader->ok && clippersCount <= MAX_CLIPPER_BLOCKS_FACES )
+                sm64_level_update_player_loaded_Rooms_with_clippers( marioId, rooms, roomsCount, clippers, clippersCount );
+            free( rooms );
+            free( clippers );
+            break;
+        }
+
+        case RECORD_OBJECT_CREATE:
+        {
+            uint32_t objectId = read_u32( reader );
+            struct SM64SurfaceObject object;
+            read_surface_object( reader, &object );
+            if( reader->ok )
+                replay_map_id( replay, &replay->objects, objectId, sm64_surface_object_create( &object ));
+            free( object.surfaces );
+            break;
+        }
+
+        case RECORD_OBJECT_MOVE:
+        {
+            uint32_t objectId = id_map_get( &replay->objects, read_u32( reader ));
+            struct SM64ObjectTransform transform;
+            read_into( reader, &transform, sizeof( struct SM64ObjectTransform ));
+            if( reader->ok )
+                sm64_surface_object_move( objectId, &transform );
+            break;
+        }
+
+        case RECORD_OBJECTS_MOVE_BATCH:
+        {
+            uint32_t count = read_u32( reader );
+            uint32_t *ids = read_array( reader, count, sizeof( uint32_t ));
+            struct SM64ObjectTransform *transforms = read_array( reader, count, sizeof( struct SM64ObjectTransform ));
+            for( uint32_t i = 0; reader->ok && i < count; ++i )
+                ids[i] = id_map_get( &replay->objects, ids[i] );
+            if( reader->ok )
+                sm64_surface_objects_move_batch( ids, transforms, count );
+            free( ids );
+            free( transforms );
+            break;
+        }
+
+        case RECORD_OBJECT_DELETE:
+            sm64_surface_object_delete( id_map_get( &replay->objects, read_u32( reader )));
+            break;
+
+        case RECORD_MARIO_CREATE:
+        {
+            int32_t marioId = read_i32( reader );
+            float x = read_f32( reader );
+            float y = read_f32( reader );
+            float z = read_f32( reader );
+            int16_t angles[3];
+            read_into( reader, angles, sizeof( angles ));
+            uint8_t fake = read_u8( reader );
+            int32_t roomsCount = read_i32( reader );
+            int *rooms = roomsCount > 0 ? read_array( reader, (uint32_t)roomsCount, sizeof( int )) : NULL;
+            if( reader->ok )
+                replay_map_id( replay, &replay->marios, (uint32_t)marioId, (uint32_t)sm64_mario_create( x, y, z, angles[0], angles[1], angles[2], fake, rooms, roomsCount ));
+            free( rooms );
+            break;
+        }
+
+        case RECORD_MARIO_CLONE:
+        {
+            int32_t marioId = read_i32( reader );
+            int32_t templateId = (int32_t)id_map_get( &replay->marios, (uint32_t)read_i32( reader ));
+            float x = read_f32( reader );
+            float y = read_f32( reader );
+            float z = read_f32( reader );
+            int16_t angles[3];
+            read_into( reader, angles, sizeof( angles ));
+            int32_t roomsCount = read_i32( reader );
+            int *rooms = roomsCount > 0 ? read_array( reader, (uint32_t)roomsCount, sizeof( int )) : NULL;
+            if( reader->ok )
+                replay_map_id( replay, &replay->marios, (uint32_t)marioId, (uint32_t)sm64_mario_clone( templateId, x, y, z, angles[0], angles[1], angles[2], rooms, roomsCount ));
+            free( rooms );
+            break;
+        }
+
+        case RECORD_MARIO_FORK:
+        {
+            int32_t forkId = read_i32( reader );
+            int32_t marioId = (int32_t)id_map_get( &replay->marios, (uint32_t)read_i32( reader ));
+            if( reader->ok )
+                replay_map_id( replay, &replay->marios, (uint32_t)forkId, (uint32_t)sm64_mario_fork( marioId ));
+            break;
+        }
+
+        case RECORD_MARIO_DELETE:
+            sm64_mario_delete( (int32_t)id_map_get( &replay->marios, (uint32_t)read_i32( reader )));
+            break;
+
+        case RECORD_MARIO_TICK:
+        {
+            int32_t marioId = (int32_t)id_map_get( &replay->marios, (uint32_t)read_i32( reader ));
+            struct SM64MarioInputs inputs;
+            read_inputs( reader, &inputs );
+            bool geometry = read_u8( reader );
+            uint32_t checksum = read_u32( reader );
+            if( !reader->ok )
+                break;
+
+            struct SM64MarioState state;
+            memset( &state, 0, sizeof( struct SM64MarioState ));
+            sm64_mario_tick( marioId, &inputs, &state, replay_buffers( replay, geometry, 1 ));
+            replay_check_state( replay, &state, checksum );
+            break;
+        }
+
+        case RECORD_MARIO_TICK_BATCH:
+        {
+            uint32_t count = read_u32( reader );
+            bool geometry = read_u8( reader );
+            if( count > reader->size - reader->cursor )
+            {
+                reader->ok = false;
+                break;
+            }
+
+            int32_t *ids = malloc( sizeof( int32_t ) * ( count + 1 ));
+            struct SM64MarioInputs *inputs = malloc( sizeof( struct SM64MarioInputs ) * ( count + 1 ));
+            uint32_t *checksums = malloc( sizeof( uint32_t ) * ( count + 1 ));
+            struct SM64MarioState *states = calloc( count + 1, sizeof( struct SM64MarioState ));
+            for( uint32_t i = 0; reader->ok && i < count; ++i )
+            {
+                ids[i] = (int32_t)id_map_get( &replay->marios, (uint32_t)read_i32( reader ));
+                read_inputs( reader, &inputs[i] );
+                checksums[i] = read_u32( reader );
+            }
+
+            if( reader->ok )
+            {
+                sm64_mario_tick_batch( ids, inputs, states, replay_buffers( replay, geometry, count ), count );
+                for( uint32_t i = 0; i < count; ++i )
+                    replay_check_state( replay, &states[i], checksums[i] );
+            }
+
+            free( ids );
+            free( inputs );
+            free( checksums );
+            free( states );
+            break;
+        }
+
+        case RECORD_MARIO_ANIM_TICK:
+        {
+            int32_t marioId = (int32_t)id_map_get( &replay->marios, (uint32_t)read_i32( reader ));
+            uint32_t stateFlags = read_u32( reader );
+            struct SM64AnimInfo animInfo;
+            memset( &animInfo, 0, sizeof( struct SM64AnimInfo ));
+            animInfo.animAccel = read_i32( reader );
+            int16_t values[4];
+            read_into( reader, values, sizeof( values ));
+            bool geometry = read_u8( reader );
+            animInfo.animID = values[0];
+            if( reader->ok )
+                sm64_mario_anim_tick( marioId, stateFlags, &animInfo, replay_buffers( replay, geometry, 1 ), &values[1] );
+            break;
+        }
+
+        case RECORD_MARIO_LOAD_STATE:
+        {
+            int32_t marioId = (int32_t)id_map_get( &replay->marios, (uint32_t)read_i32( reader ));
+            uint32_t size = read_u32( reader );
+            const void *data = read_bytes( reader, size );
+            if( reader->ok && size <= SM64_MARIO_STATE_SIZE )
+            {
+                uint8_t *buffer = calloc( 1, SM64_MARIO_STATE_SIZE );
+                memcpy( buffer, data, size );
+                sm64_mario_load_state( marioId, buffer );
+                free( buffer );
+            }
+            break;
+        }
+
+        default:
+            replay_setter( replay, type, reader );
+            break;
+    }
+}
+
+static double replay_seconds( void )
+{
+    struct timeval tv;
+    gettimeofday( &tv, NULL );
+    return (double)tv.tv_sec + (double)tv.tv_usec / 1000000.0;
+}
+
+bool replay_run( const char *path, uint32_t flags, struct SM64ReplayStats *outStats )
+{
+    if( recorder_active() )
+    {
+        DEBUG_PRINT("Cannot replay %s while recording", path);
+        return false;
+    }
+
+    FILE *file = fopen( path, "rb" );
+    if( file == NULL )
+    {
+        DEBUG_PRINT("Failed opening recording file %s", path);
+        return false;
+    }
+
+    fseek( file, 0, SEEK_END );
+    long fileSize = ftell( file );
+    fseek( file, 0, SEEK_SET );
+
+    uint8_t *data = malloc( fileSize > 0 ? (size_t)fileSize : 1 );
+    bool readOk = data != NULL && fileSize > 0 && fread( data, 1, (size_t)fileSize, file ) == (size_t)fileSize;
+    fclose( file );
+
+    struct ReplayReader reader = { data, readOk ? (uint32_t)fileSize : 0, 0, readOk };
+    if( read_u32( &reader ) != RECORDING_MAGIC || read_u32( &reader ) != RECORDING_VERSION )
+    {
+        DEBUG_PRINT("%s is not a recording made by this version of libsm64", path);
+        free( data );
+        return false;
+    }
+
+    struct SM64ReplayStats stats;
+    memset( &stats, 0, sizeof( struct SM64ReplayStats ));
+    stats.firstMismatchTick = UINT32_MAX;
+
+    struct Replay replay;
+    memset( &replay, 0, sizeof( struct Replay ));
+    replay.flags = flags;
+    replay.stats = &stats;
+
+    double start = replay_seconds();
+    while( reader.ok && !replay.failed && reader.cursor < reader.size )
+    {
+        uint8_t type = read_u8( &reader );
+        uint32_t payloadSize = read_u32( &reader );
+        const uint8_t *payload = read_bytes( &reader, payloadSize );
+        if( !reader.ok )
+            break;
+
+        // Each record is read on its own, so a record of an unknown type or a short payload can't desync the others.
+        struct ReplayReader recordReader = { payload, payloadSize, 0, true };
+        replay_record( &replay, type, &recordReader );
+        stats.records++;
+    }
+    stats.seconds = replay_seconds() - start;
+
+    for( uint32_t i = 0; i < replay.buffersCount; ++i )
+    {
+        free( replay.buffers[i].position );
+        free( replay.buffers[i].normal );
+        free( replay.buffers[i].color );
+        free( replay.buffers[i].uv );
+    }
+    free( replay.buffers );
+    id_map_free( &replay.marios );
+    id_map_free( &replay.objects );
+    id_map_free( &replay.meshes );
+    free( data );
+
+    if( outStats != NULL )
+        *outStats = stats;
+
+    if( !reader.ok )
+        DEBUG_PRINT("Recording %s is truncated, replayed %u records", path, stats.records);
+    return reader.ok && !replay.failed;
+}
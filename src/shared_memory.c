@@ -0,0 +1,192 @@
+#include "shared_memory.h"
+
+#include <string.h>
+
+#include "debug_print.h"
+
+// The name is kept so the owner can remove it on close, a truncated copy would unlink some other region.
+static bool shared_memory_name_fits( const char *name )
+{
+    if( strlen( name ) >= sizeof( ((struct SharedMemory*)NULL)->name ))
+    {
+        DEBUG_PRINT("Shared memory name %s is too long", name);
+        return false;
+    }
+    return true;
+}
+
+#ifdef _WIN32
+
+#include <windows.h>
+
+bool shared_memory_create( struct SharedMemory *shm, const char *name, size_t size )
+{
+    memset( shm, 0, sizeof( struct SharedMemory ));
+    if( !shared_memory_name_fits( name ))
+    {
+        return false;
+    }
+
+    HANDLE mapping = CreateFileMappingA( INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, (DWORD)((uint64_t)size >> 32), (DWORD)size, name );
+    if( mapping == NULL )
+    {
+        DEBUG_PRINT("Failed to create shared memory %s", name);
+        return false;
+    }
+    if( GetLastError() == ERROR_ALREADY_EXISTS )
+    {
+        DEBUG_PRINT("Shared memory %s already exists", name);
+        CloseHandle( mapping );
+        return false;
+    }
+
+    shm->data = MapViewOfFile( mapping, FILE_MAP_WRITE, 0, 0, size );
+    if( shm->data == NULL )
+    {
+        CloseHandle( mapping );
+        return false;
+    }
+
+    shm->size = size;
+    shm->owner = true;
+    shm->handle = mapping;
+    strcpy( shm->name, name );
+    return true;
+}
+
+bool shared_memory_open( struct SharedMemory *shm, const char *name )
+{
+    memset( shm, 0, sizeof( struct SharedMemory ));
+    if( !shared_memory_name_fits( name ))
+    {
+        return false;
+    }
+
+    HANDLE mapping = OpenFileMappingA( FILE_MAP_READ, FALSE, name );
+    if( mapping == NULL )
+    {
+        DEBUG_PRINT("Failed to open shared memory %s", name);
+        return false;
+    }
+
+    shm->data = MapViewOfFile( mapping, FILE_MAP_READ, 0, 0, 0 );
+    if( shm->data == NULL )
+    {
+        CloseHandle( mapping );
+        return false;
+    }
+
+    MEMORY_BASIC_INFORMATION info;
+    VirtualQuery( shm->data, &info, sizeof( info ));
+
+    shm->size = info.RegionSize;
+    shm->owner = false;
+    shm->handle = mapping;
+    strcpy( shm->name, name );
+    return true;
+}
+
+void shared_memory_close( struct SharedMemory *shm )
+{
+    if( shm->data != NULL )
+    {
+        UnmapViewOfFile( shm->data );
+        CloseHandle( (HANDLE)shm->handle );
+    }
+    memset( shm, 0, sizeof( struct SharedMemory ));
+}
+
+#else
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+bool shared_memory_create( struct SharedMemory *shm, const char *name, size_t size )
+{
+    memset( shm, 0, sizeof( struct SharedMemory ));
+    if( !shared_memory_name_fits( name ))
+    {
+        return false;
+    }
+
+    int fd = shm_open( name, O_CREAT | O_EXCL | O_RDWR, 0644 );
+    if( fd < 0 )
+    {
+        DEBUG_PRINT("Failed to create shared memory %s", name);
+        return false;
+    }
+
+    if( ftruncate( fd, size ) != 0 )
+    {
+        close( fd );
+        shm_unlink( name );
+        return false;
+    }
+
+    void *data = mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+    close( fd );
+    if( data == MAP_FAILED )
+    {
+        shm_unlink( name );
+        return false;
+    }
+
+    shm->data = data;
+    shm->size = size;
+    shm->owner = true;
+    strcpy( shm->name, name );
+    return true;
+}
+
+bool shared_memory_open( struct SharedMemory *shm, const char *name )
+{
+    memset( shm, 0, sizeof( struct SharedMemory ));
+    if( !shared_memory_name_fits( name ))
+    {
+        return false;
+    }
+
+    int fd = shm_open( name, O_RDONLY, 0 );
+    if( fd < 0 )
+    {
+        DEBUG_PRINT("Failed to open shared memory %s", name);
+        return false;
+    }
+
+    struct stat st;
+    if( fstat( fd, &st ) != 0 || st.st_size <= 0 )
+    {
+        close( fd );
+        return false;
+    }
+
+    void *data = mmap( NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+    close( fd );
+    if( data == MAP_FAILED )
+    {
+        return false;
+    }
+
+    shm->data = data;
+    shm->size = st.st_size;
+    shm->owner = false;
+    strcpy( shm->name, name );
+    return true;
+}
+
+void shared_memory_close( struct SharedMemory *shm )
+{
+    if( shm->data != NULL )
+    {
+        munmap( shm->data, shm->size );
+        if( shm->owner )
+        {
+            shm_unlink( shm->name );
+        }
+    }
+    memset( shm, 0, sizeof( struct SharedMemory ));
+}
+
+#endif
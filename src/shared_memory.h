@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * @brief A named memory region that other processes can map by name (shm_open on POSIX, a named file mapping on Windows).
+ */
+struct SharedMemory
+{
+    void *data;
+    size_t size;
+    bool owner;
+    void *handle;
+    char name[256];
+};
+
+/**
+ * @brief Creates a new named region of the given size mapped read/write. Fails if the name is already in use.
+ */
+extern bool shared_memory_create( struct SharedMemory *shm, const char *name, size_t size );
+/**
+ * @brief Maps an existing named region read-only, the size is taken from the region itself.
+ */
+extern bool shared_memory_open( struct SharedMemory *shm, const char *name );
+/**
+ * @brief Unmaps the region, the owner also removes the name so no new process can open it.
+ * Processes that already mapped it keep their mapping.
+ */
+extern void shared_memory_close( struct SharedMemory *shm );
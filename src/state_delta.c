@@ -0,0 +1,195 @@
+#include "state_delta.h"
+
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+
+// Positions and velocities keep the precision the engine needs to rebuild the same floor checks, angles go back to the engine's s16 units.
+#define POSITION_SCALE 16.0f
+#define VELOCITY_SCALE 64.0f
+#define ANGLE_SCALE ( 32768.0f / 3.14159f )
+
+enum StateFieldType
+{
+    STATE_FIELD_FLOAT,
+    STATE_FIELD_S16,
+    STATE_FIELD_S32,
+    STATE_FIELD_U8,
+    STATE_FIELD_U32,
+};
+
+struct StateField
+{
+    size_t offset;
+    enum StateFieldType type;
+    float scale;
+};
+
+#define STATE_FIELD( member, type, scale ) { offsetof( struct SM64MarioNetState, member ), type, scale }
+
+// The order is part of the stream format, new fields go at the end.
+static const struct StateField s_fields[] =
+{
+    STATE_FIELD( state.position[0], STATE_FIELD_FLOAT, POSITION_SCALE ),
+    STATE_FIELD( state.position[1], STATE_FIELD_FLOAT, POSITION_SCALE ),
+    STATE_FIELD( state.position[2], STATE_FIELD_FLOAT, POSITION_SCALE ),
+    STATE_FIELD( state.velocity[0], STATE_FIELD_FLOAT, VELOCITY_SCALE ),
+    STATE_FIELD( state.velocity[1], STATE_FIELD_FLOAT, VELOCITY_SCALE ),
+    STATE_FIELD( state.velocity[2], STATE_FIELD_FLOAT, VELOCITY_SCALE ),
+    STATE_FIELD( state.angleVel[0], STATE_FIELD_FLOAT, ANGLE_SCALE ),
+    STATE_FIELD( state.angleVel[1], STATE_FIELD_FLOAT, ANGLE_SCALE ),
+    STATE_FIELD( state.angleVel[2], STATE_FIELD_FLOAT, ANGLE_SCALE ),
+    STATE_FIELD( state.faceAngle, STATE_FIELD_FLOAT, ANGLE_SCALE ),
+    STATE_FIELD( state.pitchAngle, STATE_FIELD_FLOAT, ANGLE_SCALE ),
+    STATE_FIELD( state.health, STATE_FIELD_S16, 0.0f ),
+    STATE_FIELD( state.action, STATE_FIELD_U32, 0.0f ),
+    STATE_FIELD( state.flags, STATE_FIELD_U32, 0.0f ),
+    STATE_FIELD( state.particleFlags, STATE_FIELD_U32, 0.0f ),
+    STATE_FIELD( state.invincTimer, STATE_FIELD_S16, 0.0f ),
+    STATE_FIELD( state.burnTimer, STATE_FIELD_S16, 0.0f ),
+    STATE_FIELD( state.fallDamage, STATE_FIELD_U8, 0.0f ),
+    STATE_FIELD( animID, STATE_FIELD_S16, 0.0f ),
+    STATE_FIELD( animYTrans, STATE_FIELD_S16, 0.0f ),
+    STATE_FIELD( animFrame, STATE_FIELD_S16, 0.0f ),
+    STATE_FIELD( animAccel, STATE_FIELD_S32, 0.0f ),
+    STATE_FIELD( rotation[0], STATE_FIELD_S16, 0.0f ),
+    STATE_FIELD( rotation[1], STATE_FIELD_S16, 0.0f ),
+    STATE_FIELD( rotation[2], STATE_FIELD_S16, 0.0f ),
+};
+
+#define STATE_FIELDS_COUNT ( sizeof( s_fields ) / sizeof( s_fields[0] ))
+
+static uint32_t field_quantize( const struct SM64MarioNetState *state, const struct StateField *field )
+{
+    const uint8_t *ptr = (const uint8_t *)state + field->offset;
+
+    switch( field->type )
+    {
+        case STATE_FIELD_FLOAT: return (uint32_t)(int32_t)lroundf( *(const float *)ptr * field->scale );
+        case STATE_FIELD_S16:   return (uint32_t)(int32_t)*(const int16_t *)ptr;
+        case STATE_FIELD_S32:   return (uint32_t)*(const int32_t *)ptr;
+        case STATE_FIELD_U8:    return *ptr;
+        case STATE_FIELD_U32:   return *(const uint32_t *)ptr;
+    }
+    return 0;
+}
+
+static void field_dequantize( struct SM64MarioNetState *state, const struct StateField *field, uint32_t value )
+{
+    uint8_t *ptr = (uint8_t *)state + field->offset;
+
+    switch( field->type )
+    {
+        case STATE_FIELD_FLOAT: *(float *)ptr = (float)(int32_t)value / field->scale; break;
+        case STATE_FIELD_S16:   *(int16_t *)ptr = (int16_t)value; break;
+        case STATE_FIELD_S32:   *(int32_t *)ptr = (int32_t)value; break;
+        case STATE_FIELD_U8:    *ptr = (uint8_t)value; break;
+        case STATE_FIELD_U32:   *(uint32_t *)ptr = value; break;
+    }
+}
+
+static bool varint_write( uint8_t *buffer, uint32_t size, uint32_t *cursor, uint32_t value )
+{
+    do
+    {
+        if( *cursor >= size )
+            return false;
+
+        uint8_t byte = value & 0x7F;
+        value >>= 7;
+        buffer[(*cursor)++] = byte | ( value != 0 ? 0x80 : 0 );
+    }
+    while( value != 0 );
+
+    return true;
+}
+
+static bool varint_read( const uint8_t *buffer, uint32_t size, uint32_t *cursor, uint32_t *outValue )
+{
+    uint32_t value = 0;
+    for( uint32_t shift = 0; shift < 35; shift += 7 )
+    {
+        if( *cursor >= size )
+            return false;
+
+        uint8_t byte = buffer[(*cursor)++];
+        value |= (uint32_t)( byte & 0x7F ) << shift;
+        if(( byte & 0x80 ) == 0 )
+        {
+            *outValue = value;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Small differences of either sign become small unsigned values, so they fit in one or two varint bytes.
+static uint32_t zigzag_encode( uint32_t difference )
+{
+    return ( difference << 1 ) ^ (uint32_t)((int32_t)difference >> 31 );
+}
+
+static uint32_t zigzag_decode( uint32_t value )
+{
+    return ( value >> 1 ) ^ ( 0u - ( value & 1 ));
+}
+
+uint32_t state_delta_encode( const struct SM64MarioNetState *baseline, const struct SM64MarioNetState *current, uint8_t *outBuffer, uint32_t bufferSize )
+{
+    struct SM64MarioNetState zero;
+    if( baseline == NULL )
+    {
+        memset( &zero, 0, sizeof( struct SM64MarioNetState ));
+        baseline = &zero;
+    }
+
+    uint32_t differences[STATE_FIELDS_COUNT];
+    uint32_t mask = 0;
+    for( uint32_t i = 0; i < STATE_FIELDS_COUNT; ++i )
+    {
+        differences[i] = field_quantize( current, &s_fields[i] ) - field_quantize( baseline, &s_fields[i] );
+        if( differences[i] != 0 )
+            mask |= 1u << i;
+    }
+
+    uint32_t cursor = 0;
+    if( !varint_write( outBuffer, bufferSize, &cursor, mask ))
+        return 0;
+
+    for( uint32_t i = 0; i < STATE_FIELDS_COUNT; ++i )
+    {
+        if(( mask & ( 1u << i )) && !varint_write( outBuffer, bufferSize, &cursor, zigzag_encode( differences[i] )))
+            return 0;
+    }
+
+    return cursor;
+}
+
+uint32_t state_delta_decode( const struct SM64MarioNetState *baseline, const uint8_t *buffer, uint32_t size, struct SM64MarioNetState *outState )
+{
+    struct SM64MarioNetState result;
+    memset( &result, 0, sizeof( struct SM64MarioNetState ));
+    if( baseline != NULL )
+        result = *baseline;
+
+    uint32_t cursor = 0;
+    uint32_t mask;
+    if( !varint_read( buffer, size, &cursor, &mask ) || ( mask >> STATE_FIELDS_COUNT ) != 0 )
+        return 0;
+
+    for( uint32_t i = 0; i < STATE_FIELDS_COUNT; ++i )
+    {
+        if(( mask & ( 1u << i )) == 0 )
+            continue;
+
+        uint32_t value;
+        if( !varint_read( buffer, size, &cursor, &value ))
+            return 0;
+
+        field_dequantize( &result, &s_fields[i], field_quantize( &result, &s_fields[i] ) + zigzag_decode( value ));
+    }
+
+    *outState = result;
+    return cursor;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "libsm64.h"
+
+/**
+ * @brief Writes the fields of current that differ from baseline once both are quantized.
+ * The stream starts with a varint bitmask of the changed fields, followed by each changed field as a zigzag varint
+ * of the difference between the quantized values.
+ * 
+ * @param baseline last state acknowledged by the receiver, NULL to encode against a zeroed state.
+ * @return uint32_t the number of bytes written, 0 if bufferSize is too small.
+ */
+extern uint32_t state_delta_encode( const struct SM64MarioNetState *baseline, const struct SM64MarioNetState *current, uint8_t *outBuffer, uint32_t bufferSize );
+/**
+ * @brief Rebuilds a state from the baseline it was encoded against, unchanged fields are copied from the baseline.
+ * 
+ * @return uint32_t the number of bytes read, 0 if the stream is truncated or malformed.
+ */
+extern uint32_t state_delta_decode( const struct SM64MarioNetState *baseline, const uint8_t *buffer, uint32_t size, struct SM64MarioNetState *outState );
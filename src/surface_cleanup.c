@@ -0,0 +1,409 @@
+#include "surface_cleanup.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define CLEANUP_MAX_MERGE_PASSES 4
+
+struct WeldGrid
+{
+    uint32_t *heads;    // first representative of each hash slot
+    uint32_t *next;     // next representative in the same hash slot
+    int32_t (*reps)[3];
+    uint32_t repsCount;
+    uint32_t mask;
+    int32_t cellSize;
+};
+
+static uint32_t hash_cell( int32_t cx, int32_t cy, int32_t cz )
+{
+    return ((uint32_t)cx * 73856093u) ^ ((uint32_t)cy * 19349663u) ^ ((uint32_t)cz * 83492791u);
+}
+
+static int32_t cell_of( int32_t v, int32_t cellSize )
+{
+    return v >= 0 ? v / cellSize : -((-v + cellSize - 1) / cellSize);
+}
+
+/**
+ * Snaps the vertex to a representative within the weld distance, or makes it a new representative.
+ * Returns whether the vertex moved.
+ */
+static int weld_vertex( struct WeldGrid *grid, int32_t vertex[3], int32_t weldDistance )
+{
+    int32_t cx = cell_of( vertex[0], grid->cellSize );
+    int32_t cy = cell_of( vertex[1], grid->cellSize );
+    int32_t cz = cell_of( vertex[2], grid->cellSize );
+
+    for( int dx = -1; dx <= 1; ++dx )
+    for( int dy = -1; dy <= 1; ++dy )
+    for( int dz = -1; dz <= 1; ++dz )
+    {
+        uint32_t slot = hash_cell( cx + dx, cy + dy, cz + dz ) & grid->mask;
+        for( uint32_t r = grid->heads[slot]; r != UINT32_MAX; r = grid->next[r] )
+        {
+            int32_t *rep = grid->reps[r];
+            if( abs( rep[0] - vertex[0] ) <= weldDistance &&
+                abs( rep[1] - vertex[1] ) <= weldDistance &&
+                abs( rep[2] - vertex[2] ) <= weldDistance )
+            {
+                int moved = rep[0] != vertex[0] || rep[1] != vertex[1] || rep[2] != vertex[2];
+                memcpy( vertex, rep, sizeof( int32_t ) * 3 );
+                return moved;
+            }
+        }
+    }
+
+    uint32_t r = grid->repsCount++;
+    uint32_t slot = hash_cell( cx, cy, cz ) & grid->mask;
+    memcpy( grid->reps[r], vertex, sizeof( int32_t ) * 3 );
+    grid->next[r] = grid->heads[slot];
+    grid->heads[slot] = r;
+    return 0;
+}
+
+static uint32_t weld_vertices( struct SM64Surface *surfaces, uint32_t count, int32_t weldDistance )
+{
+    uint32_t verticesCount = count * 3;
+    uint32_t slots = 1;
+    while( slots < verticesCount * 2 )
+        slots <<= 1;
+
+    struct WeldGrid grid;
+    grid.heads = malloc( slots * sizeof( uint32_t ));
+    grid.next = malloc( verticesCount * sizeof( uint32_t ));
+    grid.reps = malloc( verticesCount * sizeof( int32_t[3] ));
+    grid.repsCount = 0;
+    grid.mask = slots - 1;
+    grid.cellSize = weldDistance + 1;
+    memset( grid.heads, 0xFF, slots * sizeof( uint32_t ));
+
+    uint32_t welded = 0;
+    for( uint32_t i = 0; i < count; ++i )
+        for( int v = 0; v < 3; ++v )
+            welded += weld_vertex( &grid, surfaces[i].vertices[v], weldDistance );
+
+    free( grid.heads );
+    free( grid.next );
+    free( grid.reps );
+    return welded;
+}
+
+static void cross_i64( const int32_t a[3], const int32_t b[3], const int32_t c[3], int64_t out[3] )
+{
+    int64_t ux = (int64_t)b[0] - a[0], uy = (int64_t)b[1] - a[1], uz = (int64_t)b[2] - a[2];
+    int64_t vx = (int64_t)c[0] - b[0], vy = (int64_t)c[1] - b[1], vz = (int64_t)c[2] - b[2];
+    out[0] = uy * vz - uz * vy;
+    out[1] = uz * vx - ux * vz;
+    out[2] = ux * vy - uy * vx;
+}
+
+/**
+ * Same test engine_surface_from_lib_surface uses to flag a surface as invalid.
+ */
+static int is_degenerate( const struct SM64Surface *surf )
+{
+    int64_t n[3];
+    cross_i64( surf->vertices[0], surf->vertices[1], surf->vertices[2], n );
+    double mag = sqrt( (double)n[0] * n[0] + (double)n[1] * n[1] + (double)n[2] * n[2] );
+    return mag < 0.0001;
+}
+
+static int same_attributes( const struct SM64Surface *a, const struct SM64Surface *b )
+{
+    return a->type == b->type && a->force == b->force && a->terrain == b->terrain && a->roomId == b->roomId;
+}
+
+static int same_vertex( const int32_t a[3], const int32_t b[3] )
+{
+    return a[0] == b[0] && a[1] == b[1] && a[2] == b[2];
+}
+
+static int compare_vertex( const int32_t a[3], const int32_t b[3] )
+{
+    for( int k = 0; k < 3; ++k )
+        if( a[k] != b[k] )
+            return a[k] < b[k] ? -1 : 1;
+    return 0;
+}
+
+/**
+ * Index of the smallest vertex, rotating from it keeps the winding so equal triangles compare equal.
+ */
+static int first_vertex( const struct SM64Surface *surf )
+{
+    int first = 0;
+    for( int v = 1; v < 3; ++v )
+        if( compare_vertex( surf->vertices[v], surf->vertices[first] ) < 0 )
+            first = v;
+    return first;
+}
+
+static const struct SM64Surface *s_sort_surfaces;
+
+static int compare_surfaces( const void *pa, const void *pb )
+{
+    const struct SM64Surface *a = &s_sort_surfaces[*(const uint32_t*)pa];
+    const struct SM64Surface *b = &s_sort_surfaces[*(const uint32_t*)pb];
+    int fa = first_vertex( a ), fb = first_vertex( b );
+
+    for( int v = 0; v < 3; ++v )
+    {
+        int c = compare_vertex( a->vertices[(fa + v) % 3], b->vertices[(fb + v) % 3] );
+        if( c != 0 )
+            return c;
+    }
+    if( a->type != b->type ) return a->type < b->type ? -1 : 1;
+    if( a->force != b->force ) return a->force < b->force ? -1 : 1;
+    if( a->terrain != b->terrain ) return a->terrain < b->terrain ? -1 : 1;
+    if( a->roomId != b->roomId ) return a->roomId < b->roomId ? -1 : 1;
+
+    // Keep the first one in the original order
+    return *(const uint32_t*)pa < *(const uint32_t*)pb ? -1 : 1;
+}
+
+static uint32_t mark_duplicates( const struct SM64Surface *surfaces, uint32_t count, uint8_t *removed )
+{
+    uint32_t *order = malloc( count * sizeof( uint32_t ));
+    uint32_t duplicates = 0;
+
+    for( uint32_t i = 0; i < count; ++i )
+        order[i] = i;
+
+    s_sort_surfaces = surfaces;
+    qsort( order, count, sizeof( uint32_t ), compare_surfaces );
+
+    for( uint32_t i = 1; i < count; ++i )
+    {
+        const struct SM64Surface *a = &surfaces[order[i - 1]];
+        const struct SM64Surface *b = &surfaces[order[i]];
+        int fa = first_vertex( a ), fb = first_vertex( b );
+
+        if( removed[order[i]] || !same_attributes( a, b ))
+            continue;
+        if( !same_vertex( a->vertices[fa], b->vertices[fb] ) ||
+            !same_vertex( a->vertices[(fa + 1) % 3], b->vertices[(fb + 1) % 3] ) ||
+            !same_vertex( a->vertices[(fa + 2) % 3], b->vertices[(fb + 2) % 3] ))
+            continue;
+
+        removed[order[i]] = 1;
+        duplicates++;
+    }
+
+    free( order );
+    return duplicates;
+}
+
+/**
+ * Whether b lies strictly inside the segment a-c.
+ */
+static int is_between( const int32_t a[3], const int32_t b[3], const int32_t c[3] )
+{
+    int64_t ab[3], bc[3];
+    for( int k = 0; k < 3; ++k )
+    {
+        ab[k] = (int64_t)b[k] - a[k];
+        bc[k] = (int64_t)c[k] - b[k];
+    }
+
+    if( ab[1] * bc[2] - ab[2] * bc[1] != 0 || ab[2] * bc[0] - ab[0] * bc[2] != 0 || ab[0] * bc[1] - ab[1] * bc[0] != 0 )
+        return 0;
+
+    return ab[0] * bc[0] + ab[1] * bc[1] + ab[2] * bc[2] > 0;
+}
+
+/**
+ * Tries to merge b into a when both triangles share an edge in opposite directions and
+ * their union is a triangle: one of the shared vertices is on the line between the two others.
+ */
+static int try_merge_pair( struct SM64Surface *a, const struct SM64Surface *b )
+{
+    if( !same_attributes( a, b ))
+        return 0;
+
+    for( int ea = 0; ea < 3; ++ea )
+    {
+        const int32_t *u = a->vertices[ea];
+        const int32_t *v = a->vertices[(ea + 1) % 3];
+        const int32_t *pa = a->vertices[(ea + 2) % 3];
+
+        for( int eb = 0; eb < 3; ++eb )
+        {
+            if( !same_vertex( b->vertices[eb], v ) || !same_vertex( b->vertices[(eb + 1) % 3], u ))
+                continue;
+
+            const int32_t *pb = b->vertices[(eb + 2) % 3];
+            int32_t merged[3][3];
+
+            // The union is the polygon u, pb, v, pa
+            if( is_between( pb, v, pa ))
+            {
+                memcpy( merged[0], u, sizeof( merged[0] ));
+                memcpy( merged[1], pb, sizeof( merged[1] ));
+                memcpy( merged[2], pa, sizeof( merged[2] ));
+            }
+            else if( is_between( pa, u, pb ))
+            {
+                memcpy( merged[0], pb, sizeof( merged[0] ));
+                memcpy( merged[1], v, sizeof( merged[1] ));
+                memcpy( merged[2], pa, sizeof( merged[2] ));
+            }
+            else
+            {
+                continue;
+            }
+
+            // Both halves must face the same way, otherwise the pair folds over itself.
+            int64_t na[3], nb[3];
+            cross_i64( a->vertices[0], a->vertices[1], a->vertices[2], na );
+            cross_i64( b->vertices[0], b->vertices[1], b->vertices[2], nb );
+            if( na[1] * nb[2] - na[2] * nb[1] != 0 || na[2] * nb[0] - na[0] * nb[2] != 0 || na[0] * nb[1] - na[1] * nb[0] != 0 ||
+                na[0] * nb[0] + na[1] * nb[1] + na[2] * nb[2] <= 0 )
+                return 0;
+
+            memcpy( a->vertices, merged, sizeof( merged ));
+            return 1;
+        }
+    }
+    return 0;
+}
+
+struct EdgeEntry
+{
+    int32_t u[3];
+    int32_t v[3];
+    uint32_t surface;
+};
+
+static uint32_t hash_vertex( const int32_t v[3] )
+{
+    return hash_cell( v[0], v[1], v[2] );
+}
+
+static uint32_t merge_pass( struct SM64Surface *surfaces, uint32_t count, uint8_t *removed )
+{
+    // Each directed edge is hashed once so the matching reversed edge of a neighbour is found in O(1).
+    uint32_t slots = 1;
+    while( slots < count * 6 )
+        slots <<= 1;
+
+    struct EdgeEntry *edges = malloc( slots * sizeof( struct EdgeEntry ));
+    for( uint32_t i = 0; i < slots; ++i )
+        edges[i].surface = UINT32_MAX;
+
+    uint8_t *merged = calloc( count, 1 );
+    uint32_t merges = 0;
+
+    for( uint32_t i = 0; i < count; ++i )
+    {
+        if( removed[i] )
+            continue;
+
+        for( int e = 0; e < 3; ++e )
+        {
+            const int32_t *u = surfaces[i].vertices[e];
+            const int32_t *v = surfaces[i].vertices[(e + 1) % 3];
+
+            // Look for a neighbour having the edge v->u
+            uint32_t slot = (hash_vertex( v ) * 31u + hash_vertex( u )) & (slots - 1);
+            for( ; edges[slot].surface != UINT32_MAX; slot = (slot + 1) & (slots - 1) )
+            {
+                uint32_t other = edges[slot].surface;
+                if( removed[other] || merged[other] || !same_vertex( edges[slot].u, v ) || !same_vertex( edges[slot].v, u ))
+                    continue;
+
+                if( !merged[i] && try_merge_pair( &surfaces[other], &surfaces[i] ))
+                {
+                    removed[i] = 1;
+                    merged[other] = 1;
+                    merges++;
+                }
+                break;
+            }
+
+            if( removed[i] )
+                break;
+        }
+
+        if( removed[i] )
+            continue;
+
+        for( int e = 0; e < 3; ++e )
+        {
+            const int32_t *u = surfaces[i].vertices[e];
+            const int32_t *v = surfaces[i].vertices[(e + 1) % 3];
+            uint32_t slot = (hash_vertex( u ) * 31u + hash_vertex( v )) & (slots - 1);
+            while( edges[slot].surface != UINT32_MAX )
+                slot = (slot + 1) & (slots - 1);
+
+            memcpy( edges[slot].u, u, sizeof( edges[slot].u ));
+            memcpy( edges[slot].v, v, sizeof( edges[slot].v ));
+            edges[slot].surface = i;
+        }
+    }
+
+    free( merged );
+    free( edges );
+    return merges;
+}
+
+uint32_t surface_cleanup( struct SM64Surface *surfaces, uint32_t count, const struct SM64SurfaceCleanupOptions *options, struct SM64SurfaceCleanupStats *stats )
+{
+    struct SM64SurfaceCleanupStats result;
+    memset( &result, 0, sizeof( result ));
+    result.surfacesBefore = count;
+
+    if( count > 0 )
+    {
+        uint8_t *removed = calloc( count, 1 );
+
+        if( options->weldDistance > 0 )
+            result.verticesWelded = weld_vertices( surfaces, count, options->weldDistance );
+
+        if( options->removeDegenerates )
+        {
+            for( uint32_t i = 0; i < count; ++i )
+            {
+                if( is_degenerate( &surfaces[i] ))
+                {
+                    removed[i] = 1;
+                    result.degeneratesRemoved++;
+                }
+            }
+        }
+
+        if( options->removeDuplicates )
+            result.duplicatesRemoved = mark_duplicates( surfaces, count, removed );
+
+        if( options->mergeCoplanarPairs )
+        {
+            for( int pass = 0; pass < CLEANUP_MAX_MERGE_PASSES; ++pass )
+            {
+                uint32_t merges = merge_pass( surfaces, count, removed );
+                result.pairsMerged += merges;
+                if( merges == 0 )
+                    break;
+            }
+        }
+
+        uint32_t kept = 0;
+        for( uint32_t i = 0; i < count; ++i )
+        {
+            if( removed[i] )
+                continue;
+            if( kept != i )
+                surfaces[kept] = surfaces[i];
+            kept++;
+        }
+        count = kept;
+
+        free( removed );
+    }
+
+    result.surfacesAfter = count;
+    if( stats != NULL )
+        *stats = result;
+
+    return count;
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "decomp/include/external_types.h"
+
+/**
+ * @brief Welds vertices, removes degenerate and duplicated triangles and merges coplanar pairs in place.
+ * 
+ * @param stats filled with the counts before and after the cleanup, can be NULL.
+ * @return uint32_t the number of surfaces left at the start of the array.
+ */
+extern uint32_t surface_cleanup( struct SM64Surface *surfaces, uint32_t count, const struct SM64SurfaceCleanupOptions *options, struct SM64SurfaceCleanupStats *stats );
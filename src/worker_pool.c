@@ -0,0 +1,272 @@
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+// Before any system header, libsm64.h sets _XOPEN_SOURCE
+#include "debug_print.h"
+#include "worker_pool.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+#define WORKER_POOL_MAX_THREADS 64
+
+// The range of indices left to a worker packed as begin | end << 32, so it can be split with a single compare and swap.
+#define RANGE_PACK( begin, end ) ((uint64_t)(begin) | ((uint64_t)(end) << 32))
+#define RANGE_BEGIN( range ) ((uint32_t)(range))
+#define RANGE_END( range ) ((uint32_t)((range) >> 32))
+
+struct Worker
+{
+    pthread_t thread;
+    uint32_t index;
+    uint64_t range;
+    // Keeps the ranges of different workers on different cache lines.
+    uint8_t padding[64 - sizeof( uint64_t )];
+};
+
+struct WorkerPool
+{
+    struct Worker workers[WORKER_POOL_MAX_THREADS];
+    uint32_t threadCount;
+    WorkerPoolThreadExit threadExit;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t jobStarted;
+    pthread_cond_t jobFinished;
+    uint32_t jobGeneration;
+    uint32_t busyWorkers;
+    bool stopping;
+
+    WorkerPoolTask task;
+    void *context;
+};
+
+static struct WorkerPool *s_pool = NULL;
+
+static bool worker_take( struct Worker *worker, uint32_t *index )
+{
+    uint64_t range = __atomic_load_n( &worker->range, __ATOMIC_ACQUIRE );
+    while( RANGE_BEGIN( range ) < RANGE_END( range ))
+    {
+        uint64_t taken = RANGE_PACK( RANGE_BEGIN( range ) + 1, RANGE_END( range ));
+        if( __atomic_compare_exchange_n( &worker->range, &range, taken, true, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE ))
+        {
+            *index = RANGE_BEGIN( range );
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Moves the back half of the largest range found into the empty range of the thief.
+ */
+static bool worker_steal( struct Worker *thief )
+{
+    for( ;; )
+    {
+        struct Worker *victim = NULL;
+        uint64_t victimRange = 0;
+        uint32_t victimCount = 0;
+
+        for( uint32_t i = 0; i < s_pool->threadCount; ++i )
+        {
+            uint64_t range = __atomic_load_n( &s_pool->workers[i].range, __ATOMIC_ACQUIRE );
+            uint32_t count = RANGE_END( range ) - RANGE_BEGIN( range );
+            if( RANGE_BEGIN( range ) < RANGE_END( range ) && count > victimCount )
+            {
+                victim = &s_pool->workers[i];
+                victimRange = range;
+                victimCount = count;
+            }
+        }
+
+        if( victim == NULL )
+            return false;
+
+        uint32_t begin = RANGE_BEGIN( victimRange );
+        uint32_t end = RANGE_END( victimRange );
+        uint32_t split = end - (victimCount + 1) / 2;
+        if( __atomic_compare_exchange_n( &victim->range, &victimRange, RANGE_PACK( begin, split ), false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE ))
+        {
+            __atomic_store_n( &thief->range, RANGE_PACK( split, end ), __ATOMIC_RELEASE );
+            return true;
+        }
+    }
+}
+
+static void worker_run_job( struct Worker *worker )
+{
+    uint32_t index;
+    do
+    {
+        while( worker_take( worker, &index ))
+        {
+            s_pool->task( s_pool->context, index );
+        }
+    }
+    while( worker_steal( worker ));
+}
+
+static void worker_job_done( void )
+{
+    pthread_mutex_lock( &s_pool->mutex );
+    if( --s_pool->busyWorkers == 0 )
+        pthread_cond_signal( &s_pool->jobFinished );
+    pthread_mutex_unlock( &s_pool->mutex );
+}
+
+static void *worker_thread( void *param )
+{
+    struct Worker *worker = (struct Worker*)param;
+    uint32_t generation = 0;
+
+    for( ;; )
+    {
+        pthread_mutex_lock( &s_pool->mutex );
+        while( !s_pool->stopping && s_pool->jobGeneration == generation )
+            pthread_cond_wait( &s_pool->jobStarted, &s_pool->mutex );
+        bool stopping = s_pool->stopping;
+        generation = s_pool->jobGeneration;
+        pthread_mutex_unlock( &s_pool->mutex );
+
+        if( stopping )
+            break;
+
+        worker_run_job( worker );
+        worker_job_done();
+    }
+
+    if( s_pool->threadExit != NULL )
+        s_pool->threadExit();
+
+    return NULL;
+}
+
+static void worker_pin( struct Worker *worker, int32_t cpu )
+{
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO( &set );
+    CPU_SET( cpu, &set );
+    if( pthread_setaffinity_np( worker->thread, sizeof( set ), &set ) != 0 )
+    {
+        DEBUG_PRINT("Failed to pin worker %u to cpu %d", worker->index, cpu);
+    }
+#else
+    DEBUG_PRINT("Pinning workers is not supported on this platform");
+#endif
+}
+
+bool worker_pool_init( uint32_t threadCount, const int32_t *cpus, WorkerPoolThreadExit threadExit )
+{
+    if( s_pool != NULL )
+    {
+        DEBUG_PRINT("Worker pool is already running");
+        return false;
+    }
+
+    if( threadCount < 2 || threadCount > WORKER_POOL_MAX_THREADS )
+    {
+        DEBUG_PRINT("Worker pool needs between 2 and %d threads, got %u", WORKER_POOL_MAX_THREADS, threadCount);
+        return false;
+    }
+
+    s_pool = calloc( 1, sizeof( struct WorkerPool ));
+    s_pool->threadCount = threadCount;
+    s_pool->threadExit = threadExit;
+    pthread_mutex_init( &s_pool->mutex, NULL );
+    pthread_cond_init( &s_pool->jobStarted, NULL );
+    pthread_cond_init( &s_pool->jobFinished, NULL );
+
+    for( uint32_t i = 0; i < threadCount; ++i )
+    {
+        s_pool->workers[i].index = i;
+    }
+
+    // Worker 0 is whoever calls worker_pool_run.
+    for( uint32_t i = 1; i < threadCount; ++i )
+    {
+        struct Worker *worker = &s_pool->workers[i];
+        if( pthread_create( &worker->thread, NULL, worker_thread, worker ) != 0 )
+        {
+            DEBUG_PRINT("Failed to start worker %u", i);
+            s_pool->threadCount = i;
+            worker_pool_terminate();
+            return false;
+        }
+
+        if( cpus != NULL )
+            worker_pin( worker, cpus[i] );
+    }
+
+    return true;
+}
+
+void worker_pool_terminate( void )
+{
+    if( s_pool == NULL )
+        return;
+
+    pthread_mutex_lock( &s_pool->mutex );
+    s_pool->stopping = true;
+    pthread_cond_broadcast( &s_pool->jobStarted );
+    pthread_mutex_unlock( &s_pool->mutex );
+
+    for( uint32_t i = 1; i < s_pool->threadCount; ++i )
+    {
+        pthread_join( s_pool->workers[i].thread, NULL );
+    }
+
+    pthread_cond_destroy( &s_pool->jobFinished );
+    pthread_cond_destroy( &s_pool->jobStarted );
+    pthread_mutex_destroy( &s_pool->mutex );
+    free( s_pool );
+    s_pool = NULL;
+}
+
+uint32_t worker_pool_thread_count( void )
+{
+    return s_pool != NULL ? s_pool->threadCount : 1;
+}
+
+void worker_pool_run( WorkerPoolTask task, void *context, uint32_t count )
+{
+    if( s_pool == NULL || count < 2 )
+    {
+        for( uint32_t i = 0; i < count; ++i )
+            task( context, i );
+        return;
+    }
+
+    s_pool->task = task;
+    s_pool->context = context;
+
+    uint32_t threadCount = s_pool->threadCount;
+    for( uint32_t i = 0; i < threadCount; ++i )
+    {
+        uint32_t begin = (uint32_t)((uint64_t)count * i / threadCount);
+        uint32_t end = (uint32_t)((uint64_t)count * (i + 1) / threadCount);
+        __atomic_store_n( &s_pool->workers[i].range, RANGE_PACK( begin, end ), __ATOMIC_RELEASE );
+    }
+
+    pthread_mutex_lock( &s_pool->mutex );
+    s_pool->busyWorkers = threadCount;
+    s_pool->jobGeneration++;
+    pthread_cond_broadcast( &s_pool->jobStarted );
+    pthread_mutex_unlock( &s_pool->mutex );
+
+    worker_run_job( &s_pool->workers[0] );
+
+    pthread_mutex_lock( &s_pool->mutex );
+    s_pool->busyWorkers--;
+    while( s_pool->busyWorkers > 0 )
+        pthread_cond_wait( &s_pool->jobFinished, &s_pool->mutex );
+    pthread_mutex_unlock( &s_pool->mutex );
+}
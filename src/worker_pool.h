@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef void (*WorkerPoolTask)( void *context, uint32_t index );
+typedef void (*WorkerPoolThreadExit)( void );
+
+/**
+ * @brief Starts threadCount - 1 worker threads, the thread calling worker_pool_run is the last worker.
+ * 
+ * @param cpus optional array of threadCount cpu ids the workers are pinned to, entry 0 is the calling thread and is not pinned.
+ * @param threadExit optional function every worker thread calls before exiting.
+ */
+extern bool worker_pool_init( uint32_t threadCount, const int32_t *cpus, WorkerPoolThreadExit threadExit );
+extern void worker_pool_terminate( void );
+extern uint32_t worker_pool_thread_count( void );
+
+/**
+ * @brief Calls task for every index in [0, count) spread over the pool and returns once all of them are done.
+ * Each thread starts on an even share of the indices and steals half of the remaining indices of another thread
+ * when it runs out, so uneven task costs balance out. Without a pool the tasks run in order on the calling thread.
+ */
+extern void worker_pool_run( WorkerPoolTask task, void *context, uint32_t count );
@@ -0,0 +1,1242 @@
+#define _CRT_SECURE_NO_WARNINGS 1 // for fopen
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/wait.h>
+#endif
+
+#include "../src/libsm64.h"
+#include "../src/decomp/include/sm64shared.h"
+#include "../src/decomp/include/mario_animation_ids.h"
+#include "../src/decomp/game/mario_step.h"
+#include "../src/load_surfaces.h"
+#include "../src/recorder.h"
+
+// Headless behaviour checks, run with `make check`. Checks that need Mario
+// (geometry, animations and audio come from the ROM) are skipped when baserom.us.z64 is missing.
+
+static int s_failures = 0;
+static int s_checks = 0;
+static bool s_has_rom = false;
+
+#define CHECK( cond ) do { \
+    s_checks++; \
+    if( !( cond )) { \
+        s_failures++; \
+        printf( "  %s:%d: check failed: %s\n", __FILE__, __LINE__, #cond ); \
+    } \
+} while( 0 )
+
+static uint8_t *utils_read_file_alloc( const char *path, size_t *fileLength )
+{
+    FILE *f = fopen( path, "rb" );
+
+    if( !f ) return NULL;
+
+    fseek( f, 0, SEEK_END );
+    size_t length = (size_t)ftell( f );
+    rewind( f );
+    uint8_t *buffer = malloc( length + 1 );
+    if( fread( buffer, 1, length, f ) != length )
+    {
+        fclose( f );
+        free( buffer );
+        return NULL;
+    }
+    buffer[length] = 0;
+    fclose( f );
+
+    if( fileLength ) *fileLength = length;
+
+    return buffer;
+}
+
+static void make_floor( struct SM64Surface *outSurfaces, int16_t halfSize, int16_t height )
+{
+    memset( outSurfaces, 0, 2 * sizeof( struct SM64Surface ));
+
+    const int32_t a[3] = { -halfSize, height, -halfSize };
+    const int32_t b[3] = { -halfSize, height,  halfSize };
+    const int32_t c[3] = {  halfSize, height,  halfSize };
+    const int32_t d[3] = {  halfSize, height, -halfSize };
+
+    memcpy( outSurfaces[0].vertices[0], a, sizeof( a ));
+    memcpy( outSurfaces[0].vertices[1], b, sizeof( b ));
+    memcpy( outSurfaces[0].vertices[2], c, sizeof( c ));
+    memcpy( outSurfaces[1].vertices[0], a, sizeof( a ));
+    memcpy( outSurfaces[1].vertices[1], c, sizeof( c ));
+    memcpy( outSurfaces[1].vertices[2], d, sizeof( d ));
+}
+
+// Fresh level with a flat floor loaded in `roomId`, nothing else bound.
+static void load_flat_level( uint32_t roomsCount, uint32_t roomId )
+{
+    struct SM64Surface floor[2];
+    make_floor( floor, 4000, 0 );
+
+    sm64_level_init( roomsCount );
+    sm64_level_load_room( roomId, floor, 2, NULL, 0 );
+}
+
+static void check_create_in_fresh_level( void )
+{
+    load_flat_level( 8, 5 );
+
+    int rooms[] = { 5, 2, 7 };
+    int32_t marioId = sm64_mario_create( 0, 0, 0, 0, 0, 0, 0, rooms, 3 );
+    CHECK( marioId >= 0 );
+
+    int32_t cloneId = sm64_mario_clone( marioId, 100, 0, 0, 0, 0, 0, rooms, 3 );
+    CHECK( cloneId >= 0 );
+
+    int32_t forkId = sm64_mario_fork( marioId );
+    CHECK( forkId >= 0 );
+
+    sm64_mario_delete( forkId );
+    sm64_mario_delete( cloneId );
+    sm64_mario_delete( marioId );
+    sm64_level_unload();
+}
+
+// Calling a state setter wakes a Mario, so `awake` never takes the idle path.
+static void keep_awake( int32_t marioId )
+{
+    sm64_set_mario_water_level( marioId, sm64_get_mario_water_level( marioId ));
+}
+
+// Ticks both Marios without input, `awake` never takes the idle path. False on the first tick their state differs.
+static bool tick_pair_matches( int32_t idle, int32_t awake, int ticks )
+{
+    struct SM64MarioInputs inputs;
+    memset( &inputs, 0, sizeof( inputs ));
+    struct SM64MarioState idleState, awakeState;
+
+    for( int i = 0; i < ticks; i++ )
+    {
+        keep_awake( awake );
+        sm64_mario_tick( idle, &inputs, &idleState, NULL );
+        sm64_mario_tick( awake, &inputs, &awakeState, NULL );
+
+        int16_t rot[3];
+        struct SM64AnimInfo idleAnim = *sm64_mario_get_anim_info( idle, rot );
+        struct SM64AnimInfo awakeAnim = *sm64_mario_get_anim_info( awake, rot );
+
+        if( idleState.action != awakeState.action
+            || memcmp( idleState.position, awakeState.position, sizeof( idleState.position )) != 0
+            || idleAnim.animID != awakeAnim.animID
+            || idleAnim.animFrame != awakeAnim.animFrame )
+            return false;
+    }
+
+    return true;
+}
+
+// Lands both Marios and puts them to sleep. The sleep sequence only moves on at the end of each animation.
+static void start_sleeping_pair( int32_t idle, int32_t awake )
+{
+    CHECK( tick_pair_matches( idle, awake, 30 ));
+    sm64_set_mario_action( idle, ACT_SLEEPING );
+    sm64_set_mario_action( awake, ACT_SLEEPING );
+}
+
+static void check_idle_skip_matches_full_ticks( void )
+{
+    load_flat_level( 1, 0 );
+
+    int rooms[] = { 0 };
+    int32_t idle = sm64_mario_create( 0, 0, 0, 0, 0, 0, 0, rooms, 1 );
+    int32_t awake = sm64_mario_create( 0, 0, 0, 0, 0, 0, 0, rooms, 1 );
+    CHECK( idle >= 0 && awake >= 0 );
+
+    start_sleeping_pair( idle, awake );
+    CHECK( tick_pair_matches( idle, awake, 10000 ));
+
+    int16_t rot[3];
+    CHECK( sm64_mario_get_anim_info( idle, rot )->animID == MARIO_ANIM_SLEEP_LYING );
+
+    sm64_mario_delete( awake );
+    sm64_mario_delete( idle );
+    sm64_level_unload();
+}
+
+static void check_idle_wakes_on_object_move( void )
+{
+    load_flat_level( 1, 0 );
+
+    struct SM64Surface step[2];
+    make_floor( step, 200, 0 );
+    struct SM64SurfaceObject object;
+    memset( &object, 0, sizeof( object ));
+    object.transform.position[0] = 6000.0f;
+    object.transform.position[1] = 20.0f;
+    object.surfaceCount = 2;
+    object.surfaces = step;
+    uint32_t objectId = sm64_surface_object_create( &object );
+
+    int rooms[] = { 0 };
+    int32_t idle = sm64_mario_create( 0, 0, 0, 0, 0, 0, 0, rooms, 1 );
+    int32_t awake = sm64_mario_create( 0, 0, 0, 0, 0, 0, 0, rooms, 1 );
+    CHECK( idle >= 0 && awake >= 0 );
+
+    start_sleeping_pair( idle, awake );
+    CHECK( tick_pair_matches( idle, awake, 10000 ));
+
+    // Slide the step under both sleepers, the full tick snaps Mario up onto it.
+    struct SM64ObjectTransform transform = object.transform;
+    transform.position[0] = 0.0f;
+    sm64_surface_object_move( objectId, &transform );
+    CHECK( tick_pair_matches( idle, awake, 60 ));
+
+    struct SM64MarioState state;
+    struct SM64MarioInputs inputs;
+    memset( &inputs, 0, sizeof( inputs ));
+    keep_awake( awake );
+    sm64_mario_tick( awake, &inputs, &state, NULL );
+    CHECK( state.position[1] == 20.0f );
+
+    sm64_mario_delete( awake );
+    sm64_mario_delete( idle );
+    sm64_surface_object_delete( objectId );
+    sm64_level_unload();
+}
+
+static void check_surface_ref_water_pseudo_floor( void )
+{
+    load_flat_level( 1, 0 );
+
+    struct SurfaceRef ref;
+    level_surface_to_ref( &gWaterSurfacePseudoFloor, &ref );
+    CHECK( ref.kind == SURFACE_REF_WATER_PSEUDO_FLOOR );
+    CHECK( level_surface_from_ref( &ref ) == &gWaterSurfacePseudoFloor );
+
+    level_surface_to_ref( NULL, &ref );
+    CHECK( ref.kind == SURFACE_REF_NONE );
+    CHECK( level_surface_from_ref( &ref ) == NULL );
+
+    sm64_level_unload();
+}
+
+static bool surface_refs_equal( const struct SurfaceRef *a, const struct SurfaceRef *b )
+{
+    return a->kind == b->kind && a->owner == b->owner && a->instance == b->instance && a->index == b->index;
+}
+
+// Resolves a reference and makes one again from what it resolved to, the two must match.
+static bool surface_ref_round_trips( struct SurfaceRef ref )
+{
+    struct SurfaceRef back;
+    struct Surface *surface = level_surface_from_ref( &ref );
+    level_surface_to_ref( surface, &back );
+    return surface != NULL && surface_refs_equal( &ref, &back );
+}
+
+static bool transform_ref_round_trips( struct SurfaceRef surfaceRef, struct SurfaceRef expected )
+{
+    struct SurfaceRef back;
+    struct SurfaceObjectTransform *transform = level_surface_from_ref( &surfaceRef )->transform;
+    level_transform_to_ref( transform, &back );
+    return transform != NULL && surface_refs_equal( &back, &expected ) && level_transform_from_ref( &back ) == transform;
+}
+
+static void check_surface_refs_of_every_owner( void )
+{
+    struct SM64Surface floor[2], block[2];
+    make_floor( floor, 4000, 0 );
+    make_floor( block, 100, 50 );
+
+    struct SM64SurfaceObject staticObject;
+    memset( &staticObject, 0, sizeof( staticObject ));
+    staticObject.transform.position[0] = 500.0f;
+    staticObject.surfaceCount = 2;
+    staticObject.surfaces = block;
+
+    sm64_level_init( 2 );
+    sm64_level_load_room( 0, floor, 2, &staticObject, 1 );
+    uint32_t meshId = sm64_level_register_mesh( block, 2 );
+    struct SM64MeshInstance instance;
+    memset( &instance, 0, sizeof( instance ));
+    instance.meshId = meshId;
+    instance.transform.position[2] = 700.0f;
+    sm64_level_load_room_mesh_instances( 0, &instance, 1 );
+    uint32_t objectId = sm64_surface_object_create( &staticObject );
+
+    // The room moves to another slot, the references must follow it.
+    int switched[1][2] = {{ 0, 1 }};
+    sm64_level_rooms_switch( switched, 1 );
+
+    struct SurfaceRef roomFloor = { SURFACE_REF_ROOM, 1, 0, 1 };
+    struct SurfaceRef roomObject = { SURFACE_REF_ROOM, 1, 0, 3 };
+    struct SurfaceRef meshSurface = { SURFACE_REF_MESH_INSTANCE, 1, 0, 1 };
+    struct SurfaceRef objectSurface = { SURFACE_REF_DYNAMIC_OBJECT, objectId, 0, 1 };
+    CHECK( surface_ref_round_trips( roomFloor ));
+    CHECK( surface_ref_round_trips( roomObject ));
+    CHECK( surface_ref_round_trips( meshSurface ));
+    CHECK( surface_ref_round_trips( objectSurface ));
+
+    // Platforms are saved by their transform, whichever surface of the object Mario stood on.
+    struct SurfaceRef roomTransform = { SURFACE_REF_ROOM, 1, 0, 2 };
+    struct SurfaceRef meshTransform = { SURFACE_REF_MESH_INSTANCE, 1, 0, 0 };
+    struct SurfaceRef objectTransform = { SURFACE_REF_DYNAMIC_OBJECT, objectId, 0, 0 };
+    CHECK( transform_ref_round_trips( roomObject, roomTransform ));
+    CHECK( transform_ref_round_trips( meshSurface, meshTransform ));
+    CHECK( transform_ref_round_trips( objectSurface, objectTransform ));
+
+    sm64_surface_object_delete( objectId );
+    CHECK( level_transform_from_ref( &objectTransform ) == NULL );
+    sm64_level_unload();
+}
+
+static bool mario_states_equal( const struct SM64MarioState *a, const struct SM64MarioState *b )
+{
+    return memcmp( a->position, b->position, sizeof( a->position )) == 0
+        && memcmp( a->velocity, b->velocity, sizeof( a->velocity )) == 0
+        && a->faceAngle == b->faceAngle
+        && a->action == b->action
+        && a->health == b->health;
+}
+
+static void check_layout_stamp_sees_nearby_changes( void )
+{
+    load_flat_level( 2, 0 );
+
+    struct MarioLoadedRooms player;
+    uint32_t roomIds[2];
+    memset( &player, 0, sizeof( player ));
+    int rooms[] = { 0 };
+    level_load_player_loaded_rooms( 1000, &player, roomIds );
+    level_update_player_loaded_Rooms( 1000, rooms, 1 );
+    level_bind_loaded_rooms( &player );
+
+    struct SM64Surface step[2], floor[2];
+    make_floor( step, 200, 0 );
+    make_floor( floor, 4000, 0 );
+    struct SM64SurfaceObject object;
+    memset( &object, 0, sizeof( object ));
+    object.transform.position[0] = 20000.0f;
+    object.surfaceCount = 2;
+    object.surfaces = step;
+    uint32_t objectId = sm64_surface_object_create( &object );
+
+    struct LevelLayoutStamp before, after;
+    level_get_layout_stamp( 0.0f, 0.0f, &before );
+
+    // A platform moving far away and a room this player doesn't have leave it alone.
+    object.transform.position[0] = 21000.0f;
+    sm64_surface_object_move( objectId, &object.transform );
+    sm64_level_load_room( 1, floor, 2, NULL, 0 );
+    level_get_layout_stamp( 0.0f, 0.0f, &after );
+    CHECK( memcmp( &before, &after, sizeof( before )) == 0 );
+
+    object.transform.position[0] = 300.0f;
+    sm64_surface_object_move( objectId, &object.transform );
+    level_get_layout_stamp( 0.0f, 0.0f, &after );
+    CHECK( memcmp( &before, &after, sizeof( before )) != 0 );
+
+    // Moving it away again is a change too, the step is no longer there.
+    level_get_layout_stamp( 0.0f, 0.0f, &before );
+    object.transform.position[0] = 20000.0f;
+    sm64_surface_object_move( objectId, &object.transform );
+    level_get_layout_stamp( 0.0f, 0.0f, &after );
+    CHECK( memcmp( &before, &after, sizeof( before )) != 0 );
+
+    level_get_layout_stamp( 0.0f, 0.0f, &before );
+    sm64_level_unload_room( 0 );
+    level_get_layout_stamp( 0.0f, 0.0f, &after );
+    CHECK( memcmp( &before, &after, sizeof( before )) != 0 );
+
+    level_bind_loaded_rooms( NULL );
+    level_unload_player_loaded_rooms( 1000 );
+    sm64_surface_object_delete( objectId );
+    sm64_level_unload();
+}
+
+static void check_save_load_round_trip( void )
+{
+    load_flat_level( 1, 0 );
+
+    int rooms[] = { 0 };
+    int32_t source = sm64_mario_create( 0, 0, 0, 0, 0, 0, 0, rooms, 1 );
+    int32_t target = sm64_mario_create( 1000, 0, 0, 0, 0, 0, 0, rooms, 1 );
+    CHECK( source >= 0 && target >= 0 );
+
+    struct SM64MarioInputs inputs;
+    memset( &inputs, 0, sizeof( inputs ));
+    struct SM64MarioState sourceState, targetState;
+    for( int i = 0; i < 30; i++ )
+        sm64_mario_tick( source, &inputs, &sourceState, NULL );
+
+    // Riding a shell below the water level puts Mario on the engine's water pseudo floor.
+    sm64_set_mario_water_level( source, 50 );
+    sm64_set_mario_action( source, ACT_RIDING_SHELL_GROUND );
+    inputs.stickY = 1.0f;
+    for( int i = 0; i < 10; i++ )
+        sm64_mario_tick( source, &inputs, &sourceState, NULL );
+    CHECK( sourceState.position[1] > 0.0f );
+
+    static uint8_t saved[SM64_MARIO_STATE_SIZE], reloaded[SM64_MARIO_STATE_SIZE];
+    memset( saved, 0, sizeof( saved ));
+    memset( reloaded, 0, sizeof( reloaded ));
+    CHECK( sm64_mario_save_state( source, saved ));
+    CHECK( sm64_mario_load_state( target, saved ));
+    CHECK( sm64_mario_save_state( target, reloaded ));
+    CHECK( memcmp( saved, reloaded, sizeof( saved )) == 0 );
+
+    bool same = true;
+    for( int i = 0; i < 60 && same; i++ )
+    {
+        sm64_mario_tick( source, &inputs, &sourceState, NULL );
+        sm64_mario_tick( target, &inputs, &targetState, NULL );
+        same = mario_states_equal( &sourceState, &targetState );
+    }
+    CHECK( same );
+
+    sm64_mario_delete( target );
+    sm64_mario_delete( source );
+    sm64_level_unload();
+}
+
+static void check_fork_isolation( void )
+{
+    struct SM64Surface floor[2], step[2];
+    make_floor( floor, 4000, 0 );
+    make_floor( step, 200, 20 );
+    sm64_level_init( 2 );
+    sm64_level_load_room( 0, floor, 2, NULL, 0 );
+    sm64_level_load_room( 1, step, 2, NULL, 0 );
+
+    int rooms[] = { 0 };
+    int32_t source = sm64_mario_create( 0, 0, 0, 0, 0, 0, 0, rooms, 1 );
+    CHECK( source >= 0 );
+
+    struct SM64MarioInputs inputs;
+    memset( &inputs, 0, sizeof( inputs ));
+    struct SM64MarioState sourceState, forkState;
+    for( int i = 0; i < 30; i++ )
+        sm64_mario_tick( source, &inputs, &sourceState, NULL );
+
+    static uint8_t before[SM64_MARIO_STATE_SIZE], after[SM64_MARIO_STATE_SIZE];
+    memset( before, 0, sizeof( before ));
+    memset( after, 0, sizeof( after ));
+    CHECK( sm64_mario_save_state( source, before ));
+
+    int32_t fork = sm64_mario_fork( source );
+    CHECK( fork >= 0 );
+    CHECK( sm64_get_collision_surfaces_count( fork ) == sm64_get_collision_surfaces_count( source ));
+
+    // Room list updates reach the fork's own record and leave the source alone.
+    int forkRooms[] = { 0, 1 };
+    int sourceCount = sm64_get_collision_surfaces_count( source );
+    sm64_level_update_loaded_rooms_list( fork, forkRooms, 2 );
+    CHECK( sm64_get_collision_surfaces_count( fork ) == sourceCount + 2 );
+    CHECK( sm64_get_collision_surfaces_count( source ) == sourceCount );
+
+    inputs.stickY = 1.0f;
+    for( int i = 0; i < 30; i++ )
+        sm64_mario_tick( fork, &inputs, &forkState, NULL );
+    CHECK( forkState.position[2] != sourceState.position[2] || forkState.position[0] != sourceState.position[0] );
+
+    CHECK( sm64_mario_save_state( source, after ));
+    CHECK( memcmp( before, after, sizeof( before )) == 0 );
+
+    sm64_mario_delete( fork );
+    sm64_mario_delete( source );
+    sm64_level_unload();
+}
+
+static bool debug_surfaces_have_height( const struct SM64DebugSurface *surfaces, int count, float height )
+{
+    for( int i = 0; i < count; i++ )
+    {
+        if( surfaces[i].v1[1] == height && surfaces[i].v2[1] == height && surfaces[i].v3[1] == height )
+            return true;
+    }
+    return false;
+}
+
+static void check_collision_export_mesh_instances( void )
+{
+    load_flat_level( 1, 0 );
+
+    struct SM64Surface block[2];
+    make_floor( block, 100, 50 );
+    uint32_t meshId = sm64_level_register_mesh( block, 2 );
+
+    struct SM64MeshInstance instances[2];
+    memset( instances, 0, sizeof( instances ));
+    instances[0].meshId = meshId;
+    instances[1].meshId = meshId;
+    instances[1].transform.position[0] = 20000.0f;
+    sm64_level_load_room_mesh_instances( 0, instances, 2 );
+
+    int rooms[] = { 0 };
+    int32_t marioId = sm64_mario_create( 0, 100, 0, 0, 0, 0, 0, rooms, 1 );
+    CHECK( marioId >= 0 );
+
+    // Room floor, player surfaces and the near instance only, before any tick queried the level.
+    int expected = 2 + BIG_FLOOR_HACK_SURFACES_COUNT + 2;
+    int count = sm64_get_collision_surfaces_count( marioId );
+    CHECK( count == expected );
+
+    struct SM64DebugSurface floor, ceiling, wall, surfaces[16];
+    memset( surfaces, 0, sizeof( surfaces ));
+    if( count > 0 && count <= 16 )
+    {
+        sm64_get_collision_surfaces( marioId, &floor, &ceiling, &wall, surfaces );
+        CHECK( debug_surfaces_have_height( surfaces, count, 50.0f ));
+    }
+
+    // Releasing keeps what a Mario stands next to, the export stays the same.
+    sm64_level_release_mesh_instances();
+    CHECK( sm64_get_collision_surfaces_count( marioId ) == expected );
+
+    sm64_mario_delete( marioId );
+    sm64_level_unload();
+}
+
+static void check_mesh_instances_stay_in_place( void )
+{
+    load_flat_level( 1, 0 );
+
+    struct SM64Surface block[2];
+    make_floor( block, 100, 50 );
+    uint32_t meshId = sm64_level_register_mesh( block, 2 );
+    struct SM64MeshInstance instance;
+    memset( &instance, 0, sizeof( instance ));
+    instance.meshId = meshId;
+    sm64_level_load_room_mesh_instances( 0, &instance, 1 );
+
+    // A loaded rooms record without a Mario, so the query runs without the ROM.
+    struct MarioLoadedRooms player;
+    uint32_t roomIds[1];
+    memset( &player, 0, sizeof( player ));
+    int rooms[] = { 0 };
+    level_load_player_loaded_rooms( 1000, &player, roomIds );
+    level_update_player_loaded_Rooms( 1000, rooms, 1 );
+    level_update_mesh_instances_query( 0.0f, 0.0f, 50.0f );
+    CHECK( player.instancesQueryCount == 2 );
+
+    if( player.instancesQueryCount == 2 )
+    {
+        // Built surfaces point at their instance's transform, adding instances to the room must not move it.
+        struct Surface *surface = player.instancesQuery[0];
+        struct SurfaceObjectTransform *transform = surface->transform;
+        struct SurfaceObjectTransform saved = *transform;
+
+        static struct SM64MeshInstance more[256];
+        memset( more, 0, sizeof( more ));
+        for( int i = 0; i < 256; i++ )
+        {
+            more[i].meshId = meshId;
+            more[i].transform.position[0] = 1000.0f + 300.0f * i;
+        }
+        sm64_level_load_room_mesh_instances( 0, more, 256 );
+
+        CHECK( surface->transform == transform );
+        CHECK( memcmp( transform, &saved, sizeof( saved )) == 0 );
+    }
+
+    level_unload_player_loaded_rooms( 1000 );
+    sm64_level_unload();
+}
+
+// Instances of a mesh spanning +-halfSize around their translation, as the level bounds them.
+static bool instance_in_reach( const struct SM64MeshInstance *instance, int16_t halfSize, float x, float z, float margin )
+{
+    float minX = instance->transform.position[0] - halfSize - 1, maxX = instance->transform.position[0] + halfSize + 1;
+    float minZ = instance->transform.position[2] - halfSize - 1, maxZ = instance->transform.position[2] + halfSize + 1;
+    return !( x + margin < minX || x - margin > maxX || z + margin < minZ || z - margin > maxZ );
+}
+
+static void check_mesh_instances_query_matches_bounds( void )
+{
+    load_flat_level( 1, 0 );
+
+    struct SM64Surface small[2], large[2];
+    make_floor( small, 100, 50 );
+    make_floor( large, 3000, 80 );
+    uint32_t smallId = sm64_level_register_mesh( small, 2 );
+    uint32_t largeId = sm64_level_register_mesh( large, 2 );
+
+    // A spread of small instances and one over many cells, which must still be gathered once.
+    static struct SM64MeshInstance instances[1601];
+    memset( instances, 0, sizeof( instances ));
+    for( int i = 0; i < 1600; i++ )
+    {
+        instances[i].meshId = smallId;
+        instances[i].transform.position[0] = -20000.0f + 1000.0f * ( i % 40 ) + ( i * 37 % 11 );
+        instances[i].transform.position[2] = -20000.0f + 1000.0f * ( i / 40 ) - ( i * 53 % 13 );
+    }
+    instances[1600].meshId = largeId;
+    instances[1600].transform.position[0] = 1500.0f;
+    instances[1600].transform.position[2] = -700.0f;
+    sm64_level_load_room_mesh_instances( 0, instances, 1601 );
+
+    struct MarioLoadedRooms player;
+    uint32_t roomIds[1];
+    memset( &player, 0, sizeof( player ));
+    int rooms[] = { 0 };
+    level_load_player_loaded_rooms( 1000, &player, roomIds );
+    level_update_player_loaded_Rooms( 1000, rooms, 1 );
+
+    const float points[][3] = {
+        { 0.0f, 0.0f, 50.0f }, { -19900.0f, -20000.0f, 50.0f }, { 18900.0f, 18950.0f, 200.0f },
+        { 1500.0f, -700.0f, 2500.0f }, { 400.0f, 300.0f, 0.0f }, { 90000.0f, 0.0f, 50.0f },
+    };
+    bool same = true;
+    for( int p = 0; p < (int)( sizeof( points ) / sizeof( points[0] )); p++ )
+    {
+        uint32_t expected = 0;
+        for( int i = 0; i < 1601; i++ )
+            if( instance_in_reach( &instances[i], i == 1600 ? 3000 : 100, points[p][0], points[p][1], points[p][2] ))
+                expected += 2;
+
+        level_update_mesh_instances_query( points[p][0], points[p][1], points[p][2] );
+        same = same && player.instancesQueryCount == expected;
+    }
+    CHECK( same );
+
+    level_unload_player_loaded_rooms( 1000 );
+    sm64_level_unload();
+}
+
+static void check_mesh_instances_freed_without_batches( void )
+{
+    load_flat_level( 1, 0 );
+
+    struct SM64Surface block[2];
+    make_floor( block, 100, 50 );
+    uint32_t meshId = sm64_level_register_mesh( block, 2 );
+
+    // A long row of instances walked through by queries alone, as single ticks would.
+    static struct SM64MeshInstance instances[20000];
+    memset( instances, 0, sizeof( instances ));
+    for( int i = 0; i < 20000; i++ )
+    {
+        instances[i].meshId = meshId;
+        instances[i].transform.position[0] = 300.0f * i;
+    }
+    sm64_level_load_room_mesh_instances( 0, instances, 20000 );
+
+    struct MarioLoadedRooms player;
+    uint32_t roomIds[1];
+    memset( &player, 0, sizeof( player ));
+    int rooms[] = { 0 };
+    level_load_player_loaded_rooms( 1000, &player, roomIds );
+    level_update_player_loaded_Rooms( 1000, rooms, 1 );
+
+    uint32_t mostBuilt = 0;
+    for( int i = 0; i < 20000; i++ )
+    {
+        level_update_mesh_instances_query( 300.0f * i, 0.0f, 50.0f );
+        if( level_get_mesh_instances_built_surfaces() > mostBuilt )
+            mostBuilt = level_get_mesh_instances_built_surfaces();
+    }
+    CHECK( mostBuilt < 20000 * 2 );
+    CHECK( player.instancesQueryCount == 2 );
+
+    level_unload_player_loaded_rooms( 1000 );
+    sm64_level_unload();
+    CHECK( level_get_mesh_instances_built_surfaces() == 0 );
+}
+
+static void check_loaded_rooms_records_grow( void )
+{
+    load_flat_level( 2, 0 );
+
+    // Far more records than the level used to hold, each one must stay findable and keep its own rooms.
+    static struct MarioLoadedRooms players[200];
+    static uint32_t roomIds[200][2];
+    memset( players, 0, sizeof( players ));
+    bool registered = true;
+    for( int i = 0; i < 200; i++ )
+    {
+        int rooms[] = { i % 2 };
+        registered = registered && level_load_player_loaded_rooms( 2000 + i, &players[i], roomIds[i] );
+        level_update_player_loaded_Rooms( 2000 + i, rooms, 1 );
+    }
+    CHECK( registered );
+
+    bool found = true;
+    for( int i = 0; i < 200; i++ )
+        found = found && level_find_player_loaded_rooms( 2000 + i ) == &players[i] && players[i].count == 1 && players[i].roomIds[0] == (uint32_t)( i % 2 );
+    CHECK( found );
+
+    for( int i = 0; i < 200; i++ )
+        level_unload_player_loaded_rooms( 2000 + i );
+    CHECK( level_find_player_loaded_rooms( 2000 ) == NULL );
+    sm64_level_unload();
+}
+
+static void check_many_marios_keep_their_rooms( void )
+{
+    // Even rooms hold a floor at 0, odd rooms one at 100 under the same spot.
+    struct SM64Surface low[2], high[2];
+    make_floor( low, 4000, 0 );
+    make_floor( high, 4000, 100 );
+    sm64_level_init( 2 );
+    sm64_level_load_room( 0, low, 2, NULL, 0 );
+    sm64_level_load_room( 1, high, 2, NULL, 0 );
+
+    int32_t ids[64];
+    struct SM64MarioInputs inputs[64];
+    struct SM64MarioState states[64];
+    memset( inputs, 0, sizeof( inputs ));
+    for( int i = 0; i < 64; i++ )
+    {
+        int rooms[] = { i % 2 };
+        ids[i] = sm64_mario_create( 0, 200, 0, 0, 0, 0, 0, rooms, 1 );
+        CHECK( ids[i] >= 0 );
+    }
+
+    for( int tick = 0; tick < 60; tick++ )
+        sm64_mario_tick_batch( ids, inputs, states, NULL, 64 );
+
+    bool ownRooms = true;
+    for( int i = 0; i < 64; i++ )
+        ownRooms = ownRooms && states[i].position[1] == ( i % 2 ? 100.0f : 0.0f );
+    CHECK( ownRooms );
+
+    for( int i = 0; i < 64; i++ )
+        sm64_mario_delete( ids[i] );
+    sm64_level_unload();
+}
+
+static void check_batch_matches_single_ticks( void )
+{
+    load_flat_level( 1, 0 );
+
+    int rooms[] = { 0 };
+    int32_t batched[3], single[3];
+    for( int i = 0; i < 3; i++ )
+    {
+        batched[i] = sm64_mario_create( 300.0f * i, 0, 0, 0, 0, 0, 0, rooms, 1 );
+        single[i] = sm64_mario_create( 300.0f * i, 0, 0, 0, 0, 0, 0, rooms, 1 );
+        CHECK( batched[i] >= 0 && single[i] >= 0 );
+    }
+
+    struct SM64MarioInputs inputs[3];
+    memset( inputs, 0, sizeof( inputs ));
+    inputs[1].stickX = 1.0f;
+    inputs[2].stickY = -1.0f;
+
+    bool same = true;
+    for( int tick = 0; tick < 120 && same; tick++ )
+    {
+        inputs[0].buttonA = tick % 40 == 35;
+
+        struct SM64MarioState batchStates[3], singleState;
+        sm64_mario_tick_batch( batched, inputs, batchStates, NULL, 3 );
+        for( int i = 0; i < 3; i++ )
+        {
+            sm64_mario_tick( single[i], &inputs[i], &singleState, NULL );
+            same = same && mario_states_equal( &batchStates[i], &singleState );
+        }
+    }
+    CHECK( same );
+
+    for( int i = 0; i < 3; i++ )
+    {
+        sm64_mario_delete( batched[i] );
+        sm64_mario_delete( single[i] );
+    }
+    sm64_level_unload();
+}
+
+static void check_batch_skips_repeated_ids( void )
+{
+    load_flat_level( 1, 0 );
+
+    int rooms[] = { 0 };
+    int32_t repeated = sm64_mario_create( 0, 0, 0, 0, 0, 0, 0, rooms, 1 );
+    int32_t single = sm64_mario_create( 0, 0, 0, 0, 0, 0, 0, rooms, 1 );
+    CHECK( repeated >= 0 && single >= 0 );
+
+    // The repeat would tick the same Mario, and its loaded rooms, twice at once on the pool.
+    int32_t ids[] = { repeated, repeated, single };
+    struct SM64MarioInputs inputs[3];
+    memset( inputs, 0, sizeof( inputs ));
+    struct SM64MarioState states[3];
+    bool same = true, untouched = true;
+    for( int tick = 0; tick < 60 && same; tick++ )
+    {
+        for( int i = 0; i < 3; i++ )
+            inputs[i].stickX = tick < 30 ? 1.0f : 0.0f;
+        memset( states, 0, sizeof( states ));
+        states[1].health = -1;
+        sm64_mario_tick_batch( ids, inputs, states, NULL, 3 );
+        same = mario_states_equal( &states[0], &states[2] );
+        untouched = untouched && states[1].health == -1;
+    }
+    CHECK( same );
+    CHECK( untouched );
+
+    sm64_mario_delete( single );
+    sm64_mario_delete( repeated );
+    sm64_level_unload();
+}
+
+static void check_replay_matches_recording( void )
+{
+    const char *path = "check_replay.sm64rec";
+    CHECK( sm64_recording_start( path ));
+
+    load_flat_level( 1, 0 );
+    int rooms[] = { 0 };
+    int32_t marioId = sm64_mario_create( 0, 0, 0, 0, 0, 0, 0, rooms, 1 );
+    CHECK( marioId >= 0 );
+
+    struct SM64MarioInputs inputs;
+    memset( &inputs, 0, sizeof( inputs ));
+    struct SM64MarioState state;
+    for( int i = 0; i < 200; i++ )
+    {
+        inputs.stickX = i < 100 ? 1.0f : 0.0f;
+        inputs.buttonA = i % 50 == 20;
+        sm64_mario_tick( marioId, &inputs, &state, NULL );
+    }
+
+    sm64_mario_delete( marioId );
+    sm64_level_unload();
+    sm64_recording_stop();
+
+    struct SM64ReplayStats stats;
+    memset( &stats, 0, sizeof( stats ));
+    CHECK( sm64_replay_run( path, SM64_REPLAY_CHECK_STATES | SM64_REPLAY_SKIP_GEOMETRY, &stats ));
+    CHECK( stats.ticks == 200 );
+    CHECK( stats.mismatches == 0 );
+
+    remove( path );
+}
+
+static uint32_t create_block_object( struct SM64Surface *surfaces, float x )
+{
+    struct SM64SurfaceObject object;
+    memset( &object, 0, sizeof( object ));
+    object.transform.position[0] = x;
+    object.surfaceCount = 2;
+    object.surfaces = surfaces;
+    return sm64_surface_object_create( &object );
+}
+
+static void check_replay_level_calls( void )
+{
+    const char *snapshotPath = "check_replay_level.sm64snap";
+    const char *path = "check_replay_level.sm64rec";
+
+    load_flat_level( 2, 1 );
+    CHECK( sm64_level_save_snapshot( snapshotPath ));
+    sm64_level_unload();
+
+    // The snapshot file is gone by the replay, the record must carry it.
+    CHECK( sm64_recording_start( path ));
+    CHECK( sm64_level_load_snapshot( snapshotPath ));
+    sm64_level_release_mesh_instances();
+    sm64_recording_stop();
+    sm64_level_unload();
+    remove( snapshotPath );
+
+    struct SM64ReplayStats stats;
+    memset( &stats, 0, sizeof( stats ));
+    CHECK( sm64_replay_run( path, 0, &stats ));
+    CHECK( stats.records == 2 );
+    struct SM64DebugSurface surfaces[8];
+    CHECK( level_get_room_slots_count() == 2 && sm64_level_get_room_debug_surfaces( 1, surfaces ) == 2 );
+    sm64_level_unload();
+
+    // A call that can't be replayed ends the recording and the replay fails on it.
+    CHECK( sm64_recording_start( path ));
+    recorder_log_unsupported( "sm64_level_attach_shared_rooms" );
+    CHECK( !recorder_active() );
+    CHECK( !sm64_replay_run( path, 0, NULL ));
+
+    remove( path );
+}
+
+static void check_surface_object_stale_ids( void )
+{
+    load_flat_level( 1, 0 );
+
+    struct SM64Surface block[2];
+    make_floor( block, 100, 10 );
+    struct SM64DebugSurface debug[2];
+
+    uint32_t first = create_block_object( block, 0.0f );
+    CHECK( sm64_surface_object_get_debug_surfaces( first, debug ) == 2 );
+    sm64_surface_object_delete( first );
+
+    // The slot is reused, the id of the deleted object must not reach the new one.
+    uint32_t second = create_block_object( block, 500.0f );
+    CHECK( second != first );
+    CHECK( sm64_surface_object_get_debug_surfaces( second, debug ) == 2 );
+    CHECK( sm64_surface_object_get_debug_surfaces( first, debug ) == 0 );
+
+    // Calls through the stale id are no-ops and leave the new object alone.
+    struct SM64ObjectTransform transform;
+    memset( &transform, 0, sizeof( transform ));
+    sm64_surface_object_move( first, &transform );
+    sm64_surface_object_delete( first );
+    CHECK( sm64_surface_object_get_debug_surfaces( second, debug ) == 2 );
+
+    sm64_surface_object_delete( second );
+    sm64_level_unload();
+}
+
+static void check_mario_stale_ids( void )
+{
+    load_flat_level( 1, 0 );
+
+    int rooms[] = { 0 };
+    int32_t first = sm64_mario_create( 0, 0, 0, 0, 0, 0, 0, rooms, 1 );
+    CHECK( first >= 0 );
+    sm64_mario_delete( first );
+
+    // The slot is reused, the id of the deleted Mario must not reach the new one.
+    int32_t second = sm64_mario_create( 500, 0, 0, 0, 0, 0, 0, rooms, 1 );
+    CHECK( second >= 0 && second != first );
+
+    static uint8_t state[SM64_MARIO_STATE_SIZE];
+    CHECK( !sm64_mario_save_state( first, state ));
+    CHECK( sm64_mario_save_state( second, state ));
+    CHECK( sm64_get_collision_surfaces_count( first ) == 0 );
+
+    // Calls through the stale id are no-ops and leave the new Mario alone.
+    struct SM64MarioInputs inputs;
+    memset( &inputs, 0, sizeof( inputs ));
+    struct SM64MarioState stale, live;
+    memset( &stale, 0, sizeof( stale ));
+    sm64_set_mario_position( first, 0, 1000, 0 );
+    sm64_mario_tick( first, &inputs, &stale, NULL );
+    sm64_mario_delete( first );
+    sm64_mario_tick( second, &inputs, &live, NULL );
+    CHECK( live.position[0] == 500.0f && live.position[1] < 1000.0f );
+
+    sm64_mario_delete( second );
+    sm64_level_unload();
+}
+
+static bool net_states_equal( const struct SM64MarioNetState *a, const struct SM64MarioNetState *b )
+{
+    return mario_states_equal( &a->state, &b->state )
+        && a->state.flags == b->state.flags
+        && a->animID == b->animID
+        && a->animFrame == b->animFrame
+        && a->animAccel == b->animAccel
+        && memcmp( a->rotation, b->rotation, sizeof( a->rotation )) == 0;
+}
+
+static void check_net_state_round_trip( void )
+{
+    // Values already on the quantization grid come back exactly.
+    struct SM64MarioNetState baseline, current, decoded;
+    memset( &baseline, 0, sizeof( baseline ));
+    baseline.state.position[0] = 100.0f;
+    baseline.state.position[1] = 50.5f;
+    baseline.state.health = 0x880;
+    baseline.state.action = ACT_IDLE;
+    baseline.animID = MARIO_ANIM_IDLE_HEAD_LEFT;
+
+    current = baseline;
+    current.state.position[0] = -1234.5625f;
+    current.state.velocity[2] = -3.25f;
+    current.state.action = ACT_WALKING;
+    current.state.flags = 0x12345678;
+    current.animID = MARIO_ANIM_WALKING;
+    current.animFrame = 17;
+    current.animAccel = -0x10000;
+    current.rotation[1] = -0x4000;
+
+    uint8_t buffer[256];
+    uint32_t size = sm64_mario_net_state_encode( &baseline, &current, buffer, sizeof( buffer ));
+    CHECK( size > 0 );
+    memset( &decoded, 0, sizeof( decoded ));
+    CHECK( sm64_mario_net_state_decode( &baseline, buffer, size, &decoded ) == size );
+    CHECK( net_states_equal( &decoded, &current ));
+
+    // Against a zeroed baseline.
+    size = sm64_mario_net_state_encode( NULL, &current, buffer, sizeof( buffer ));
+    CHECK( size > 0 );
+    memset( &decoded, 0xFF, sizeof( decoded ));
+    CHECK( sm64_mario_net_state_decode( NULL, buffer, size, &decoded ) == size );
+    CHECK( net_states_equal( &decoded, &current ));
+
+    // An unchanged state is just the empty field mask.
+    CHECK( sm64_mario_net_state_encode( &current, &current, buffer, sizeof( buffer )) == 1 );
+    CHECK( sm64_mario_net_state_decode( &current, buffer, 1, &decoded ) == 1 );
+    CHECK( net_states_equal( &decoded, &current ));
+
+    // Short buffers and truncated streams are rejected.
+    size = sm64_mario_net_state_encode( &baseline, &current, buffer, sizeof( buffer ));
+    CHECK( sm64_mario_net_state_encode( &baseline, &current, buffer, size - 1 ) == 0 );
+    CHECK( sm64_mario_net_state_decode( &baseline, buffer, size - 1, &decoded ) == 0 );
+}
+
+#define SNAPSHOT_MAX_SURFACES 16
+
+struct LevelDebugSurfaces
+{
+    uint32_t roomCounts[3];
+    struct SM64DebugSurface rooms[3][SNAPSHOT_MAX_SURFACES];
+    uint32_t objectCount;
+    struct SM64DebugSurface object[SNAPSHOT_MAX_SURFACES];
+};
+
+static void level_debug_surfaces_get( uint32_t objectId, struct LevelDebugSurfaces *out )
+{
+    memset( out, 0, sizeof( *out ));
+    for( uint32_t i = 0; i < 3; i++ )
+        out->roomCounts[i] = sm64_level_get_room_debug_surfaces( i, out->rooms[i] );
+    out->objectCount = sm64_surface_object_get_debug_surfaces( objectId, out->object );
+}
+
+static void check_level_snapshot_round_trip( void )
+{
+    const char *path = "check_level.sm64snap";
+
+    struct SM64Surface floor[2], step[2], block[2];
+    make_floor( floor, 4000, 0 );
+    make_floor( step, 300, 40 );
+    make_floor( block, 100, 10 );
+    sm64_level_init( 3 );
+    sm64_level_load_room( 0, floor, 2, NULL, 0 );
+    sm64_level_load_room( 2, step, 2, NULL, 0 );
+    uint32_t objectId = create_block_object( block, 250.0f );
+
+    struct LevelDebugSurfaces *saved = malloc( sizeof( struct LevelDebugSurfaces ));
+    struct LevelDebugSurfaces *loaded = malloc( sizeof( struct LevelDebugSurfaces ));
+    level_debug_surfaces_get( objectId, saved );
+    CHECK( saved->roomCounts[0] == 2 && saved->roomCounts[1] == 0 && saved->roomCounts[2] == 2 );
+    CHECK( saved->objectCount == 2 );
+
+    CHECK( sm64_level_save_snapshot( path ));
+    sm64_surface_object_delete( objectId );
+    sm64_level_unload();
+
+    // The snapshot replaces whatever level is loaded, surface object ids are kept.
+    load_flat_level( 1, 0 );
+    CHECK( sm64_level_load_snapshot( path ));
+    level_debug_surfaces_get( objectId, loaded );
+    CHECK( memcmp( saved, loaded, sizeof( struct LevelDebugSurfaces )) == 0 );
+
+    free( loaded );
+    free( saved );
+    sm64_surface_object_delete( objectId );
+    sm64_level_unload();
+    remove( path );
+}
+
+static void check_level_snapshot_oversized_counts( void )
+{
+    const char *path = "check_level_counts.sm64snap";
+
+    load_flat_level( 1, 0 );
+    CHECK( sm64_level_save_snapshot( path ));
+    sm64_level_unload();
+
+    // The rooms count follows six u32 of the header, a count far past the file size must be refused before allocating.
+    size_t size = 0;
+    uint8_t *data = utils_read_file_alloc( path, &size );
+    CHECK( data != NULL && size > 7 * sizeof( uint32_t ));
+    if( data != NULL && size > 7 * sizeof( uint32_t ))
+    {
+        uint32_t roomsCount = 0x40000000;
+        memcpy( data + 6 * sizeof( uint32_t ), &roomsCount, sizeof( roomsCount ));
+        FILE *f = fopen( path, "wb" );
+        CHECK( f != NULL && fwrite( data, size, 1, f ) == 1 );
+        if( f ) fclose( f );
+        CHECK( !sm64_level_load_snapshot( path ));
+    }
+
+    free( data );
+    remove( path );
+}
+
+static void check_shared_rooms_mesh_instances( void )
+{
+    char longName[300];
+    memset( longName, 'a', sizeof( longName ) - 1 );
+    longName[0] = '/';
+    longName[sizeof( longName ) - 1] = 0;
+    load_flat_level( 1, 0 );
+    CHECK( !sm64_level_share_rooms( longName ));
+    sm64_level_unload();
+
+#ifndef _WIN32
+    struct SM64Surface block[2];
+    make_floor( block, 100, 50 );
+    char name[64];
+    snprintf( name, sizeof( name ), "/libsm64-check-%d", (int)getpid() );
+
+    // The publisher lives in a child, a process can't attach the rooms it shares itself.
+    int ready[2], done[2];
+    CHECK( pipe( ready ) == 0 && pipe( done ) == 0 );
+    // Otherwise the child may write out a copy of the pending output.
+    fflush( stdout );
+    pid_t child = fork();
+    if( child == 0 )
+    {
+        close( done[1] );
+        struct SM64MeshInstance instances[3];
+        memset( instances, 0, sizeof( instances ));
+        load_flat_level( 1, 0 );
+        uint32_t meshId = sm64_level_register_mesh( block, 2 );
+        for( int i = 0; i < 3; i++ )
+        {
+            instances[i].meshId = meshId;
+            instances[i].transform.position[0] = 2000.0f * i;
+        }
+        sm64_level_load_room_mesh_instances( 0, instances, 3 );
+        char shared = sm64_level_share_rooms( name ) ? 1 : 0;
+        char byte;
+        if( write( ready[1], &shared, 1 ) != 1 || read( done[0], &byte, 1 ) < 0 )
+            shared = 0;
+        sm64_level_unload();
+        _exit( 0 );
+    }
+
+    char shared = 0;
+    CHECK( child > 0 && read( ready[0], &shared, 1 ) == 1 && shared == 1 );
+
+    sm64_level_init( 1 );
+    sm64_level_register_mesh( block, 2 );
+    CHECK( shared && sm64_level_attach_shared_rooms( name ) == 1 );
+
+    struct MarioLoadedRooms player;
+    uint32_t roomIds[1];
+    memset( &player, 0, sizeof( player ));
+    int rooms[] = { 0 };
+    level_load_player_loaded_rooms( 1000, &player, roomIds );
+    level_update_player_loaded_Rooms( 1000, rooms, 1 );
+    level_update_mesh_instances_query( 4000.0f, 0.0f, 50.0f );
+    CHECK( player.instancesQueryCount == 2 );
+    level_unload_player_loaded_rooms( 1000 );
+    sm64_level_unload();
+
+    close( done[1] );
+    if( child > 0 )
+        waitpid( child, NULL, 0 );
+    close( ready[0] );
+    close( ready[1] );
+    close( done[0] );
+#endif
+}
+
+static void check_clone_isolation( void )
+{
+    load_flat_level( 1, 0 );
+
+    int rooms[] = { 0 };
+    int32_t template = sm64_mario_create( 0, 0, 0, 0, 0, 0, 0, rooms, 1 );
+    int32_t created = sm64_mario_create( 500, 0, 0, 0, 0, 0, 0, rooms, 1 );
+    int32_t clone = sm64_mario_clone( template, 500, 0, 0, 0, 0, 0, rooms, 1 );
+    CHECK( template >= 0 && created >= 0 && clone >= 0 );
+
+    static uint8_t before[SM64_MARIO_STATE_SIZE], after[SM64_MARIO_STATE_SIZE];
+    memset( before, 0, sizeof( before ));
+    memset( after, 0, sizeof( after ));
+    CHECK( sm64_mario_save_state( template, before ));
+
+    // A clone of a Mario that never ticked behaves like one created at the same spot.
+    struct SM64MarioInputs inputs;
+    memset( &inputs, 0, sizeof( inputs ));
+    inputs.stickX = 1.0f;
+    struct SM64MarioState createdState, cloneState;
+    bool same = true;
+    for( int i = 0; i < 60 && same; i++ )
+    {
+        inputs.buttonA = i == 40;
+        sm64_mario_tick( created, &inputs, &createdState, NULL );
+        sm64_mario_tick( clone, &inputs, &cloneState, NULL );
+        same = mario_states_equal( &createdState, &cloneState );
+    }
+    CHECK( same );
+
+    // Ticking and changing the clone leaves the template alone, and the clone outlives it.
+    sm64_set_mario_water_level( clone, 100 );
+    CHECK( sm64_mario_save_state( template, after ));
+    CHECK( memcmp( before, after, sizeof( before )) == 0 );
+    CHECK( sm64_get_mario_water_level( template ) != 100 );
+
+    sm64_mario_delete( template );
+    sm64_mario_tick( clone, &inputs, &cloneState, NULL );
+    CHECK( sm64_get_mario_water_level( clone ) == 100 );
+
+    sm64_mario_delete( clone );
+    sm64_mario_delete( created );
+    sm64_level_unload();
+}
+
+struct Check
+{
+    const char *name;
+    void (*run)( void );
+    bool needsRom;
+};
+
+static const struct Check s_all_checks[] = {
+    { "create in fresh level", check_create_in_fresh_level, true },
+    { "idle skip matches full ticks", check_idle_skip_matches_full_ticks, true },
+    { "idle wakes on surface object move", check_idle_wakes_on_object_move, true },
+    { "layout stamp sees nearby changes", check_layout_stamp_sees_nearby_changes, false },
+    { "surface ref of the water pseudo floor", check_surface_ref_water_pseudo_floor, false },
+    { "surface refs of every owner", check_surface_refs_of_every_owner, false },
+    { "save load round trip", check_save_load_round_trip, true },
+    { "fork isolation", check_fork_isolation, true },
+    { "collision export of mesh instances", check_collision_export_mesh_instances, true },
+    { "mesh instances stay in place", check_mesh_instances_stay_in_place, false },
+    { "mesh instances query matches their bounds", check_mesh_instances_query_matches_bounds, false },
+    { "mesh instances freed without batches", check_mesh_instances_freed_without_batches, false },
+    { "loaded rooms records grow", check_loaded_rooms_records_grow, false },
+    { "many Marios keep their rooms", check_many_marios_keep_their_rooms, true },
+    { "batch matches single ticks", check_batch_matches_single_ticks, true },
+    { "batch skips repeated ids", check_batch_skips_repeated_ids, true },
+    { "replay matches recording", check_replay_matches_recording, true },
+    { "replay of level calls", check_replay_level_calls, false },
+    { "stale surface object ids", check_surface_object_stale_ids, false },
+    { "stale Mario ids", check_mario_stale_ids, true },
+    { "net state round trip", check_net_state_round_trip, false },
+    { "level snapshot round trip", check_level_snapshot_round_trip, false },
+    { "level snapshot with oversized counts", check_level_snapshot_oversized_counts, false },
+    { "shared rooms carry mesh instances", check_shared_rooms_mesh_instances, false },
+    { "clone isolation", check_clone_isolation, true },
+};
+
+int main( void )
+{
+    uint8_t *rom = utils_read_file_alloc( "baserom.us.z64", NULL );
+    uint8_t *texture = NULL;
+
+    if( rom != NULL )
+    {
+        texture = malloc( 4 * SM64_TEXTURE_WIDTH * SM64_TEXTURE_HEIGHT );
+        sm64_global_init( rom, texture, NULL );
+        s_has_rom = true;
+    }
+
+    for( size_t i = 0; i < sizeof( s_all_checks ) / sizeof( s_all_checks[0] ); i++ )
+    {
+        const struct Check *check = &s_all_checks[i];
+
+        if( check->needsRom && !s_has_rom )
+        {
+            printf( "SKIP %s (no baserom.us.z64)\n", check->name );
+            continue;
+        }
+
+        int failuresBefore = s_failures;
+        check->run();
+        printf( "%s %s\n", s_failures == failuresBefore ? "PASS" : "FAIL", check->name );
+    }
+
+    if( s_has_rom )
+        sm64_global_terminate();
+
+    free( texture );
+    free( rom );
+
+    printf( "%d checks, %d failed\n", s_checks, s_failures );
+    return s_failures == 0 ? 0 : 1;
+}